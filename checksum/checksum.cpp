@@ -0,0 +1,312 @@
+#include "checksum.h"
+#include "../cpu/cpu.h"
+
+#if IMAGELIB_X86
+#include <immintrin.h>
+#endif
+
+using namespace Generic::cpu;
+
+namespace Generic {
+	namespace checksum {
+		static const uint32_t base = 65521; //largest prime smaller than 65536
+		static const size_t nmax = 5552; //largest n such that 255n(n+1)/2 + (n+1)(base-1) fits in 32 bits
+
+		/* Works on the crc register (ie. already inverted) so the vector version can hand its tail over */
+		static uint32_t CRC32Scalar(const uint8_t* data, size_t length, uint32_t crc) {
+			/* Slicing-by-8 for the bulk of the data */
+			while (length >= 8) {
+				uint32_t one = (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24) ^ crc;
+				uint32_t two = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t)data[7] << 24;
+				crc = crcTables[7][one & 0xFF] ^ crcTables[6][(one >> 8) & 0xFF] ^ crcTables[5][(one >> 16) & 0xFF] ^ crcTables[4][one >> 24] ^
+					crcTables[3][two & 0xFF] ^ crcTables[2][(two >> 8) & 0xFF] ^ crcTables[1][(two >> 16) & 0xFF] ^ crcTables[0][two >> 24];
+				data += 8;
+				length -= 8;
+			}
+			while (length--) {
+				crc = crcTables[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+			}
+
+			return crc;
+		}
+
+		static uint32_t Adler32Scalar(const uint8_t* data, size_t length, uint32_t adler) {
+			uint32_t a = adler & 0xFFFF;
+			uint32_t b = adler >> 16;
+
+			/* Only take the modulo once per nmax bytes */
+			while (length > 0) {
+				size_t block = length < nmax ? length : nmax;
+				length -= block;
+				while (block--) {
+					a += *data++;
+					b += a;
+				}
+				a %= base;
+				b %= base;
+			}
+
+			return (b << 16) | a;
+		}
+
+
+
+		/* ======= Vector kernels ======= */
+#if IMAGELIB_X86
+		/* CRC by carry-less multiplication (Intel, "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ"): four 128-bit accumulators are folded forward over
+		64 bytes at a time, then folded into one, and Barrett reduced to 32 bits. Constants are powers of x modulo the (reflected) polynomial, as used by zlib / chromium
+		*/
+		IMAGELIB_TARGET("sse4.1,pclmul") static uint32_t CRC32PCLMUL(const uint8_t* data, size_t length, uint32_t crc) {
+			if (length < 64) {
+				return CRC32Scalar(data, length, crc);
+			}
+
+			alignas(16) static const uint64_t k1k2[] = { 0x0154442BD4, 0x01C6E41596 }; //fold by 4 x 128 bits
+			alignas(16) static const uint64_t k3k4[] = { 0x01751997D0, 0x00CCAA009E }; //fold by 128 bits
+			alignas(16) static const uint64_t k5k0[] = { 0x0163CD6124, 0x0000000000 }; //fold 64 bits into 32
+			alignas(16) static const uint64_t poly[] = { 0x01DB710641, 0x01F7011641 }; //polynomial & its Barrett constant
+
+			__m128i x1 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+			__m128i x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+			__m128i x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+			__m128i x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+			x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+			__m128i k = _mm_load_si128((const __m128i*)k1k2);
+			data += 64;
+			length -= 64;
+
+			while (length >= 64) {
+				__m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+				__m128i x6 = _mm_clmulepi64_si128(x2, k, 0x00);
+				__m128i x7 = _mm_clmulepi64_si128(x3, k, 0x00);
+				__m128i x8 = _mm_clmulepi64_si128(x4, k, 0x00);
+				x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+				x2 = _mm_clmulepi64_si128(x2, k, 0x11);
+				x3 = _mm_clmulepi64_si128(x3, k, 0x11);
+				x4 = _mm_clmulepi64_si128(x4, k, 0x11);
+
+				x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(data + 0x00)));
+				x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(data + 0x10)));
+				x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(data + 0x20)));
+				x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(data + 0x30)));
+				data += 64;
+				length -= 64;
+			}
+
+			/* Fold the four accumulators into one, then any remaining 16 byte blocks into that */
+			k = _mm_load_si128((const __m128i*)k3k4);
+			for (__m128i next : { x2, x3, x4 }) {
+				__m128i low = _mm_clmulepi64_si128(x1, k, 0x00);
+				x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x11), next), low);
+			}
+			while (length >= 16) {
+				__m128i low = _mm_clmulepi64_si128(x1, k, 0x00);
+				x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x11), _mm_loadu_si128((const __m128i*)data)), low);
+				data += 16;
+				length -= 16;
+			}
+
+			/* 128 bits to 64, then 64 to 32 */
+			const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+			__m128i x0 = _mm_clmulepi64_si128(x1, k, 0x10);
+			x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x0);
+			k = _mm_loadl_epi64((const __m128i*)k5k0);
+			x0 = _mm_srli_si128(x1, 4);
+			x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x00), x0);
+
+			/* Barrett reduction */
+			k = _mm_load_si128((const __m128i*)poly);
+			x0 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k, 0x10);
+			x0 = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), k, 0x00);
+			x1 = _mm_xor_si128(x1, x0);
+			crc = (uint32_t)_mm_extract_epi32(x1, 1);
+
+			return CRC32Scalar(data, length, crc);
+		}
+
+		/* Adler-32 over blocks of 32 bytes (as in chromium's adler32_simd): a is a sum of absolute differences against zero, and b adds each byte weighted by its distance from the end of the block
+		plus 32 times the value a had at the start of each block (accumulated in ps)
+		*/
+		IMAGELIB_TARGET("ssse3") static uint32_t Adler32SSSE3(const uint8_t* data, size_t length, uint32_t adler) {
+			const size_t blockSize = 32;
+			uint32_t a = adler & 0xFFFF;
+			uint32_t b = adler >> 16;
+
+			const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+			const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i ones = _mm_set1_epi16(1);
+
+			size_t blocks = length / blockSize;
+			length -= blocks * blockSize;
+			while (blocks) {
+				size_t n = nmax / blockSize;
+				if (n > blocks) { n = blocks; }
+				blocks -= n;
+
+				__m128i ps = _mm_cvtsi32_si128(a * (uint32_t)n);
+				__m128i vb = _mm_cvtsi32_si128(b);
+				__m128i va = zero;
+				do {
+					const __m128i bytes1 = _mm_loadu_si128((const __m128i*)data);
+					const __m128i bytes2 = _mm_loadu_si128((const __m128i*)(data + 16));
+					ps = _mm_add_epi32(ps, va);
+					va = _mm_add_epi32(va, _mm_add_epi32(_mm_sad_epu8(bytes1, zero), _mm_sad_epu8(bytes2, zero)));
+					vb = _mm_add_epi32(vb, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+					vb = _mm_add_epi32(vb, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+					data += blockSize;
+				} while (--n);
+				vb = _mm_add_epi32(vb, _mm_slli_epi32(ps, 5));
+
+				/* Horizontal sums */
+				va = _mm_add_epi32(va, _mm_shuffle_epi32(va, _MM_SHUFFLE(2, 3, 0, 1)));
+				va = _mm_add_epi32(va, _mm_shuffle_epi32(va, _MM_SHUFFLE(1, 0, 3, 2)));
+				vb = _mm_add_epi32(vb, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 3, 0, 1)));
+				vb = _mm_add_epi32(vb, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2)));
+				a = (a + (uint32_t)_mm_cvtsi128_si32(va)) % base;
+				b = (uint32_t)_mm_cvtsi128_si32(vb) % base;
+			}
+
+			return Adler32Scalar(data, length, (b << 16) | a);
+		}
+
+		/* Same as the SSSE3 version, on 64 byte blocks */
+		IMAGELIB_TARGET("avx2") static uint32_t Adler32AVX2(const uint8_t* data, size_t length, uint32_t adler) {
+			const size_t blockSize = 64;
+			uint32_t a = adler & 0xFFFF;
+			uint32_t b = adler >> 16;
+
+			const __m256i tap1 = _mm256_setr_epi8(64, 63, 62, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49, 48, 47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33);
+			const __m256i tap2 = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+			const __m256i zero = _mm256_setzero_si256();
+			const __m256i ones = _mm256_set1_epi16(1);
+
+			size_t blocks = length / blockSize;
+			length -= blocks * blockSize;
+			while (blocks) {
+				size_t n = nmax / blockSize;
+				if (n > blocks) { n = blocks; }
+				blocks -= n;
+
+				__m256i ps = _mm256_setr_epi32(a * (uint32_t)n, 0, 0, 0, 0, 0, 0, 0);
+				__m256i vb = _mm256_setr_epi32(b, 0, 0, 0, 0, 0, 0, 0);
+				__m256i va = zero;
+				do {
+					const __m256i bytes1 = _mm256_loadu_si256((const __m256i*)data);
+					const __m256i bytes2 = _mm256_loadu_si256((const __m256i*)(data + 32));
+					ps = _mm256_add_epi32(ps, va);
+					va = _mm256_add_epi32(va, _mm256_add_epi32(_mm256_sad_epu8(bytes1, zero), _mm256_sad_epu8(bytes2, zero)));
+					vb = _mm256_add_epi32(vb, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes1, tap1), ones));
+					vb = _mm256_add_epi32(vb, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes2, tap2), ones));
+					data += blockSize;
+				} while (--n);
+				vb = _mm256_add_epi32(vb, _mm256_slli_epi32(ps, 6));
+
+				/* Horizontal sums (halves first) */
+				__m128i va128 = _mm_add_epi32(_mm256_castsi256_si128(va), _mm256_extracti128_si256(va, 1));
+				__m128i vb128 = _mm_add_epi32(_mm256_castsi256_si128(vb), _mm256_extracti128_si256(vb, 1));
+				va128 = _mm_add_epi32(va128, _mm_shuffle_epi32(va128, _MM_SHUFFLE(2, 3, 0, 1)));
+				va128 = _mm_add_epi32(va128, _mm_shuffle_epi32(va128, _MM_SHUFFLE(1, 0, 3, 2)));
+				vb128 = _mm_add_epi32(vb128, _mm_shuffle_epi32(vb128, _MM_SHUFFLE(2, 3, 0, 1)));
+				vb128 = _mm_add_epi32(vb128, _mm_shuffle_epi32(vb128, _MM_SHUFFLE(1, 0, 3, 2)));
+				a = (a + (uint32_t)_mm_cvtsi128_si32(va128)) % base;
+				b = (uint32_t)_mm_cvtsi128_si32(vb128) % base;
+			}
+
+			return Adler32Scalar(data, length, (b << 16) | a);
+		}
+#endif
+
+		using ChecksumFunction = uint32_t(*)(const uint8_t* data, size_t length, uint32_t value);
+
+		/* Picked once at startup (AVX-512 brings nothing over AVX2 here, so that level uses the AVX2 kernels) */
+		static ChecksumFunction SelectCRC32() {
+#if IMAGELIB_X86
+			if (GetSIMDLevel() >= SIMDLevel::SSE41 && GetFeatures().pclmul) {
+				return CRC32PCLMUL;
+			}
+#endif
+			return CRC32Scalar;
+		}
+		static ChecksumFunction SelectAdler32() {
+#if IMAGELIB_X86
+			if (GetSIMDLevel() >= SIMDLevel::AVX2) {
+				return Adler32AVX2;
+			}
+			if (GetSIMDLevel() >= SIMDLevel::SSE41) {
+				return Adler32SSSE3;
+			}
+#endif
+			return Adler32Scalar;
+		}
+		static const ChecksumFunction crc32Kernel = SelectCRC32();
+		static const ChecksumFunction adler32Kernel = SelectAdler32();
+
+		uint32_t CRC32(const uint8_t* data, size_t length, uint32_t crc) {
+			return ~crc32Kernel(data, length, ~crc);
+		}
+
+		uint32_t Adler32(const uint8_t* data, size_t length, uint32_t adler) {
+			return adler32Kernel(data, length, adler);
+		}
+
+		/* Multiplication of two polynomials modulo the crc polynomial (bit 31 holds x^0, matching the reflected crc) */
+		static constexpr uint32_t MultiplyModP(uint32_t a, uint32_t b) {
+			uint32_t m = 1u << 31;
+			uint32_t p = 0;
+			while (true) {
+				if (a & m) {
+					p ^= b;
+					if ((a & (m - 1)) == 0) {
+						break;
+					}
+				}
+				m >>= 1;
+				b = (b & 1) ? (b >> 1) ^ 0xEDB88320u : b >> 1;
+			}
+			return p;
+		}
+
+		/* x^(n * 2^k) modulo the crc polynomial, by repeated squaring */
+		static uint32_t PowerModP(uint64_t n, unsigned int k) {
+			static constexpr std::array<uint32_t, 32> squares{ []() consteval {
+				std::array<uint32_t, 32> result{};
+				uint32_t p = 1u << 30; //x^1
+				result[0] = p;
+				for (int n = 1; n < 32; n++) {
+					result[n] = p = MultiplyModP(p, p);
+				}
+				return result;
+			}() };
+
+			uint32_t p = 1u << 31; //x^0
+			while (n) {
+				if (n & 1) {
+					p = MultiplyModP(squares[k & 31], p);
+				}
+				n >>= 1;
+				k++;
+			}
+			return p;
+		}
+
+		uint32_t CRC32Combine(uint32_t crcFirst, uint32_t crcSecond, uint64_t lengthSecond) {
+			return MultiplyModP(PowerModP(lengthSecond, 3), crcFirst) ^ crcSecond; //shift the first crc past lengthSecond * 8 zero bits
+		}
+
+		uint32_t Adler32Combine(uint32_t adlerFirst, uint32_t adlerSecond, uint64_t lengthSecond) {
+			uint32_t remainder = (uint32_t)(lengthSecond % base);
+			uint32_t a = adlerFirst & 0xFFFF;
+			uint32_t b = (uint32_t)(((uint64_t)remainder * a) % base);
+
+			a += (adlerSecond & 0xFFFF) + base - 1;
+			b += (adlerFirst >> 16) + (adlerSecond >> 16) + base - remainder;
+			if (a >= base) { a -= base; }
+			if (a >= base) { a -= base; }
+			if (b >= (base << 1)) { b -= (base << 1); }
+			if (b >= base) { b -= base; }
+
+			return (b << 16) | a;
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+
+namespace Generic {
+	namespace checksum {
+		/* CRC-32 as used by gzip (RFC 1952) and png chunks (reflected polynomial 0xEDB88320)
+		Tables are built at compile time for slicing-by-8 (8 bytes consumed per step)
+		*/
+		static constexpr std::array<std::array<uint32_t, 256>, 8> crcTables{ []() consteval {
+			std::array<std::array<uint32_t, 256>, 8> result{};
+			for (uint32_t n = 0; n < 256; n++) {
+				uint32_t c = n;
+				for (int k = 0; k < 8; k++) {
+					c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				}
+				result[0][n] = c;
+			}
+			for (uint32_t n = 0; n < 256; n++) {
+				for (int slice = 1; slice < 8; slice++) {
+					result[slice][n] = (result[slice - 1][n] >> 8) ^ result[0][result[slice - 1][n] & 0xFF];
+				}
+			}
+			return result;
+		}() };
+
+		/* Running checksums; pass the previous return value back in to continue (start with the default value) */
+		uint32_t CRC32(const uint8_t* data, size_t length, uint32_t crc = 0);
+		uint32_t Adler32(const uint8_t* data, size_t length, uint32_t adler = 1);
+
+		/* Checksum of two consecutive pieces of data from the checksums of each piece (second is lengthSecond bytes long), so pieces can be summed independently */
+		uint32_t CRC32Combine(uint32_t crcFirst, uint32_t crcSecond, uint64_t lengthSecond);
+		uint32_t Adler32Combine(uint32_t adlerFirst, uint32_t adlerSecond, uint64_t lengthSecond);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "cpu.h"
+#include <cstdlib>
+#include <cstring>
+
+#if IMAGELIB_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace Generic {
+	namespace cpu {
+#if IMAGELIB_X86
+		static void CPUID(const unsigned int leaf, const unsigned int subleaf, unsigned int registers[4]) {
+#if defined(_MSC_VER)
+			int values[4] = {};
+			__cpuidex(values, (int)leaf, (int)subleaf);
+			for (int i = 0; i < 4; i++) {
+				registers[i] = (unsigned int)values[i];
+			}
+#else
+			registers[0] = registers[1] = registers[2] = registers[3] = 0;
+			__get_cpuid_count(leaf, subleaf, &registers[0], &registers[1], &registers[2], &registers[3]);
+#endif
+		}
+
+		/* Which register states the OS saves on context switch (XCR0) */
+		static uint64_t XGETBV() {
+#if defined(_MSC_VER)
+			return _xgetbv(0);
+#else
+			unsigned int eax = 0;
+			unsigned int edx = 0;
+			__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+			return ((uint64_t)edx << 32) | eax;
+#endif
+		}
+
+		static Features DetectFeatures() {
+			Features features;
+			unsigned int registers[4] = {}; //eax, ebx, ecx, edx
+
+			CPUID(0, 0, registers);
+			unsigned int maxLeaf = registers[0];
+			if (maxLeaf < 1) {
+				return features;
+			}
+
+			CPUID(1, 0, registers);
+			features.ssse3 = registers[2] & (1 << 9);
+			features.sse41 = registers[2] & (1 << 19);
+			features.pclmul = registers[2] & (1 << 1);
+			bool osxsave = registers[2] & (1 << 27);
+			bool avx = registers[2] & (1 << 28);
+
+			if (!osxsave || !avx || maxLeaf < 7) {
+				return features;
+			}
+			uint64_t xcr0 = XGETBV();
+			bool ymmState = (xcr0 & 0x6) == 0x6; //sse + avx state
+			bool zmmState = (xcr0 & 0xE6) == 0xE6; //opmask + upper zmm registers too
+
+			CPUID(7, 0, registers);
+			features.avx2 = ymmState && (registers[1] & (1 << 5));
+			features.avx512 = zmmState && (registers[1] & (1 << 16)) && (registers[1] & (1 << 30)); //F, BW
+			features.bmi2 = registers[1] & (1 << 8);
+
+			return features;
+		}
+#else
+		static Features DetectFeatures() {
+			return Features();
+		}
+#endif
+
+		static SIMDLevel HighestLevel(const Features& features) {
+			if (!features.ssse3 || !features.sse41) { return SIMDLevel::Scalar; }
+			if (!features.avx2) { return SIMDLevel::SSE41; }
+			if (!features.avx512) { return SIMDLevel::AVX2; }
+			return SIMDLevel::AVX512;
+		}
+
+		const Features& GetFeatures() {
+			static const Features features = DetectFeatures();
+			return features;
+		}
+
+		/* IMAGELIB_SIMD (scalar, sse4.1, avx2 or avx512) lowers the starting level without rebuilding, since kernels are picked before main could call SetSIMDLevel */
+		static SIMDLevel StartingLevel() {
+			SIMDLevel highest = HighestLevel(GetFeatures());
+			const char* requested = getenv("IMAGELIB_SIMD");
+			if (requested == nullptr) {
+				return highest;
+			}
+
+			SIMDLevel level = highest;
+			for (SIMDLevel candidate : { SIMDLevel::Scalar, SIMDLevel::SSE41, SIMDLevel::AVX2, SIMDLevel::AVX512 }) {
+				const char* name = candidate == SIMDLevel::Scalar ? "scalar" : candidate == SIMDLevel::SSE41 ? "sse4.1" : candidate == SIMDLevel::AVX2 ? "avx2" : "avx512";
+				if (strcmp(requested, name) == 0) {
+					level = candidate;
+				}
+			}
+			return level < highest ? level : highest;
+		}
+
+		static SIMDLevel& CurrentLevel() {
+			static SIMDLevel level = StartingLevel();
+			return level;
+		}
+
+		SIMDLevel GetSIMDLevel() {
+			return CurrentLevel();
+		}
+
+		void SetSIMDLevel(const SIMDLevel level) {
+			SIMDLevel highest = HighestLevel(GetFeatures());
+			CurrentLevel() = level < highest ? level : highest;
+		}
+
+		const char* SIMDLevelName(const SIMDLevel level) {
+			switch (level) {
+			case SIMDLevel::SSE41:
+				return "SSE4.1";
+			case SIMDLevel::AVX2:
+				return "AVX2";
+			case SIMDLevel::AVX512:
+				return "AVX-512";
+			default:
+				return "Scalar";
+			}
+		}
+	}
+}
\ No newline at end of file
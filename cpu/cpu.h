@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+/* Vector kernels are only built for x86 / x64 (everything else runs the scalar versions) */
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define IMAGELIB_X86 1
+#else
+#define IMAGELIB_X86 0
+#endif
+
+/* Marks a function as compiled for a given instruction set (gcc / clang syntax, eg. "avx2" or "sse4.1,pclmul"), so it can sit in the same file as code for older CPUs
+MSVC emits whatever intrinsics are used without needing this, so it expands to nothing there
+A function marked this way must only be called after checking the CPU supports it (see GetSIMDLevel)
+*/
+#if defined(_MSC_VER) && !defined(__clang__)
+#define IMAGELIB_TARGET(isa)
+#else
+#define IMAGELIB_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* Forces a body shared by several IMAGELIB_TARGET functions into each of them, so it is compiled for each instruction set (gcc / clang won't inline it across targets otherwise) */
+#if defined(_MSC_VER) && !defined(__clang__)
+#define IMAGELIB_INLINE __forceinline
+#else
+#define IMAGELIB_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace Generic {
+	namespace cpu {
+		/* Each level includes everything below it */
+		enum class SIMDLevel : uint8_t {
+			Scalar,
+			SSE41, //SSSE3 + SSE4.1
+			AVX2,
+			AVX512, //AVX-512 F + BW
+		};
+
+		struct Features {
+			bool ssse3 = false;
+			bool sse41 = false;
+			bool pclmul = false;
+			bool avx2 = false;
+			bool avx512 = false; //F + BW, with the OS saving zmm state
+			bool bmi2 = false; //only looked for on CPUs with AVX
+		};
+
+		/* Queried through cpuid (and xgetbv for OS support of ymm / zmm registers) once, on first use */
+		const Features& GetFeatures();
+
+		/* Highest level the CPU supports, unless lowered by SetSIMDLevel or the IMAGELIB_SIMD environment variable (scalar, sse4.1, avx2 or avx512) */
+		SIMDLevel GetSIMDLevel();
+
+		/* Lowers the level kernels are picked from (eg. to compare kernels, or to rule out a faulty path); levels above what the CPU supports are clamped
+		Kernels are picked when their module starts up, so this only affects code that asks for a kernel afterwards
+		*/
+		void SetSIMDLevel(const SIMDLevel level);
+
+		const char* SIMDLevelName(const SIMDLevel level);
+	}
+}
\ No newline at end of file
@@ -1,7 +1,120 @@
 #include "huffman.h"
+#include <algorithm>
 
 namespace Generic {
 	namespace huffman {
-		
+		/* Huffman's algorithm on the symbols sorted by frequency, using two queues (leaves in order, and internal nodes which are made in increasing order of weight)
+		Lengths over maxLength are then brought back in by adjusting the number of codes of each length (as the JPEG standard does, annex K.3),
+		and the lengths handed out again so that the least frequent symbols get the longest codes
+		*/
+		void BuildLengths(const uint32_t* frequencies, const unsigned int count, const unsigned int maxLength, uint8_t* lengths) {
+			unsigned short symbols[max_build_symbols];
+			uint32_t weight[2 * max_build_symbols];
+			unsigned short parent[2 * max_build_symbols];
+			unsigned short depth[2 * max_build_symbols];
+			unsigned int lengthCount[2 * max_build_symbols] = {};
+
+			memset(lengths, 0, count);
+			unsigned int used = 0;
+			for (unsigned int symbol = 0; symbol < count; symbol++) {
+				if (frequencies[symbol] != 0) {
+					symbols[used++] = (unsigned short)symbol;
+				}
+			}
+			for (unsigned int symbol = 0; used < 2 && symbol < count; symbol++) {
+				if (frequencies[symbol] == 0) {
+					symbols[used++] = (unsigned short)symbol;
+				}
+			}
+			if (used < 2) {
+				lengths[symbols[0]] = 1;
+				return;
+			}
+
+			std::sort(symbols, symbols + used, [frequencies](const unsigned short a, const unsigned short b) {
+				return frequencies[a] != frequencies[b] ? frequencies[a] < frequencies[b] : a < b;
+			});
+			for (unsigned int i = 0; i < used; i++) {
+				weight[i] = frequencies[symbols[i]] > 0 ? frequencies[symbols[i]] : 1;
+			}
+
+			/* Leaves are nodes 0 to used - 1, internal nodes follow (the root is made last) */
+			unsigned int leaf = 0;
+			unsigned int internal = used;
+			unsigned int nodes = used;
+			auto smallest = [&]() {
+				if (leaf < used && (internal == nodes || weight[leaf] <= weight[internal])) {
+					return leaf++;
+				}
+				return internal++;
+			};
+			while (nodes < 2 * used - 1) {
+				unsigned int a = smallest();
+				unsigned int b = smallest();
+				weight[nodes] = weight[a] + weight[b];
+				parent[a] = parent[b] = (unsigned short)nodes;
+				nodes++;
+			}
+
+			depth[nodes - 1] = 0;
+			for (int node = (int)nodes - 2; node >= 0; node--) {
+				depth[node] = depth[parent[node]] + 1;
+			}
+			unsigned int longest = 0;
+			for (unsigned int i = 0; i < used; i++) {
+				lengthCount[depth[i]]++;
+				longest = std::max<unsigned int>(longest, depth[i]);
+			}
+
+			/* Two codes of the longest length are replaced by one a bit shorter, and a code one bit shorter than that is split in two, until nothing is over the limit */
+			for (unsigned int length = longest; length > maxLength; length--) {
+				while (lengthCount[length] > 0) {
+					unsigned int shorter = length - 2;
+					while (lengthCount[shorter] == 0) {
+						shorter--;
+					}
+					lengthCount[length] -= 2;
+					lengthCount[length - 1]++;
+					lengthCount[shorter + 1] += 2;
+					lengthCount[shorter]--;
+				}
+			}
+
+			/* symbols is in increasing frequency, so the longest codes go first */
+			unsigned int next = 0;
+			for (unsigned int length = std::min(longest, maxLength); length > 0; length--) {
+				for (unsigned int i = 0; i < lengthCount[length]; i++) {
+					lengths[symbols[next++]] = (uint8_t)length;
+				}
+			}
+		}
+
+		void BuildCodes(const uint8_t* lengths, const unsigned int count, uint16_t* codes) {
+			unsigned short lengthCount[max_code_length + 1] = {};
+			unsigned short nextCode[max_code_length + 1] = {};
+			for (unsigned int symbol = 0; symbol < count; symbol++) {
+				lengthCount[lengths[symbol]]++;
+			}
+			lengthCount[0] = 0;
+			unsigned short code = 0;
+			for (unsigned int length = 1; length <= max_code_length; length++) {
+				code = (code + lengthCount[length - 1]) << 1;
+				nextCode[length] = code;
+			}
+
+			for (unsigned int symbol = 0; symbol < count; symbol++) {
+				const unsigned int length = lengths[symbol];
+				if (length == 0) {
+					codes[symbol] = 0;
+					continue;
+				}
+				unsigned int value = nextCode[length]++;
+				unsigned int reversed = 0;
+				for (unsigned int bit = 0; bit < length; bit++) {
+					reversed = (reversed << 1) | ((value >> bit) & 1);
+				}
+				codes[symbol] = (uint16_t)reversed;
+			}
+		}
 	}
 }
\ No newline at end of file
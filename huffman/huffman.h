@@ -4,6 +4,18 @@
 
 namespace Generic {
 	namespace huffman {
+		/* Most symbols BuildLengths takes (DEFLATE's 288 literal / length codes) */
+		static const unsigned short max_build_symbols = 288;
+		static const unsigned short max_code_length = 15; //longest code BuildCodes takes
+
+		/* Code lengths of an optimal prefix code limited to maxLength bits, for symbols used frequencies[symbol] times (unused symbols get 0)
+		At least two symbols always get a code, so that the code is complete (symbols 0 and 1 are used to make up the numbers if needed)
+		*/
+		void BuildLengths(const uint32_t* frequencies, const unsigned int count, const unsigned int maxLength, uint8_t* lengths);
+
+		/* Canonical codes for the lengths (RFC 1951 3.2.2), bit-reversed so that they can be written least-significant bit first */
+		void BuildCodes(const uint8_t* lengths, const unsigned int count, uint16_t* codes);
+
 		/* from puff.c
 		will develop my own version later once the zlib stream and png decoder is working
 		*/
@@ -12,6 +24,12 @@ namespace Generic {
 			short count[max_count_size] = {};
 			short symbol[max_symbol_size] = {};
 
+			/* Lookup for codes of up to fast_bits, indexed by the next fast_bits of input (first bit in the lowest position)
+			Entries are (symbol << 4) | code length; 0 means the code is longer and needs the canonical decode
+			*/
+			static const unsigned short fast_bits = 9;
+			unsigned short fast[1 << fast_bits] = {};
+
 			int construct(const short* codeLengths, const unsigned int codeLengthsSize = max_symbol_size) {
 				int symbol;
 				int length;
@@ -19,8 +37,9 @@ namespace Generic {
 				short offs[max_count_size] = {};
 
 				/* Reset arrays (between construct uses, if reused) */
-				memset(count, 0, max_count_size);
-				memset(this->symbol, 0, max_symbol_size);
+				memset(count, 0, sizeof(count));
+				memset(this->symbol, 0, sizeof(this->symbol));
+				memset(fast, 0, sizeof(fast));
 
 				/* Count number of codes of each length */
 				for (symbol = 0; symbol < codeLengthsSize; symbol++) {
@@ -51,9 +70,60 @@ namespace Generic {
 					}
 				}
 
+				constructFast();
 				return codesLeft;
 			}
 
+			/* Codes are assigned canonically (RFC 1951 3.2.2), but are packed starting from their most significant bit, so the table is indexed by the reversed code */
+			void constructFast() {
+				int code = 0;
+				int index = 0;
+				for (int length = 1; length <= fast_bits && length < max_count_size; length++) {
+					for (int i = 0; i < count[length]; i++) {
+						int reversed = 0;
+						for (int bit = 0; bit < length; bit++) {
+							reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+						}
+						for (int fill = reversed; fill < (1 << fast_bits); fill += 1 << length) {
+							fast[fill] = (unsigned short)((this->symbol[index] << 4) | length);
+						}
+						code++;
+						index++;
+					}
+					code <<= 1;
+				}
+			}
+
+			/* Decodes from bits already peeked from the stream (at least max_count_size - 1 of them, first bit in the lowest position)
+			Sets used to the number of bits the code took, returns -1 for an invalid code
+			*/
+			int decode(const uint32_t bits, unsigned int* used) const {
+				unsigned short entry = fast[bits & ((1 << fast_bits) - 1)];
+				if (entry != 0) {
+					*used = entry & 0xF;
+					return entry >> 4;
+				}
+
+				int code = 0;
+				int first = 0;
+				int index = 0;
+				for (int len = 1; len < max_count_size; len++) {
+					code |= (bits >> (len - 1)) & 1;
+					int count = this->count[len];
+					if (code - count < first) {
+						*used = len;
+						return symbol[index + (code - first)];
+					}
+
+					index += count;
+					first += count;
+					first <<= 1;
+					code <<= 1;
+				}
+
+				return -1; //out of codes
+			}
+
 			template<typename Backing, typename Type>
 			int decode(BitReader<Backing, Type>* ms) {
 				int len; //current number of bits in code
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <span>
 #include <fstream>
 
 namespace Generic {
@@ -22,6 +23,9 @@ namespace Generic {
 		Read,
 		Write,
 	};
+
+	/* Given by Data::Remaining when the source can't tell how much is left */
+	constexpr uint64_t unknown_length = ~(uint64_t)0;
 	
 	static uint32_t ConvertEndian(const uint8_t* pointer) {
 		return *pointer << 24 | *(pointer + 1) << 16 | *(pointer + 2) << 8 | *(pointer + 3);
@@ -47,6 +51,7 @@ namespace Generic {
 		virtual Type Peek();
 		virtual void Seek(const unsigned int amount);
 		virtual void SeekBack(const unsigned int amount);
+		virtual uint64_t Remaining(); //elements left to read, or unknown_length
 	};
 
 	/* Write-only */
@@ -69,6 +74,13 @@ namespace Generic {
 
 		Data(std::string filePath) : source(filePath, std::ios_base::binary) {}
 
+		/* Reopens the stream on another file */
+		void Reset(std::string filePath) {
+			source.close();
+			source.clear();
+			source.open(filePath, std::ios_base::binary);
+		}
+
 		virtual void Read(Type* out, const unsigned int length) {
 			source.read(out, length);
 		}
@@ -94,6 +106,16 @@ namespace Generic {
 		virtual void SeekBack(const unsigned int amount) {
 			source.seekg(-amount, std::ios_base::cur);
 		}
+		virtual uint64_t Remaining() {
+			const auto position = source.tellg();
+			if (position < 0) {
+				return unknown_length;
+			}
+			source.seekg(0, std::ios_base::end);
+			const auto end = source.tellg();
+			source.seekg(position);
+			return end < position ? unknown_length : (uint64_t)(end - position);
+		}
 	};
 
 	/* Write-only file access */
@@ -101,7 +123,14 @@ namespace Generic {
 	struct Data<std::basic_ofstream<Type, std::char_traits<Type>>, Type, Write> {
 		std::basic_ofstream<Type, std::char_traits<Type>> source;
 
-		Data(std::string filePath) : source(filePath) {}
+		Data(std::string filePath) : source(filePath, std::ios_base::binary) {}
+
+		/* Closes the current file & starts writing another */
+		void Reset(std::string filePath) {
+			source.close();
+			source.clear();
+			source.open(filePath, std::ios_base::binary);
+		}
 
 		virtual void Write(const Type* in, const unsigned int length) {
 			source.write(in, length);
@@ -123,6 +152,13 @@ namespace Generic {
 		Data(unsigned int length) : source(length) {}
 		Data(Type* ptr, unsigned int length) : source(ptr, length) {}
 
+		/* Copies in new contents (reusing the vector's memory) and starts reading from the beginning */
+		void Reset(const Type* ptr, unsigned int length) {
+			source.assign(ptr, ptr + length);
+			current_index = 0;
+			last_read = 0;
+		}
+
 		virtual void Read(Type* out, const unsigned int length) {
 			unsigned int l = length;
 			if (length > source.size() - current_index)
@@ -160,6 +196,78 @@ namespace Generic {
 
 			current_index -= amount;
 		}
+		virtual uint64_t Remaining() {
+			return source.size() - current_index;
+		}
+	};
+
+	/* Span implementation (non-owning view over memory that outlives the reader, eg. one member of a larger buffer) */
+	template<typename Type>
+	struct Data<std::span<const Type>, Type, Read> {
+	protected:
+		size_t current_index = 0;
+		unsigned int last_read = 0;
+	public:
+		std::span<const Type> source;
+
+		Data(std::span<const Type> view) : source(view) {}
+		Data(const Type* ptr, size_t length) : source(ptr, length) {}
+
+		/* Views other memory, from its beginning */
+		void Reset(std::span<const Type> view) {
+			source = view;
+			current_index = 0;
+			last_read = 0;
+		}
+		void Reset(const Type* ptr, size_t length) {
+			Reset(std::span<const Type>(ptr, length));
+		}
+
+		virtual void Read(Type* out, const unsigned int length) {
+			size_t l = length;
+			if (length > source.size() - current_index)
+				l = source.size() - current_index;
+
+			memcpy(out, source.data() + current_index, l * sizeof(Type));
+			current_index += l;
+			last_read = (unsigned int)l;
+		}
+		virtual bool TryRead(Type* out, const unsigned int length) {
+			Read(out, length);
+			if (last_read == length) {
+				return true;
+			}
+			else {
+				return false;
+			}
+		}
+		virtual int GetReadCount() {
+			return last_read;
+		}
+
+		virtual Type Peek() {
+			return source[current_index];
+		}
+		virtual void Seek(const unsigned int amount) {
+			if (amount > source.size() - current_index)
+				throw std::exception("Seeking beyond stream!");
+
+			current_index += amount;
+		}
+		virtual void SeekBack(const unsigned int amount) {
+			if (amount > current_index)
+				throw std::exception("Seeking beyond stream!");
+
+			current_index -= amount;
+		}
+		virtual uint64_t Remaining() {
+			return source.size() - current_index;
+		}
+
+		/* Offset of the next element to be read, from the start of the view */
+		size_t GetPosition() {
+			return current_index;
+		}
 	};
 
 	/* Vector implementation */
@@ -170,12 +278,13 @@ namespace Generic {
 
 		Data() : source() {}
 
+		/* Empties the vector to write from the start again (keeping its memory) */
+		void Reset() {
+			source.clear();
+		}
+
 		virtual void Write(const Type* in, const unsigned int length) {
-			source.reserve(length);
-			
-			for (const Type* ptr = in; ptr < in + length; ptr++) {
-				source.emplace_back(*ptr);
-			}
+			source.insert(source.end(), in, in + length);
 		}
 
 		/* No need to flush anything when writing to a vector in memory */
@@ -196,78 +305,135 @@ namespace Generic {
 	public:
 		BitReader(Data<Backing, Type, Read>* source) : src(source) {};
 
+		/* Bits are packed least-significant first (as in DEFLATE), and OR'd into out (so out should be zeroed beforehand) */
 		void ReadBits(uint8_t* out, const unsigned int bitsNeeded) {
-			unsigned int fullBytes = 0;
-			uint8_t bitsPresent = 0;
-			if (bytePresent) { bitsPresent = 8 - bit_pointer; }
-
-			unsigned int bitsLeft = bitsNeeded;
-			uint8_t remaining_bits = 0;
-
-			/* Fast byte aligned copy to *out */
-			if (bitsNeeded > bitsPresent) {
-				fullBytes = (bitsNeeded - bitsPresent) / 8;
-				bitsLeft = (fullBytes * 8) + bitsPresent;
-				remaining_bits = bitsNeeded - bitsLeft;
-
-				if (fullBytes > 0) {
-					src->Read(out, fullBytes);
-					if (src->GetReadCount() < fullBytes) {
+			unsigned int written = 0;
+			while (written < bitsNeeded) {
+				if (!bytePresent || bit_pointer == 8) {
+					src->Read(&byte, 1);
+					if (src->GetReadCount() == 0) {
 						throw std::exception("Unable to read enough from source");
 					}
+					bit_pointer = 0;
+					bytePresent = true;
 				}
-			}
-			else {
-				bitsPresent = bitsNeeded;
-			}
 
-			uint8_t* copyEnd = out + fullBytes;
-			if (bytePresent) {
-				if (fullBytes > 0) {
-					/* shift copied data if necessary */
-					uint8_t* currentPtr = copyEnd - 1;
-					while (currentPtr > out) {
-						uint8_t store = *(currentPtr - 1);
-						*(currentPtr + 1) |= store >> (8 - bitsPresent); /* Shifting more significant bits to next byte */
-						*currentPtr = (store << bitsPresent); /* Shifting less significant bits up in current byte */
-
-						currentPtr--;
-					}
-				}
+				/* Take as many bits as possible at once: limited by what is left in the stored byte, what is needed, and what fits in the current output byte */
+				unsigned int take = 8 - bit_pointer;
+				if (take > bitsNeeded - written) { take = bitsNeeded - written; }
+				if (take > 8 - (written % 8)) { take = 8 - (written % 8); }
 
+				uint8_t bits = (byte >> bit_pointer) & ((1 << take) - 1);
+				out[written / 8] |= bits << (written % 8);
+
+				bit_pointer += take;
+				written += take;
+			}
+		}
+
+		void ResetBitPointer() {
+			byte = 0;
+			bit_pointer = 0;
+			bytePresent = false;
+		}
+	};
 
-				/* Insert aligned data from present byte (using bit_pointer) */
-				for (uint8_t out_bit_pointer = 0; out_bit_pointer < bitsPresent; out_bit_pointer++) {
-					int current_bit = (byte >> bit_pointer++) & 0x1;
-					*out |= (current_bit << out_bit_pointer);
+	/* Packs bits least-significant first (as in DEFLATE), gathering whole bytes in a buffer that is written to dest as it fills (or on Flush) */
+	template<typename Backing, typename Type>
+	struct BitWriter {
+	protected:
+		uint64_t bits = 0; //pending bits, the first in the lowest position
+		unsigned int count = 0; //number of pending bits (under 32 between calls)
+		static const unsigned int buffer_size = 4096;
+		uint8_t buffer[buffer_size] = {};
+		unsigned int used = 0;
+	public:
+		Data<Backing, Type, Write>* dest;
+	public:
+		BitWriter(Data<Backing, Type, Write>* destination) : dest(destination) {};
+
+		/* Up to 32 bits at a time (bits of value above length must be zero) */
+		void WriteBits(const uint32_t value, const unsigned int length) {
+			bits |= (uint64_t)value << count;
+			count += length;
+			if (count >= 32) {
+				if (used + 4 > buffer_size) {
+					FlushBuffer();
 				}
+				buffer[used] = (uint8_t)bits;
+				buffer[used + 1] = (uint8_t)(bits >> 8);
+				buffer[used + 2] = (uint8_t)(bits >> 16);
+				buffer[used + 3] = (uint8_t)(bits >> 24);
+				used += 4;
+				bits >>= 32;
+				count -= 32;
 			}
-			out = copyEnd;
+		}
 
-			/* Read remaining bits (not aligned) */
-			if (remaining_bits > 0) {
-				src->Read(&byte, 1);
-				if (src->GetReadCount() == 0) {
-					throw std::exception("Unable to read enough from source");
+		/* Pads with zero bits up to the next byte boundary, and moves the whole bytes pending into the buffer */
+		void AlignToByte() {
+			count = (count + 7) & ~7u;
+			while (count > 0) {
+				if (used == buffer_size) {
+					FlushBuffer();
 				}
-				bit_pointer = 0;
-				bytePresent = true;
+				buffer[used++] = (uint8_t)bits;
+				bits >>= 8;
+				count -= 8;
+			}
+		}
 
-				for (uint8_t out_bit_pointer = bitsPresent; out_bit_pointer < remaining_bits + bitsPresent; out_bit_pointer++) {
-					if (out_bit_pointer != 0 && out_bit_pointer % 8 == 0) {
-						out++;
-					}
+		/* Bytes written as they are after aligning to a byte boundary (stored blocks, trailers); large runs go straight to dest */
+		void WriteBytes(const uint8_t* in, const unsigned int length) {
+			AlignToByte();
+			if (length == 0) {
+				return;
+			}
+			if (length > buffer_size - used) {
+				FlushBuffer();
+				if (length >= buffer_size) {
+					dest->Write(in, length);
+					return;
+				}
+			}
+			memcpy(buffer + used, in, length);
+			used += length;
+		}
 
-					int current_bit = (byte >> bit_pointer++) & 0x1;
-					*out |= (current_bit << (out_bit_pointer % 8));
+		/* Hands every whole byte written so far to dest (a partial byte stays pending until more bits or AlignToByte complete it) */
+		void Flush() {
+			while (count >= 8) {
+				if (used == buffer_size) {
+					FlushBuffer();
 				}
+				buffer[used++] = (uint8_t)bits;
+				bits >>= 8;
+				count -= 8;
 			}
+			FlushBuffer();
 		}
 
-		void ResetBitPointer() {
-			byte = 0;
-			bit_pointer = 0;
-			bytePresent = false;
+		/* Drops anything pending (to start over on a new stream) */
+		void Reset() {
+			bits = 0;
+			count = 0;
+			used = 0;
+		}
+
+		/* Moves the pending bits (fewer than 32) out to the caller, which leaves none pending; for loops that gather bits in locals & pass them back as bytes (then WriteBits for the rest) */
+		unsigned int TakeBits(uint64_t& out) {
+			out = bits;
+			const unsigned int taken = count;
+			bits = 0;
+			count = 0;
+			return taken;
+		}
+	private:
+		void FlushBuffer() {
+			if (used > 0) {
+				dest->Write(buffer, used);
+				used = 0;
+			}
 		}
 	};
 }
\ No newline at end of file
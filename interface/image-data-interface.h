@@ -49,24 +49,169 @@ namespace ImageLibrary {
 		uint32_t height;
 	};
 
+	struct rect {
+		uint32_t x;
+		uint32_t y;
+		uint32_t width;
+		uint32_t height;
+	};
+
 	struct ImageFormat {
 		unsigned short bitsPerPixel = 0;
 		FormatDetails formatting = FormatDetails::Any;
 	};	
 
+	/* Header information of an image, found without decoding it */
+	struct ImageProbe {
+		bool valid = false; //false if the header is invalid or not within the bytes given
+		size dimensions = {};
+		ImageFormat format = {}; //as ReadData would return it with default options
+		bool interlaced = false;
+		bool animated = false; //only found if the animation chunk comes before the image data & within the bytes given
+		bool transparency = false; //the format has alpha, or a transparency chunk comes before the image data & within the bytes given
+	};
+
 	struct ImageData {
 		std::vector<uint8_t> image;
 		size dimensions;
 		ImageFormat format;
 	};
 
-	/* Add optional ImageFormat target later (once the functionality has been added) */
+	/* Caller owned memory to decode into (eg. a mapped upload buffer, or a sub-rectangle of an atlas): row y starts at data + y * pitch
+	pitch can be anything from the width * bytes per pixel up, so rows may be aligned or padded (padding is never written); size is checked to hold every row
+	*/
+	struct ImageBuffer {
+		uint8_t* data = nullptr;
+		size_t pitch = 0;
+		size_t size = 0;
+	};
+
+	/* Receives rows of the image as soon as they are final, instead of the whole image being stored in ImageData::image (set ImageOptions::rowSink)
+	Rows are given top to bottom in the output format; the pointer is only valid during the call
+	*/
+	class ImageRowSink abstract {
+	public:
+		virtual void Row(const unsigned int y, const uint8_t* row, const size_t length) = 0;
+	};
+
+	/* How passes of an interlaced image are returned with receiveInterlaced (named after the equivalent libpng display modes) */
+	enum class Progressive : uint8_t {
+		Off, //each pass is its own smaller image, of every pixel received so far
+		Sparkle, //full size image, with pixels that are not yet received left at zero
+		Rectangle //full size image, with each received pixel filling the block of pixels that later passes will replace
+	};
+
+	/* What an image (which may be hostile, eg. a few bytes claiming to be 65535 x 65535) is allowed to make a decoder do; 0 turns a limit off
+	Sizes from the header are checked before anything is allocated for them, and the rest as the stream is read, so an image over a limit fails early with an error
+	*/
+	struct DecodeLimits {
+		uint64_t maxPixels = (uint64_t)1 << 28; //width * height of the image (or animation canvas)
+		uint64_t maxAllocation = (uint64_t)1 << 30; //bytes of any one buffer (the returned image, a whole interlaced image, an animation canvas or frame, or a scanline)
+		uint64_t maxChunkBytes = 0; //bytes of all chunks read, headers & CRCs included
+		unsigned int maxInflateRatio = 1032; //bytes inflated per compressed byte read (deflate can't go over about 1032), also checked against what is left of the stream before the image is allocated
+		unsigned int maxAncillaryChunk = 8 << 20; //bytes of an ancillary chunk other than frame data (larger ones are skipped), or of its contents once inflated
+	};
+
+	/* How scanlines are filtered before compression (write-only streams) */
+	enum class FilterStrategy : uint8_t {
+		Adaptive, //the filter giving the smallest sum of absolute differences for each row (None for palette & sub-byte images, which rarely gain from filtering)
+		None, //the same filter for every row
+		Sub,
+		Up,
+		Average,
+		Paeth
+	};
+
+	/* How deflate looks for matches (the same order as zlib::Strategy) */
+	enum class DeflateStrategy : uint8_t {
+		Default, //hash chains, searched as far as the level says
+		HuffmanOnly, //no matches, only Huffman coding
+		RLE //only runs of the byte before, which catch flat areas once filtered
+	};
+
+	struct EncodeOptions {
+		unsigned int level = 6; //zlib compression level, from 0 (stored) to 9
+		unsigned int chunkSize = 1 << 16; //most compressed bytes per IDAT chunk
+		FilterStrategy filter = FilterStrategy::Adaptive;
+
+		/* rgb8 & rgba8 images of at most 256 colours are written with a palette instead (with tRNS for any alpha), which is lossless */
+		bool palette = false;
+
+		/* Threads compressing the image in horizontal strips of about stripSize bytes (0 uses the hardware concurrency, 1 compresses everything on the calling thread)
+		Each strip is filtered & deflated on its own, primed with the 32K before it so matches can still reach back across strips, and ends on a byte boundary;
+		the strips are then written in order as one zlib stream. Images no bigger than a strip are compressed on the calling thread
+		*/
+		unsigned int threads = 0;
+		unsigned int stripSize = 1 << 20;
+
+		DeflateStrategy strategy = DeflateStrategy::Default;
+
+		/* With HuffmanOnly or RLE, every block is coded with one table made ahead of time for filtered image data, rather than codes built for each block,
+		so each row is coded as it is filtered without being buffered (noisy images can come out a little larger than stored)
+		*/
+		bool precomputedCodes = false;
+
+		/* As fast as encoding gets, for screenshots & frame dumps: the Up filter, runs coded with precomputed codes and no strips; files are larger than at level 1 */
+		static EncodeOptions Fastest() {
+			EncodeOptions options;
+			options.level = 1;
+			options.filter = FilterStrategy::Up;
+			options.strategy = DeflateStrategy::RLE;
+			options.precomputedCodes = true;
+			options.threads = 1;
+			return options;
+		}
+	};
+
 	struct ImageOptions {
 		/* Specifies whether to receive interlaced and/or animated images (read-only streams) */
 		bool receiveInterlaced;
 		bool receiveAnimation;
-		//ImageFormat target;
 
+		/* Format to return the image in (formatting Any keeps the image's own format, bitsPerPixel is ignored), converted as each row is decoded
+		Channels can only be added (eg. grey to rgba, rgb to rgba, or palettes to rgba), and 16-bit images can be narrowed to 8 bits but 8-bit images are not widened
+		*/
+		ImageFormat target;
+
+		/* 16-bit images are returned with 8 bits per channel (rounded to nearest, and using sBIT if the image has it), for consumers that only display 8-bit */
+		bool narrow16 = false;
+
+		/* With receiveInterlaced, returns every pass as a full size preview instead (each pass only writes the pixels it changes) */
+		Progressive progressive = Progressive::Off;
+
+		/* A promise that the image returned by the last call is passed back untouched (the same ImageData, its pixels unmodified & its vector not reallocated),
+		so only what changed since is written into it (the new pixels of a progressive pass, or the areas an animation frame changed); otherwise the whole image is copied out every call
+		*/
+		bool reuseImage = false;
+
+		/* If set, rows are passed to the sink and ImageData::image is left empty, so only a couple of rows are held at once
+		Interlaced images still need the full image (pixels of a row arrive over all 7 passes); its rows are given after the last pass, and no passes are returned
+		*/
+		ImageRowSink* rowSink = nullptr;
+
+		/* Only this part of the image is decoded and returned (a width of 0 means the whole image); it must lie within the image
+		Decoding stops once its last row is read, skipping the rest of the image data. Interlaced passes are not returned with a region
+		*/
+		rect region = {};
+
+		/* Downscales the image (or region) to this size while decoding, with a box filter (eg. 1/2, 1/4 or 1/8 of each side, or any size no larger than the image); a width of 0 keeps the size
+		Interlaced images scaled to the size of their first pass (1/8, rounded up) are returned as just that pass, without decoding the rest
+		*/
+		size scaleTo = {};
+
+		/* Inflates on a second thread, overlapping with unfiltering & conversion on the calling one (for large images, where latency matters)
+		Not used while interlaced passes are being returned
+		*/
+		bool pipeline = false;
+
+		/* Threads decoding animation frames ahead of the one being composited (0 uses the hardware concurrency, 1 decodes each frame when it is needed)
+		Animation frames are always returned at full canvas size; region, scaleTo, rowSink, pipeline & receiveInterlaced only apply to still images
+		*/
+		unsigned int frameThreads = 0;
+
+		DecodeLimits limits;
+
+		EncodeOptions encode;
 	};
 
 	enum class AnimationFinish : uint8_t {
@@ -75,13 +220,24 @@ namespace ImageLibrary {
 		DRAWN_OVER_BY_NEXT
 	};
 
+	/* Returned with each frame of an animation (receiveAnimation): the image is the whole canvas with this frame composited on,
+	and only the area at relativeX, relativeY of width x height changed since the previous frame was returned (plus the area the previous frame was cleared from)
+	The whole canvas is copied into the image for every frame, unless ImageOptions::reuseImage is set: then only those two areas are written, and the image
+	given back for the next frame has to be the one returned (not modified, swapped or reallocated), or it won't hold the composited canvas
+	*/
 	struct AnimationInfo {
 		bool hasAnimation = false;
-		unsigned int animationID;
+		unsigned int animationID; //frame number, from 0
 		int relativeX;
 		int relativeY;
-		bool applyTransparency;
-		AnimationFinish overAction;
+		bool applyTransparency; //frame was blended over the canvas, rather than replacing its area
+		AnimationFinish overAction; //what happens to the frame's area before the next frame
+		unsigned int width = 0;
+		unsigned int height = 0;
+		unsigned short delayNumerator = 0; //frame is shown for numerator / denominator seconds (a denominator of 0 means 100)
+		unsigned short delayDenominator = 0;
+		unsigned int frames = 0; //in the whole animation
+		unsigned int plays = 0; //times to play the animation (0 is forever)
 	};
 
 	struct ImageReturnInfo {
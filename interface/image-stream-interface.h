@@ -17,6 +17,8 @@ namespace ImageLibrary {
 		If receiving interlaced images, successive calls to ReadData will give higher quality images until fully parsed
 		*/
 		virtual ImageReturnInfo ReadData(ImageData* out, const ImageOptions* const options) = 0;
+		/* Decodes into caller owned memory instead of ImageData::image (out only receives the dimensions & format, plus any reduced interlace passes) */
+		virtual ImageReturnInfo ReadData(ImageData* out, const ImageBuffer& buffer, const ImageOptions* const options) = 0;
 		virtual ImageStreamState QueryState() = 0;
 	};
 
@@ -0,0 +1,96 @@
+#include "mapped-file.h"
+#include <exception>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace Generic {
+
+#if defined(_WIN32)
+	MappedFile::MappedFile(const std::string& filePath) {
+		file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			file = nullptr;
+			throw std::exception("Unable to open file!");
+		}
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize)) {
+			CloseHandle(file);
+			throw std::exception("Unable to read file size!");
+		}
+		length = (size_t)fileSize.QuadPart;
+		if (length == 0) {
+			return; //empty files cannot be mapped
+		}
+
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping != nullptr) {
+			data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		}
+		if (data == nullptr) {
+			if (mapping != nullptr) {
+				CloseHandle(mapping);
+			}
+			CloseHandle(file);
+			throw std::exception("Unable to map file!");
+		}
+	}
+
+	MappedFile::~MappedFile() {
+		if (data != nullptr) {
+			UnmapViewOfFile(data);
+		}
+		if (mapping != nullptr) {
+			CloseHandle(mapping);
+		}
+		if (file != nullptr) {
+			CloseHandle(file);
+		}
+	}
+#else
+	/* std::exception has no message constructor outside of MSVC */
+	MappedFile::MappedFile(const std::string& filePath) {
+		file = open(filePath.c_str(), O_RDONLY);
+		if (file < 0) {
+			throw std::runtime_error("Unable to open file!");
+		}
+
+		struct stat info;
+		if (fstat(file, &info) != 0) {
+			close(file);
+			throw std::runtime_error("Unable to read file size!");
+		}
+		length = (size_t)info.st_size;
+		if (length == 0) {
+			return; //empty files cannot be mapped
+		}
+
+		void* view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+		if (view == MAP_FAILED) {
+			close(file);
+			throw std::runtime_error("Unable to map file!");
+		}
+		madvise(view, length, MADV_SEQUENTIAL); //read front to back, so readahead can be aggressive
+		data = (const uint8_t*)view;
+	}
+
+	MappedFile::~MappedFile() {
+		if (data != nullptr) {
+			munmap((void*)data, length);
+		}
+		if (file >= 0) {
+			close(file);
+		}
+	}
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace Generic {
+	/* Read-only memory mapping of a whole file, so it can be read through Data<std::span<const uint8_t>, uint8_t, Read> without copying it into memory first
+	Throws if the file cannot be opened or mapped; an empty file gives an empty view
+	*/
+	class MappedFile {
+	private:
+		const uint8_t* data = nullptr;
+		size_t length = 0;
+#if defined(_WIN32)
+		void* file = nullptr;
+		void* mapping = nullptr;
+#else
+		int file = -1;
+#endif
+	public:
+		MappedFile(const std::string& filePath);
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		std::span<const uint8_t> View() const { return std::span<const uint8_t>(data, length); }
+	};
+}
\ No newline at end of file
@@ -0,0 +1,197 @@
+#include "batch.h"
+#include "../interface/mapped-file.h"
+#include <fstream>
+#include <cstring>
+#include <exception>
+
+using namespace Generic;
+using namespace std;
+
+namespace ImageLibrary {
+	namespace PNG {
+
+		/* Bytes the decoded image will take, from its header & the options it is decoded with (0 for a row sink, as only a couple of rows are held)
+		Throws if the header is already over ImageOptions::limits, so nothing more of the file is read or reserved for it
+		*/
+		static size_t DecodedSize(const ImageProbe& probe, const ImageOptions& options) {
+			if (probe.valid && options.limits.maxPixels != 0 && (uint64_t)probe.dimensions.width * probe.dimensions.height > options.limits.maxPixels) {
+				throw exception("Image dimensions over limit");
+			}
+			if (!probe.valid || options.rowSink != nullptr) {
+				return 0;
+			}
+
+			size dimensions = probe.dimensions;
+			if (options.region.width != 0) {
+				dimensions = { options.region.width, options.region.height };
+			}
+			if (options.scaleTo.width != 0) {
+				dimensions = options.scaleTo;
+			}
+
+			const bool wide = (probe.format.formatting & FormatDetails::has16) != FormatDetails::Any && !options.narrow16;
+			size_t bits = probe.format.bitsPerPixel;
+			if (options.narrow16 && (probe.format.formatting & FormatDetails::has16) != FormatDetails::Any) {
+				bits /= 2;
+			}
+			if (options.target.formatting != FormatDetails::Any) {
+				const FormatDetails target = options.target.formatting;
+				const size_t channels = ((target & FormatDetails::hasGray) != FormatDetails::Any ? 1 : 0) + ((target & FormatDetails::hasRGB) != FormatDetails::Any ? 3 : 0) + ((target & FormatDetails::hasAlpha) != FormatDetails::Any ? 1 : 0);
+				const size_t sample = wide && (target & FormatDetails::has16) != FormatDetails::Any ? 16 : 8;
+				bits = max(bits, channels * sample);
+			}
+			return (size_t)dimensions.width * dimensions.height * bits / 8;
+		}
+
+		BatchDecoder::BatchDecoder(const BatchOptions& settings) : settings(settings), pool(settings.threads, settings.affinity) {
+			workers.resize(pool.Size());
+		}
+
+		/* An image larger than the whole budget still goes ahead once nothing else is in flight, rather than waiting forever */
+		void BatchDecoder::Reserve(const size_t bytes) {
+			unique_lock<mutex> guard(budgetLock);
+			budgetFreed.wait(guard, [this, bytes]() { return inFlight == 0 || inFlight + bytes <= settings.maxInFlight; });
+			inFlight += bytes;
+		}
+
+		void BatchDecoder::Free(const size_t bytes) {
+			if (bytes == 0) {
+				return;
+			}
+			{
+				lock_guard<mutex> guard(budgetLock);
+				inFlight -= bytes;
+			}
+			budgetFreed.notify_all();
+		}
+
+		/* Fills in result, returning the bytes reserved from the budget for it (freed once the callback is done with it)
+		The header is probed before anything large is read or decoded, so the whole cost of the image is reserved in one go (reserving in parts could leave every worker holding part of the budget)
+		*/
+		size_t BatchDecoder::DecodeOne(const unsigned int worker, BatchResult& result, const BatchSource& source, const ImageOptions& options) {
+			static const size_t headerSize = 64; //signature & IHDR, with room to spare
+
+			Worker& state = workers[worker];
+			size_t reserved = 0;
+			try {
+				span<const uint8_t> bytes;
+				unique_ptr<MappedFile> mapped;
+				switch (source.kind) {
+				case BatchSource::Kind::File: {
+					ifstream file(source.path, ios_base::binary | ios_base::ate);
+					if (!file) {
+						throw exception("Unable to open file!");
+					}
+					const size_t length = (size_t)file.tellg();
+					file.seekg(0);
+
+					uint8_t header[headerSize] = {};
+					const size_t headerLength = min(length, headerSize);
+					file.read((char*)header, headerLength);
+
+					reserved = length + DecodedSize(PNGStream<span<const uint8_t>, Mode::Read>::Probe(header, headerLength), options);
+					Reserve(reserved);
+
+					state.file.resize(length); //keeps its capacity from earlier files
+					memcpy(state.file.data(), header, headerLength);
+					file.read((char*)state.file.data() + headerLength, length - headerLength);
+					if ((size_t)file.gcount() != length - headerLength) {
+						throw exception("Unable to read file!");
+					}
+					bytes = span<const uint8_t>(state.file.data(), length);
+					break;
+				}
+				case BatchSource::Kind::Mapped:
+					mapped = make_unique<MappedFile>(source.path);
+					bytes = mapped->View();
+					reserved = bytes.size() + DecodedSize(PNGStream<span<const uint8_t>, Mode::Read>::Probe(bytes.data(), bytes.size()), options);
+					Reserve(reserved);
+					break;
+				case BatchSource::Kind::Memory:
+					bytes = source.memory;
+					reserved = DecodedSize(PNGStream<span<const uint8_t>, Mode::Read>::Probe(bytes.data(), bytes.size()), options);
+					Reserve(reserved);
+					break;
+				}
+
+				if (state.png == nullptr) {
+					state.png = make_unique<PNGStream<span<const uint8_t>, Mode::Read>>(bytes);
+				}
+				else {
+					state.png->Reset(bytes);
+				}
+				result.info = state.png->ReadData(&result.image, &options);
+				if (!result.info.valid) {
+					result.err = state.png->QueryState().err;
+				}
+			}
+			catch (std::exception e) {
+				result.info = {};
+				result.info.valid = false;
+				result.err = e.what();
+			}
+
+			/* An unusually large file (or the buffers of an unusually large image) is not kept around, so what workers hold between images stays within the budget */
+			const size_t share = settings.maxInFlight / workers.size();
+			if (state.file.capacity() > share) {
+				vector<uint8_t>().swap(state.file);
+			}
+			if (reserved > share) {
+				state.png.reset();
+			}
+			return reserved;
+		}
+
+		void BatchDecoder::Decode(const vector<BatchSource>& sources, const ImageOptions& options, const BatchCallback& done) {
+			if (sources.empty()) {
+				return;
+			}
+
+			/* Each image is returned whole */
+			ImageOptions decodeOptions = options;
+			decodeOptions.receiveInterlaced = false;
+
+			struct Batch {
+				mutex lock;
+				condition_variable finished;
+				size_t remaining;
+				exception_ptr failure;
+			} batch;
+			batch.remaining = sources.size();
+
+			for (size_t i = 0; i < sources.size(); i++) {
+				pool.Submit([this, &batch, &sources, &decodeOptions, &done, i](const unsigned int worker) {
+					size_t reserved = 0;
+					{
+						BatchResult result = {};
+						result.index = i;
+						result.worker = worker;
+						reserved = DecodeOne(worker, result, sources[i], decodeOptions);
+						try {
+							done(result);
+						}
+						catch (...) {
+							lock_guard<mutex> guard(batch.lock);
+							if (!batch.failure) {
+								batch.failure = current_exception();
+							}
+						}
+					}
+					Free(reserved); //after the result (and the image in it, unless moved out) is gone
+
+					/* Notified under the lock, since batch is gone as soon as Decode sees the last one finish */
+					lock_guard<mutex> guard(batch.lock);
+					if (--batch.remaining == 0) {
+						batch.finished.notify_all();
+					}
+				});
+			}
+
+			unique_lock<mutex> guard(batch.lock);
+			batch.finished.wait(guard, [&batch]() { return batch.remaining == 0; });
+			if (batch.failure) {
+				rethrow_exception(batch.failure);
+			}
+		}
+	}
+}
\ No newline at end of file
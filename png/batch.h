@@ -0,0 +1,85 @@
+#pragma once
+
+#include "png.h"
+#include "../thread/work-stealing-pool.h"
+#include <span>
+
+namespace ImageLibrary {
+	namespace PNG {
+		/* Where one image of a batch comes from */
+		struct BatchSource {
+			enum class Kind : uint8_t {
+				File, //read whole into a buffer kept by the worker (and reused for its next file)
+				Mapped, //memory mapped, so the file is never copied
+				Memory //caller owned bytes, which must stay valid until Decode returns
+			};
+			Kind kind = Kind::Memory;
+			std::string path;
+			std::span<const uint8_t> memory;
+
+			static BatchSource FromFile(const std::string& path) { return { Kind::File, path, {} }; }
+			static BatchSource FromMapping(const std::string& path) { return { Kind::Mapped, path, {} }; }
+			static BatchSource FromMemory(std::span<const uint8_t> memory) { return { Kind::Memory, {}, memory }; }
+		};
+
+		struct BatchResult {
+			size_t index; //of the source in the list given to Decode
+			unsigned int worker; //pool worker that decoded it (0 to threads - 1), eg. to index per-worker state of the caller's own
+			ImageReturnInfo info; //valid is false if the file could not be read or the image could not be decoded (err says why)
+			ImageData image;
+			std::string err;
+		};
+
+		/* Called on the worker as each image finishes; the image can be moved out of the result to keep it */
+		using BatchCallback = std::function<void(BatchResult& result)>;
+
+		struct BatchOptions {
+			unsigned int threads = 0; //0 uses the hardware concurrency
+			/* Bytes of images (and files read into memory or mapped) decoding at once, counted from each image's header before it is decoded
+			Workers wait for memory to be freed before starting an image that would go over; an image larger than the limit alone still decodes, once nothing else is in flight
+			Memory is freed as each callback returns (images moved out of the callback are no longer counted)
+			*/
+			size_t maxInFlight = (size_t)512 << 20;
+			/* Logical processor for each worker (worker i runs on affinity[i % size]), eg. the processors of one NUMA node; empty leaves scheduling to the OS */
+			std::vector<unsigned int> affinity;
+		};
+
+		/* Decodes many independent PNGs across a work-stealing pool (for throughput over lots of small images, rather than the latency of one)
+		Each image is decoded whole by one worker; passes of interlaced images are not returned, and ImageOptions::pipeline is best left off (the pool already keeps every core busy)
+		*/
+		class BatchDecoder {
+		private:
+			/* State each worker keeps between images */
+			struct Worker {
+				std::vector<uint8_t> file; //contents of BatchSource::File sources
+				std::unique_ptr<PNGStream<std::span<const uint8_t>, Generic::Mode::Read>> png; //reset for each image, so its buffers are reused
+			};
+
+			BatchOptions settings;
+			std::vector<Worker> workers;
+
+			/* In-flight memory (BatchOptions::maxInFlight) */
+			std::mutex budgetLock;
+			std::condition_variable budgetFreed;
+			size_t inFlight = 0;
+
+			Generic::WorkStealingPool pool; //last, so workers are stopped before anything they use is destroyed
+		private:
+			void Reserve(const size_t bytes);
+			void Free(const size_t bytes);
+			size_t DecodeOne(const unsigned int worker, BatchResult& result, const BatchSource& source, const ImageOptions& options);
+		public:
+			BatchDecoder(const BatchOptions& settings = {});
+
+			BatchDecoder(const BatchDecoder&) = delete;
+			BatchDecoder& operator=(const BatchDecoder&) = delete;
+
+			unsigned int Threads() const { return pool.Size(); }
+
+			/* Decodes every source with the given options, calling done as each one finishes (in any order, and from several workers at once), and returns once all have finished
+			The first exception thrown by done is rethrown here, after the rest of the batch is done. done must not call Decode on the same decoder
+			*/
+			void Decode(const std::vector<BatchSource>& sources, const ImageOptions& options, const BatchCallback& done);
+		};
+	}
+}
\ No newline at end of file
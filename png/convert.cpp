@@ -0,0 +1,457 @@
+#include "convert.h"
+#include <array>
+#include <cstring>
+
+#if IMAGELIB_X86
+#include <immintrin.h>
+#endif
+
+using namespace Generic::cpu;
+
+namespace ImageLibrary {
+	namespace PNG {
+		static void SwapBytes16Scalar(uint8_t* target, const uint8_t* row, const size_t length) {
+			for (size_t i = 0; i + 1 < length; i += 2) {
+				uint8_t high = row[i];
+				target[i] = row[i + 1];
+				target[i + 1] = high;
+			}
+		}
+
+
+		static void ExpandPaletteScalar(uint8_t* target, const uint8_t* indices, const size_t columns, const uint8_t* palette, const bool alpha) {
+			if (alpha) {
+				for (size_t x = 0; x < columns; x++, target += 4) {
+					memcpy(target, palette + indices[x] * 4, 4);
+				}
+			}
+			else {
+				for (size_t x = 0; x < columns; x++, target += 3) {
+					memcpy(target, palette + indices[x] * 4, 3);
+				}
+			}
+		}
+
+		/* Which input channel each output channel of an expansion comes from (-1 for added alpha) */
+		static constexpr int ExpandSource(const unsigned int from, const unsigned int to, const unsigned int channel) {
+			if (channel == 3 || (to == 2 && channel == 1)) {
+				return from == 2 || from == 4 ? (int)from - 1 : -1;
+			}
+			return from >= 3 ? (int)channel : 0;
+		}
+
+		template<unsigned int from, unsigned int to>
+		static void ExpandChannelsScalar(uint8_t* target, const uint8_t* row, const size_t pixels) {
+			for (size_t x = 0; x < pixels; x++, row += from, target += to) {
+				for (unsigned int c = 0; c < to; c++) {
+					const int source = ExpandSource(from, to, c);
+					target[c] = source < 0 ? 0xFF : row[source];
+				}
+			}
+		}
+
+		static void ExpandChannels16(uint8_t* target, const uint8_t* row, const size_t pixels, const unsigned int from, const unsigned int to) {
+			for (size_t x = 0; x < pixels; x++, row += from * 2, target += to * 2) {
+				for (unsigned int c = 0; c < to; c++) {
+					const int source = ExpandSource(from, to, c);
+					if (source < 0) {
+						target[c * 2] = 0xFF;
+						target[c * 2 + 1] = 0xFF;
+					}
+					else {
+						memcpy(target + c * 2, row + source * 2, 2);
+					}
+				}
+			}
+		}
+
+		static void Narrow16To8Scalar(uint8_t* target, const uint8_t* row, const size_t samples) {
+			for (size_t i = 0; i < samples; i++) {
+				uint32_t v = row[i * 2] << 8 | row[i * 2 + 1];
+				target[i] = (uint8_t)((v * 255 + 32895) >> 16);
+			}
+		}
+
+
+		/* ======= Vector kernels ======= */
+#if IMAGELIB_X86
+		IMAGELIB_TARGET("ssse3") static void SwapBytes16SSSE3(uint8_t* target, const uint8_t* row, const size_t length) {
+			const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+			size_t i = 0;
+			for (; i + 16 <= length; i += 16) {
+				__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+				_mm_storeu_si128((__m128i*)(target + i), _mm_shuffle_epi8(x, swap));
+			}
+			SwapBytes16Scalar(target + i, row + i, length - i);
+		}
+
+		IMAGELIB_TARGET("avx2") static void SwapBytes16AVX2(uint8_t* target, const uint8_t* row, const size_t length) {
+			const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+			size_t i = 0;
+			for (; i + 32 <= length; i += 32) {
+				__m256i x = _mm256_loadu_si256((const __m256i*)(row + i));
+				_mm256_storeu_si256((__m256i*)(target + i), _mm256_shuffle_epi8(x, swap));
+			}
+			SwapBytes16Scalar(target + i, row + i, length - i);
+		}
+
+		/* Rotating each 16-bit lane by 8 is the byte swap, and a masked load / store takes care of the tail */
+		IMAGELIB_TARGET("avx512f,avx512bw") static void SwapBytes16AVX512(uint8_t* target, const uint8_t* row, const size_t length) {
+			size_t i = 0;
+			for (; i + 64 <= length; i += 64) {
+				__m512i x = _mm512_loadu_si512((const void*)(row + i));
+				_mm512_storeu_si512((void*)(target + i), _mm512_or_si512(_mm512_slli_epi16(x, 8), _mm512_srli_epi16(x, 8)));
+			}
+			size_t remaining = (length - i) & ~(size_t)1;
+			if (remaining > 0) {
+				__mmask64 mask = ~0ULL >> (64 - remaining);
+				__m512i x = _mm512_maskz_loadu_epi8(mask, row + i);
+				_mm512_mask_storeu_epi8(target + i, mask, _mm512_or_si512(_mm512_slli_epi16(x, 8), _mm512_srli_epi16(x, 8)));
+			}
+		}
+
+		/* Palette entries are gathered 8 at a time; for rgb8 the alpha bytes are shuffled out of each 128-bit lane, leaving 12 bytes per lane to store */
+		IMAGELIB_TARGET("avx2") static void ExpandPaletteAVX2(uint8_t* target, const uint8_t* indices, const size_t columns, const uint8_t* palette, const bool alpha) {
+			const int* entries = (const int*)palette;
+			size_t x = 0;
+			if (alpha) {
+				for (; x + 8 <= columns; x += 8) {
+					__m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(indices + x)));
+					_mm256_storeu_si256((__m256i*)(target + x * 4), _mm256_i32gather_epi32(entries, index, 4));
+				}
+				ExpandPaletteScalar(target + x * 4, indices + x, columns - x, palette, alpha);
+			}
+			else {
+				const __m256i dropAlpha = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+				for (; x + 10 <= columns; x += 8) { //each 16 byte store runs 4 bytes past the 12 it fills, so at least 2 more pixels must follow
+					__m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(indices + x)));
+					__m256i pixels = _mm256_shuffle_epi8(_mm256_i32gather_epi32(entries, index, 4), dropAlpha);
+					_mm_storeu_si128((__m128i*)(target + x * 3), _mm256_castsi256_si128(pixels));
+					_mm_storeu_si128((__m128i*)(target + x * 3 + 12), _mm256_extracti128_si256(pixels, 1));
+				}
+				ExpandPaletteScalar(target + x * 3, indices + x, columns - x, palette, alpha);
+			}
+		}
+
+		/* 16 entries per gather; for rgb8 the 12 used bytes of each lane are packed together across lanes and written with a 48 byte masked store */
+		IMAGELIB_TARGET("avx512f,avx512bw") static void ExpandPaletteAVX512(uint8_t* target, const uint8_t* indices, const size_t columns, const uint8_t* palette, const bool alpha) {
+			size_t x = 0;
+			if (alpha) {
+				for (; x + 16 <= columns; x += 16) {
+					__m512i index = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(indices + x)));
+					_mm512_storeu_si512((void*)(target + x * 4), _mm512_i32gather_epi32(index, (const void*)palette, 4));
+				}
+				ExpandPaletteScalar(target + x * 4, indices + x, columns - x, palette, alpha);
+			}
+			else {
+				const __m512i dropAlpha = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1));
+				const __m512i pack = _mm512_setr_epi32(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0, 0, 0, 0);
+				const __mmask64 rgbBytes = ~0ULL >> 16;
+				for (; x + 16 <= columns; x += 16) {
+					__m512i index = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(indices + x)));
+					__m512i pixels = _mm512_shuffle_epi8(_mm512_i32gather_epi32(index, (const void*)palette, 4), dropAlpha);
+					_mm512_mask_storeu_epi8(target + x * 3, rgbBytes, _mm512_permutexvar_epi32(pack, pixels));
+				}
+				ExpandPaletteScalar(target + x * 3, indices + x, columns - x, palette, alpha);
+			}
+		}
+
+		/* Same rounding as the scalar version on 16-bit lanes: with t = min(v + 128, 65535), round(v * 255 / 65535) = (t - (t >> 8)) >> 8 (checked for every v) */
+		IMAGELIB_TARGET("ssse3") static inline __m128i Narrow16Lanes(const __m128i bigEndian) {
+			const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+			__m128i t = _mm_adds_epu16(_mm_shuffle_epi8(bigEndian, swap), _mm_set1_epi16(128));
+			return _mm_srli_epi16(_mm_sub_epi16(t, _mm_srli_epi16(t, 8)), 8);
+		}
+		IMAGELIB_TARGET("ssse3") static void Narrow16To8SSSE3(uint8_t* target, const uint8_t* row, const size_t samples) {
+			size_t i = 0;
+			for (; i + 16 <= samples; i += 16) {
+				__m128i low = Narrow16Lanes(_mm_loadu_si128((const __m128i*)(row + i * 2)));
+				__m128i high = Narrow16Lanes(_mm_loadu_si128((const __m128i*)(row + i * 2 + 16)));
+				_mm_storeu_si128((__m128i*)(target + i), _mm_packus_epi16(low, high));
+			}
+			Narrow16To8Scalar(target + i, row + i * 2, samples - i);
+		}
+
+		IMAGELIB_TARGET("avx2") static inline __m256i Narrow16Lanes(const __m256i bigEndian) {
+			const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+			__m256i t = _mm256_adds_epu16(_mm256_shuffle_epi8(bigEndian, swap), _mm256_set1_epi16(128));
+			return _mm256_srli_epi16(_mm256_sub_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+		}
+		IMAGELIB_TARGET("avx2") static void Narrow16To8AVX2(uint8_t* target, const uint8_t* row, const size_t samples) {
+			size_t i = 0;
+			for (; i + 32 <= samples; i += 32) {
+				__m256i low = Narrow16Lanes(_mm256_loadu_si256((const __m256i*)(row + i * 2)));
+				__m256i high = Narrow16Lanes(_mm256_loadu_si256((const __m256i*)(row + i * 2 + 32)));
+				__m256i packed = _mm256_packus_epi16(low, high); //packs within 128-bit lanes, so the middle quarters are swapped back
+				_mm256_storeu_si256((__m256i*)(target + i), _mm256_permute4x64_epi64(packed, 0xD8));
+			}
+			Narrow16To8Scalar(target + i, row + i * 2, samples - i);
+		}
+
+		/* AVX-512 BW can truncate 16-bit lanes to bytes directly */
+		IMAGELIB_TARGET("avx512f,avx512bw") static void Narrow16To8AVX512(uint8_t* target, const uint8_t* row, const size_t samples) {
+			const __m512i swap = _mm512_broadcast_i32x4(_mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14));
+			const __m512i round = _mm512_set1_epi16(128);
+			size_t i = 0;
+			for (; i + 32 <= samples; i += 32) {
+				__m512i t = _mm512_adds_epu16(_mm512_shuffle_epi8(_mm512_loadu_si512((const void*)(row + i * 2)), swap), round);
+				t = _mm512_srli_epi16(_mm512_sub_epi16(t, _mm512_srli_epi16(t, 8)), 8);
+				_mm256_storeu_si256((__m256i*)(target + i), _mm512_cvtepi16_epi8(t));
+			}
+			Narrow16To8Scalar(target + i, row + i * 2, samples - i);
+		}
+
+		/* pshufb controls for a 16-byte block of output pixels (16 / to of them; the byte left over with 3 channels is overwritten by the next block), and the added alpha bytes to OR in */
+		template<unsigned int from, unsigned int to>
+		static constexpr std::array<uint8_t, 16> expandShuffle{ []() consteval {
+			std::array<uint8_t, 16> result{};
+			for (unsigned int i = 0; i < 16; i++) {
+				const int source = i < 16 / to * to ? ExpandSource(from, to, i % to) : -1;
+				result[i] = source < 0 ? 0x80 : (uint8_t)(i / to * from + source);
+			}
+			return result;
+		}() };
+		template<unsigned int from, unsigned int to>
+		static constexpr std::array<uint8_t, 16> expandAlpha{ []() consteval {
+			std::array<uint8_t, 16> result{};
+			for (unsigned int i = 0; i < 16 / to * to; i++) {
+				result[i] = ExpandSource(from, to, i % to) < 0 ? 0xFF : 0;
+			}
+			return result;
+		}() };
+
+		template<unsigned int from, unsigned int to>
+		IMAGELIB_TARGET("ssse3") static void ExpandChannelsSSSE3(uint8_t* target, const uint8_t* row, const size_t pixels) {
+			constexpr unsigned int perBlock = 16 / to;
+			const __m128i shuffle = _mm_loadu_si128((const __m128i*)expandShuffle<from, to>.data());
+			const __m128i alpha = _mm_loadu_si128((const __m128i*)expandAlpha<from, to>.data());
+			size_t x = 0;
+			for (; x * to + 16 <= pixels * to && x * from + 16 <= pixels * from; x += perBlock) { //full 16 byte loads & stores stay inside both rows
+				__m128i v = _mm_loadu_si128((const __m128i*)(row + x * from));
+				_mm_storeu_si128((__m128i*)(target + x * to), _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alpha));
+			}
+			ExpandChannelsScalar<from, to>(target + x * to, row + x * from, pixels - x);
+		}
+
+		/* Each lane does a block from its own 16-byte load, so only 2 & 4 channel outputs (whole pixels in 16 bytes) fill the 32 bytes without gaps */
+		template<unsigned int from, unsigned int to>
+		IMAGELIB_TARGET("avx2") static void ExpandChannelsAVX2(uint8_t* target, const uint8_t* row, const size_t pixels) {
+			constexpr unsigned int perBlock = 16 / to;
+			const __m256i shuffle = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)expandShuffle<from, to>.data()));
+			const __m256i alpha = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)expandAlpha<from, to>.data()));
+			size_t x = 0;
+			for (; x + perBlock * 2 <= pixels && (x + perBlock) * from + 16 <= pixels * from; x += perBlock * 2) {
+				__m128i low = _mm_loadu_si128((const __m128i*)(row + x * from));
+				__m128i high = _mm_loadu_si128((const __m128i*)(row + (x + perBlock) * from));
+				__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+				_mm256_storeu_si256((__m256i*)(target + x * to), _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle), alpha));
+			}
+			ExpandChannelsScalar<from, to>(target + x * to, row + x * from, pixels - x);
+		}
+#endif
+
+		using SwapFunction = void (*)(uint8_t* target, const uint8_t* row, const size_t length);
+
+		static SwapFunction SelectSwapBytes16() {
+#if IMAGELIB_X86
+			switch (GetSIMDLevel()) {
+			case SIMDLevel::SSE41:
+				return SwapBytes16SSSE3;
+			case SIMDLevel::AVX2:
+				return SwapBytes16AVX2;
+			case SIMDLevel::AVX512:
+				return SwapBytes16AVX512;
+			default:
+				break;
+			}
+#endif
+			return SwapBytes16Scalar;
+		}
+		static const SwapFunction swapBytes16Kernel = SelectSwapBytes16();
+
+		void SwapBytes16(uint8_t* target, const uint8_t* row, const size_t length) {
+			swapBytes16Kernel(target, row, length);
+		}
+
+		using ExpandPaletteFunction = void (*)(uint8_t* target, const uint8_t* indices, const size_t columns, const uint8_t* palette, const bool alpha);
+
+		/* Gathers need AVX2, below that the table lookups stay scalar */
+		static ExpandPaletteFunction SelectExpandPalette() {
+#if IMAGELIB_X86
+			switch (GetSIMDLevel()) {
+			case SIMDLevel::AVX2:
+				return ExpandPaletteAVX2;
+			case SIMDLevel::AVX512:
+				return ExpandPaletteAVX512;
+			default:
+				break;
+			}
+#endif
+			return ExpandPaletteScalar;
+		}
+		static const ExpandPaletteFunction expandPaletteKernel = SelectExpandPalette();
+
+		void ExpandPalette(uint8_t* target, const uint8_t* indices, const size_t columns, const uint8_t* palette, const bool alpha) {
+			expandPaletteKernel(target, indices, columns, palette, alpha);
+		}
+
+
+
+		/* One entry per possible input byte, holding the 8 / depth output bytes it unpacks to
+		Replicating n bits across a byte is the same as multiplying by 0xFF / (2^n - 1), so that is folded into the table too
+		*/
+		template<unsigned int depth, bool replicate>
+		static constexpr std::array<std::array<uint8_t, 8 / depth>, 256> unpackTable{ []() consteval {
+			std::array<std::array<uint8_t, 8 / depth>, 256> result{};
+			const unsigned int mask = (1 << depth) - 1;
+			for (unsigned int byte = 0; byte < 256; byte++) {
+				for (unsigned int i = 0; i < 8 / depth; i++) {
+					unsigned int sample = (byte >> (8 - depth * (i + 1))) & mask;
+					result[byte][i] = (uint8_t)(replicate ? sample * (0xFF / mask) : sample);
+				}
+			}
+			return result;
+		}() };
+
+		template<unsigned int depth, bool replicate>
+		static void UnpackRow(uint8_t* target, const uint8_t* row, const size_t columns) {
+			constexpr unsigned int perByte = 8 / depth;
+			const auto& table = unpackTable<depth, replicate>;
+
+			size_t whole = columns / perByte;
+			for (size_t i = 0; i < whole; i++, target += perByte) {
+				memcpy(target, table[row[i]].data(), perByte); //fixed size, so a single 2 / 4 / 8 byte store
+			}
+			if (columns % perByte != 0) { //padding bits at the end of the scanline are dropped
+				memcpy(target, table[row[whole]].data(), columns % perByte);
+			}
+		}
+
+		void UnpackSamples(uint8_t* target, const uint8_t* row, const size_t columns, const unsigned int bitDepth, const bool replicate) {
+			switch (bitDepth) {
+			case 1:
+				replicate ? UnpackRow<1, true>(target, row, columns) : UnpackRow<1, false>(target, row, columns);
+				break;
+			case 2:
+				replicate ? UnpackRow<2, true>(target, row, columns) : UnpackRow<2, false>(target, row, columns);
+				break;
+			case 4:
+				replicate ? UnpackRow<4, true>(target, row, columns) : UnpackRow<4, false>(target, row, columns);
+				break;
+			default:
+				memcpy(target, row, columns);
+				break;
+			}
+		}
+
+		using NarrowFunction = void (*)(uint8_t* target, const uint8_t* row, const size_t samples);
+
+		static NarrowFunction SelectNarrow16To8() {
+#if IMAGELIB_X86
+			switch (GetSIMDLevel()) {
+			case SIMDLevel::SSE41:
+				return Narrow16To8SSSE3;
+			case SIMDLevel::AVX2:
+				return Narrow16To8AVX2;
+			case SIMDLevel::AVX512:
+				return Narrow16To8AVX512;
+			default:
+				break;
+			}
+#endif
+			return Narrow16To8Scalar;
+		}
+		static const NarrowFunction narrow16To8Kernel = SelectNarrow16To8();
+
+		void Narrow16To8(uint8_t* target, const uint8_t* row, const size_t samples) {
+			narrow16To8Kernel(target, row, samples);
+		}
+
+		using ExpandChannelsFunction = void (*)(uint8_t* target, const uint8_t* row, const size_t pixels);
+
+		/* Indexed by from * 5 + to; 3 channel outputs stay on SSSE3 at every level (see ExpandChannelsAVX2) */
+		static std::array<ExpandChannelsFunction, 25> SelectExpandChannels() {
+			std::array<ExpandChannelsFunction, 25> kernels{};
+			kernels[1 * 5 + 2] = ExpandChannelsScalar<1, 2>;
+			kernels[1 * 5 + 3] = ExpandChannelsScalar<1, 3>;
+			kernels[1 * 5 + 4] = ExpandChannelsScalar<1, 4>;
+			kernels[2 * 5 + 4] = ExpandChannelsScalar<2, 4>;
+			kernels[3 * 5 + 4] = ExpandChannelsScalar<3, 4>;
+#if IMAGELIB_X86
+			if (GetSIMDLevel() >= SIMDLevel::SSE41) {
+				kernels[1 * 5 + 2] = ExpandChannelsSSSE3<1, 2>;
+				kernels[1 * 5 + 3] = ExpandChannelsSSSE3<1, 3>;
+				kernels[1 * 5 + 4] = ExpandChannelsSSSE3<1, 4>;
+				kernels[2 * 5 + 4] = ExpandChannelsSSSE3<2, 4>;
+				kernels[3 * 5 + 4] = ExpandChannelsSSSE3<3, 4>;
+			}
+			if (GetSIMDLevel() >= SIMDLevel::AVX2) {
+				kernels[1 * 5 + 2] = ExpandChannelsAVX2<1, 2>;
+				kernels[1 * 5 + 4] = ExpandChannelsAVX2<1, 4>;
+				kernels[2 * 5 + 4] = ExpandChannelsAVX2<2, 4>;
+				kernels[3 * 5 + 4] = ExpandChannelsAVX2<3, 4>;
+			}
+#endif
+			return kernels;
+		}
+		static const std::array<ExpandChannelsFunction, 25> expandChannelsKernels = SelectExpandChannels();
+
+		void ExpandChannels(uint8_t* target, const uint8_t* row, const size_t pixels, const unsigned int from, const unsigned int to, const unsigned int sampleBytes) {
+			if (sampleBytes == 2) {
+				ExpandChannels16(target, row, pixels, from, to);
+			}
+			else if (from < 5 && to < 5 && expandChannelsKernels[from * 5 + to] != nullptr) {
+				expandChannelsKernels[from * 5 + to](target, row, pixels);
+			}
+			else {
+				memcpy(target, row, pixels * from);
+			}
+		}
+
+		void Narrow16To8Tables(uint8_t* target, const uint8_t* row, const size_t pixels, const unsigned int channels, const uint8_t* const* tables, const uint8_t* shifts) {
+			for (size_t x = 0; x < pixels; x++) {
+				for (unsigned int c = 0; c < channels; c++, row += 2) {
+					*target++ = tables[c][(row[0] << 8 | row[1]) >> shifts[c]];
+				}
+			}
+		}
+
+		/* Samples are loaded & stored through memcpy, as rows in a caller's buffer may have any pitch (so 16-bit samples need not be aligned) */
+		template<typename Sample, typename Wide>
+		static void BlendOverSamples(uint8_t* target, const uint8_t* row, const size_t pixels, const unsigned int channels) {
+			const Wide full = (Sample)~0;
+			const unsigned int alpha = channels - 1;
+			const size_t pixelBytes = channels * sizeof(Sample);
+			for (size_t x = 0; x < pixels; x++, target += pixelBytes, row += pixelBytes) {
+				Sample source[4];
+				Sample destination[4];
+				memcpy(source, row, pixelBytes);
+				memcpy(destination, target, pixelBytes);
+
+				const Wide sourceAlpha = source[alpha];
+				if (sourceAlpha == full || destination[alpha] == 0) {
+					memcpy(target, source, pixelBytes);
+				}
+				else if (sourceAlpha != 0) {
+					const Wide u = sourceAlpha * full;
+					const Wide v = (full - sourceAlpha) * destination[alpha];
+					const Wide combined = u + v;
+					for (unsigned int c = 0; c < alpha; c++) {
+						destination[c] = (Sample)((source[c] * u + destination[c] * v) / combined);
+					}
+					destination[alpha] = (Sample)(combined / full);
+					memcpy(target, destination, pixelBytes);
+				}
+			}
+		}
+
+		void BlendOver(uint8_t* target, const uint8_t* row, const size_t pixels, const unsigned int channels, const unsigned int sampleBytes) {
+			if (sampleBytes == 2) {
+				BlendOverSamples<uint16_t, uint64_t>(target, row, pixels, channels);
+			}
+			else {
+				BlendOverSamples<uint8_t, uint32_t>(target, row, pixels, channels);
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "../cpu/cpu.h"
+
+namespace ImageLibrary {
+	namespace PNG {
+		/* Row conversion kernels (from the unfiltered scanline to the output format), picked for the SIMD level the CPU supports at startup */
+
+		/* Swaps the bytes of every 16-bit sample (png stores them in network byte order, the output is little-endian); length is in bytes and target may equal row */
+		void SwapBytes16(uint8_t* target, const uint8_t* row, const size_t length);
+
+		/* Unpacks 1, 2 or 4-bit samples (left-most pixel in the high-order bits) into a byte each, a whole input byte per table lookup
+		With replicate set, samples are widened to 8 bits by left bit replication (greyscale); otherwise they are kept as they are (palette indices)
+		*/
+		void UnpackSamples(uint8_t* target, const uint8_t* row, const size_t columns, const unsigned int bitDepth, const bool replicate);
+
+		/* Expands a row of palette indices to rgb8 (3 bytes per pixel) or rgba8 (4 bytes, when alpha is set)
+		palette holds 256 rgba entries (4 bytes each), so every index is valid and no bounds checks are needed
+		*/
+		void ExpandPalette(uint8_t* target, const uint8_t* indices, const size_t columns, const uint8_t* palette, const bool alpha);
+
+		/* Narrows 16-bit samples (network byte order, as in the scanline) to 8 bits, rounded to nearest: round(v * 255 / 65535) */
+		void Narrow16To8(uint8_t* target, const uint8_t* row, const size_t samples);
+
+		/* Narrows 16-bit samples through a table per channel (for images with sBIT): sample c of each pixel is shifted down by shifts[c], dropping the bits that are not significant,
+		and the rest is looked up in tables[c] (which should hold round(value * 255 / (2^bits - 1)))
+		*/
+		void Narrow16To8Tables(uint8_t* target, const uint8_t* row, const size_t pixels, const unsigned int channels, const uint8_t* const* tables, const uint8_t* shifts);
+
+		/* Adds channels to every pixel for a wider output format: grey to grey-alpha, rgb or rgba, grey-alpha to rgba, and rgb to rgba (from & to are channel counts)
+		Grey is copied into each of r, g & b, and added alpha is opaque; sampleBytes is 1 or 2 (16-bit samples are only copied, so can be in either byte order). target must not overlap row
+		*/
+		void ExpandChannels(uint8_t* target, const uint8_t* row, const size_t pixels, const unsigned int from, const unsigned int to, const unsigned int sampleBytes);
+
+		/* Composites a row over another (APNG's blend over), with alpha as the last of channels; samples are 8 or 16-bit (sampleBytes, in native byte order)
+		Opaque pixels are copied and fully transparent ones leave target as it is; the rest use the integer blend from the APNG specification
+		*/
+		void BlendOver(uint8_t* target, const uint8_t* row, const size_t pixels, const unsigned int channels, const unsigned int sampleBytes);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,413 @@
+#include "png.h"
+
+using namespace Generic;
+using namespace std;
+
+namespace ImageLibrary {
+	namespace PNG {
+
+		static void StoreBigEndian(uint8_t* out, const uint32_t value) {
+			out[0] = (uint8_t)(value >> 24);
+			out[1] = (uint8_t)(value >> 16);
+			out[2] = (uint8_t)(value >> 8);
+			out[3] = (uint8_t)value;
+		}
+
+		/* Length, type, data & CRC (of the type & data), straight to the backing */
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Write>::WriteChunk(const ChunkType type, const uint8_t* data, const unsigned int length) {
+			uint8_t header[8];
+			StoreBigEndian(header, length);
+			memcpy(header + 4, &type, 4); //chunk types are stored in file order
+			uint32_t crc = checksum::CRC32(header + 4, 4, 0);
+			if (length > 0) {
+				crc = checksum::CRC32(data, length, crc);
+			}
+			uint8_t trailer[4];
+			StoreBigEndian(trailer, crc);
+
+			Data<Backing, uint8_t, Mode::Write>::Write(header, 8);
+			if (length > 0) {
+				Data<Backing, uint8_t, Mode::Write>::Write(data, length);
+			}
+			Data<Backing, uint8_t, Mode::Write>::Write(trailer, 4);
+		}
+
+		/* Fills each IDAT chunk up to chunkSize before writing it; the last, partial one is written once deflate has finished */
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Write>::Write(const uint8_t* in, const unsigned int length) {
+			unsigned int remaining = length;
+			while (remaining > 0) {
+				const unsigned int amount = min(remaining, chunkSize - (unsigned int)idat.size());
+				idat.insert(idat.end(), in, in + amount);
+				in += amount;
+				remaining -= amount;
+				if (idat.size() == chunkSize) {
+					WriteChunk(ChunkType::IDAT, idat.data(), chunkSize);
+					idat.clear();
+				}
+			}
+		}
+
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Write>::WriteHeader(const ImageData& in, const Color_Type colorType, const uint8_t bitDepth) {
+			uint8_t ihdr[13];
+			StoreBigEndian(ihdr, in.dimensions.width);
+			StoreBigEndian(ihdr + 4, in.dimensions.height);
+			ihdr[8] = bitDepth;
+			ihdr[9] = (uint8_t)colorType;
+			ihdr[10] = 0; //deflate
+			ihdr[11] = 0; //adaptive filtering
+			ihdr[12] = 0; //not interlaced
+
+			uint8_t sig[8];
+			memcpy(sig, &signature, 8);
+			Data<Backing, uint8_t, Mode::Write>::Write(sig, 8);
+			WriteChunk(ChunkType::IHDR, ihdr, 13);
+		}
+
+		/* Collects the distinct colours of an rgb8 / rgba8 image, giving up once there are more than 256 */
+		template<typename Backing>
+		bool PNGStream<Backing, Mode::Write>::BuildPalette(const ImageData& in, const unsigned int channels) {
+			palette.clear();
+			paletteIndices.clear();
+			vector<uint32_t> colors;
+			const size_t pixels = (size_t)in.dimensions.width * in.dimensions.height;
+			const uint8_t* p = in.image.data();
+			uint32_t last = 0;
+			bool haveLast = false;
+			for (size_t i = 0; i < pixels; i++, p += channels) {
+				const uint32_t color = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)(channels == 4 ? p[3] : 255) << 24;
+				if (haveLast && color == last) {
+					continue; //runs of one colour are common
+				}
+				last = color;
+				haveLast = true;
+				if (paletteIndices.emplace(color, 0).second) {
+					colors.push_back(color);
+					if (colors.size() > 256) {
+						return false;
+					}
+				}
+			}
+
+			/* Translucent colours first, in the order they were found */
+			for (const uint32_t color : colors) {
+				if (color >> 24 != 255) {
+					palette.push_back(color);
+				}
+			}
+			for (const uint32_t color : colors) {
+				if (color >> 24 == 255) {
+					palette.push_back(color);
+				}
+			}
+			for (size_t i = 0; i < palette.size(); i++) {
+				paletteIndices[palette[i]] = (uint8_t)i;
+			}
+			return true;
+		}
+
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Write>::WritePalette() {
+			uint8_t entries[256 * 3];
+			uint8_t alpha[256];
+			unsigned int alphaCount = 0;
+			for (size_t i = 0; i < palette.size(); i++) {
+				entries[i * 3] = (uint8_t)palette[i];
+				entries[i * 3 + 1] = (uint8_t)(palette[i] >> 8);
+				entries[i * 3 + 2] = (uint8_t)(palette[i] >> 16);
+				alpha[i] = (uint8_t)(palette[i] >> 24);
+				if (alpha[i] != 255) {
+					alphaCount = (unsigned int)i + 1;
+				}
+			}
+			WriteChunk(ChunkType::PLTE, entries, (unsigned int)palette.size() * 3);
+			if (alphaCount > 0) {
+				WriteChunk(ChunkType::tRNS, alpha, alphaCount);
+			}
+		}
+
+		/* Indices packed with the left-most pixel in the high-order bits */
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Write>::PaletteRow(uint8_t* out, const uint8_t* row, const unsigned int width, const unsigned int channels, const uint8_t bitDepth) const {
+			const unsigned int perByte = 8 / bitDepth;
+			memset(out, 0, ((size_t)width * bitDepth + 7) / 8);
+			uint32_t last = 0;
+			uint8_t lastIndex = 0;
+			bool haveLast = false;
+			for (unsigned int x = 0; x < width; x++, row += channels) {
+				const uint32_t color = row[0] | row[1] << 8 | row[2] << 16 | (uint32_t)(channels == 4 ? row[3] : 255) << 24;
+				if (!haveLast || color != last) {
+					lastIndex = paletteIndices.find(color)->second;
+					last = color;
+					haveLast = true;
+				}
+				out[x / perByte] |= lastIndex << (8 - bitDepth * (x % perByte + 1));
+			}
+		}
+
+		/* Deflated rows of a strip, as a raw piece of the image's zlib stream, with the adler-32 of the rows (length bytes, filter types included) */
+		struct CompressedStrip {
+			vector<uint8_t> data;
+			uint32_t adler = 1;
+			uint64_t length = 0;
+		};
+
+		/* Rows first to end - 1 are each put into the file's format if they aren't already, filtered against the row before (as it was before filtering) and given to sink behind their filter type
+		The row before first is put into the file's format again rather than kept from an earlier call, so any range of rows can be filtered on its own
+		*/
+		template<typename Backing>
+		template<typename Sink>
+		void PNGStream<Backing, Mode::Write>::FilterRows(const ImageData& in, const EncodeLayout& layout, FilterBuffers& buffers, const unsigned int first, const unsigned int end, Sink&& sink) const {
+			const unsigned int stride = layout.stride;
+			buffers.Reserve(stride);
+			uint8_t* outputs[4] = { buffers.filtered[0].data(), buffers.filtered[1].data(), buffers.filtered[2].data(), buffers.filtered[3].data() };
+
+			auto fileRow = [&](const unsigned int y, vector<uint8_t>& buffer) -> const uint8_t* {
+				const uint8_t* source = in.image.data() + y * layout.inputStride;
+				if (layout.depth == 16) {
+					SwapBytes16(buffer.data(), source, stride);
+					return buffer.data();
+				}
+				if (layout.paletteDepth != 0) {
+					PaletteRow(buffer.data(), source, in.dimensions.width, layout.channels, layout.paletteDepth);
+					return buffer.data();
+				}
+				return source;
+			};
+
+			const uint8_t* prev;
+			if (first == 0) {
+				fill(buffers.previousScanline.begin(), buffers.previousScanline.end(), 0);
+				prev = buffers.previousScanline.data();
+			}
+			else {
+				prev = fileRow(first - 1, buffers.previousScanline);
+			}
+
+			for (unsigned int y = first; y < end; y++) {
+				const uint8_t* row = fileRow(y, buffers.scanline);
+
+				uint8_t type = (uint8_t)layout.filter;
+				const uint8_t* output = row;
+				if (layout.adaptive) {
+					const PNG_Filter chosen = FilterAdaptive(outputs, row, prev, stride, layout.bpp);
+					type = (uint8_t)chosen;
+					output = chosen == PNG_Filter::Filter_None ? row : outputs[type - 1];
+				}
+				else if (layout.filter != PNG_Filter::Filter_None) {
+					Filter(layout.filter, outputs[0], row, prev, stride, layout.bpp);
+					output = outputs[0];
+				}
+				sink(&type, 1);
+				sink(output, stride);
+
+				if (row == buffers.scanline.data()) {
+					buffers.scanline.swap(buffers.previousScanline);
+					prev = buffers.previousScanline.data();
+				}
+				else {
+					prev = row;
+				}
+			}
+		}
+
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Write>::WriteImageData(const ImageData& in, const EncodeLayout& layout) {
+			FilterRows(in, layout, filterBuffers, 0, in.dimensions.height, [this](const uint8_t* data, const unsigned int length) {
+				deflate.Write(data, length);
+			});
+			deflate.Finish();
+		}
+
+		/* Each strip primes its own deflate with the last 32K of filtered rows before it (filtering those rows again, so strips never wait on each other) and ends with a sync flush,
+		or the final block for the last strip; the zlib header & the adler-32 of the whole image (combined from those of the strips) go around them
+		Strips are handed to the pool a couple per thread ahead of the one being written, keeping every thread busy while only a few strips are held at once
+		*/
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Write>::WriteStrips(const ImageData& in, const EncodeLayout& layout, const EncodeOptions& options, const unsigned int rowsPerStrip, const unsigned int threads) {
+			const unsigned int height = in.dimensions.height;
+			const unsigned int strips = (height + rowsPerStrip - 1) / rowsPerStrip;
+			const unsigned int level = min(options.level, 9u);
+			if (stripPool == nullptr || stripPool->Size() != threads) {
+				stripPool = make_unique<ThreadPool>(threads);
+			}
+
+			auto compress = [this, &in, &layout, &options, level, rowsPerStrip, height](const unsigned int strip) {
+				const unsigned int first = strip * rowsPerStrip;
+				const unsigned int end = min(height, first + rowsPerStrip);
+				const size_t rowLength = (size_t)layout.stride + 1;
+
+				FilterBuffers buffers;
+				Data<vector<uint8_t>, uint8_t, Mode::Write> out;
+				zlib::ZLIBStream<vector<uint8_t>, Mode::Write> stripDeflate(&out, level, zlib::Format::Raw);
+				stripDeflate.SetStrategy((zlib::Strategy)options.strategy, options.precomputedCodes);
+				if (first > 0 && level > 0) {
+					const unsigned int primeRows = (unsigned int)min<size_t>(first, (zlib::sliding_32k + rowLength - 1) / rowLength);
+					vector<uint8_t> dictionary;
+					dictionary.reserve(primeRows * rowLength);
+					FilterRows(in, layout, buffers, first - primeRows, first, [&dictionary](const uint8_t* data, const unsigned int length) {
+						dictionary.insert(dictionary.end(), data, data + length);
+					});
+					stripDeflate.SetDictionary(dictionary.data(), (unsigned int)dictionary.size());
+				}
+
+				FilterRows(in, layout, buffers, first, end, [&stripDeflate](const uint8_t* data, const unsigned int length) {
+					stripDeflate.Write(data, length);
+				});
+				if (end == height) {
+					stripDeflate.Finish();
+				}
+				else {
+					stripDeflate.Flush();
+				}
+
+				CompressedStrip result;
+				result.data = move(out.source);
+				result.adler = stripDeflate.Checksum();
+				result.length = (uint64_t)(end - first) * rowLength;
+				return result;
+			};
+
+			uint8_t header[2];
+			zlib::ZLIBHeader(header, level);
+			Write(header, 2);
+
+			deque<future<CompressedStrip>> pending;
+			unsigned int submitted = 0;
+			uint32_t adler = 1;
+			try {
+				for (unsigned int strip = 0; strip < strips; strip++) {
+					while (submitted < strips && submitted < strip + threads * 2) {
+						pending.push_back(stripPool->Submit([&compress, submitted]() { return compress(submitted); }));
+						submitted++;
+					}
+					const CompressedStrip compressed = pending.front().get();
+					pending.pop_front();
+					Write(compressed.data.data(), (unsigned int)compressed.data.size());
+					adler = checksum::Adler32Combine(adler, compressed.adler, compressed.length);
+				}
+			}
+			catch (std::exception e) {
+				for (future<CompressedStrip>& strip : pending) {
+					strip.wait(); //still refer to the image
+				}
+				throw;
+			}
+
+			const uint8_t trailer[4] = { (uint8_t)(adler >> 24), (uint8_t)(adler >> 16), (uint8_t)(adler >> 8), (uint8_t)adler };
+			Write(trailer, 4);
+		}
+
+		template<typename Backing>
+		ImageStreamState PNGStream<Backing, Mode::Write>::EncodeData(const ImageData& in, const ImageOptions& options) {
+			state = {};
+			try {
+				const EncodeOptions& encode = options.encode;
+				const unsigned short formatting = (unsigned short)in.format.formatting;
+				const unsigned int depth = formatting & 0xFF;
+				const bool alpha = (in.format.formatting & FormatDetails::hasAlpha) != FormatDetails::Any;
+				const bool rgb = (in.format.formatting & FormatDetails::hasRGB) == FormatDetails::hasRGB;
+				const bool grey = (in.format.formatting & FormatDetails::hasGray) != FormatDetails::Any;
+
+				Color_Type colorType;
+				unsigned int channels;
+				if (grey && !rgb && !alpha && (depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16)) {
+					colorType = Color_Type::Greyscale;
+					channels = 1;
+				}
+				else if (grey && !rgb && alpha && (depth == 8 || depth == 16)) {
+					colorType = Color_Type::GreyscaleAlpha;
+					channels = 2;
+				}
+				else if (rgb && !grey && (depth == 8 || depth == 16)) {
+					colorType = alpha ? Color_Type::TruecolorAlpha : Color_Type::Truecolor;
+					channels = alpha ? 4 : 3;
+				}
+				else {
+					throw exception("Unsupported format to encode");
+				}
+
+				const unsigned int width = in.dimensions.width;
+				const unsigned int height = in.dimensions.height;
+				if (width == 0 || height == 0 || width > 0x7FFFFFFF || height > 0x7FFFFFFF) {
+					throw exception("Invalid image dimensions");
+				}
+				const uint64_t rowBytes = ((uint64_t)width * channels * depth + 7) / 8;
+				if (rowBytes > 0xFFFFFFFE) {
+					throw exception("Image too wide");
+				}
+				if (in.image.size() < rowBytes * height) {
+					throw exception("Image data is smaller than its dimensions");
+				}
+
+				/* A palette replaces the colour type & depth (which is as small as the number of colours allows) */
+				uint8_t paletteDepth = 0;
+				if (encode.palette && rgb && depth == 8 && BuildPalette(in, channels)) {
+					paletteDepth = palette.size() <= 2 ? 1 : palette.size() <= 4 ? 2 : palette.size() <= 16 ? 4 : 8;
+				}
+
+				const uint8_t bitDepth = paletteDepth != 0 ? paletteDepth : (uint8_t)depth;
+				EncodeLayout layout;
+				layout.stride = paletteDepth != 0 ? (width * paletteDepth + 7) / 8 : (unsigned int)rowBytes;
+				layout.bpp = paletteDepth != 0 ? 1 : max(1u, channels * depth / 8);
+				layout.depth = depth;
+				layout.channels = channels;
+				layout.paletteDepth = paletteDepth;
+				layout.inputStride = paletteDepth != 0 ? (size_t)width * channels : (size_t)rowBytes;
+				if (encode.filter == FilterStrategy::Adaptive) {
+					layout.adaptive = paletteDepth == 0 && depth >= 8;
+				}
+				else {
+					layout.filter = (PNG_Filter)((unsigned int)encode.filter - 1);
+				}
+
+				chunkSize = encode.chunkSize == 0 ? 1 << 16 : min(encode.chunkSize, 0x7FFFFFFFu);
+				idat.clear();
+				idat.reserve(min(chunkSize, 1u << 20));
+
+				WriteHeader(in, paletteDepth != 0 ? Color_Type::IndexedColor : colorType, bitDepth);
+				if (paletteDepth != 0) {
+					WritePalette();
+				}
+
+				const unsigned int threads = encode.threads != 0 ? encode.threads : thread::hardware_concurrency();
+				const unsigned int rowsPerStrip = (unsigned int)max<uint64_t>(1, min<uint64_t>(height, encode.stripSize / ((uint64_t)layout.stride + 1)));
+				const unsigned int strips = (height + rowsPerStrip - 1) / rowsPerStrip;
+				if (threads > 1 && strips > 1) {
+					WriteStrips(in, layout, encode, rowsPerStrip, min(threads, strips));
+				}
+				else {
+					deflate.Reset(this);
+					deflate.SetLevel(encode.level);
+					deflate.SetStrategy((zlib::Strategy)encode.strategy, encode.precomputedCodes);
+					WriteImageData(in, layout);
+				}
+				if (!idat.empty()) {
+					WriteChunk(ChunkType::IDAT, idat.data(), (unsigned int)idat.size());
+					idat.clear();
+				}
+				WriteChunk(ChunkType::IEND, nullptr, 0);
+				Data<Backing, uint8_t, Mode::Write>::Flush();
+			}
+			catch (std::exception e) {
+				state.hasError = true;
+				state.isFatalError = true;
+				state.err = string("[PNG] ") + e.what();
+			}
+			return state;
+		}
+
+		template<typename Backing>
+		ImageStreamState PNGStream<Backing, Mode::Write>::QueryState() {
+			return state;
+		}
+
+
+
+		/* Explicit template instantiations */
+		template class PNGStream<vector<uint8_t>, Mode::Write>;
+		template class PNGStream<basic_ofstream<uint8_t, std::char_traits<uint8_t>>, Mode::Write>;
+	}
+}
\ No newline at end of file
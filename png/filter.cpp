@@ -0,0 +1,679 @@
+#include "filter.h"
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#if IMAGELIB_X86
+#include <immintrin.h>
+#endif
+
+using namespace Generic::cpu;
+
+namespace ImageLibrary {
+	namespace PNG {
+		static inline uint8_t PaethPredictor(const int a, const int b, const int c) {
+			int pa = abs(b - c);
+			int pb = abs(a - c);
+			int pc = abs(a + b - c - c);
+
+			if (pa <= pb && pa <= pc) { return a; }
+			if (pb <= pc) { return b; }
+			return c;
+		}
+
+		/* The first pixel of a scanline has no left neighbour (a = c = 0), so it is handled before the main loop to keep that loop branch-free */
+		void UnfilterScalar(const PNG_Filter filter, uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp) {
+			size_t first = bpp < length ? bpp : length;
+
+			switch (filter) {
+			case PNG_Filter::Filter_None:
+				break;
+			case PNG_Filter::Filter_Sub:
+				for (size_t i = bpp; i < length; i++) {
+					row[i] += row[i - bpp];
+				}
+				break;
+			case PNG_Filter::Filter_Up:
+				for (size_t i = 0; i < length; i++) {
+					row[i] += prev[i];
+				}
+				break;
+			case PNG_Filter::Filter_Average:
+				for (size_t i = 0; i < first; i++) {
+					row[i] += prev[i] >> 1;
+				}
+				for (size_t i = bpp; i < length; i++) {
+					row[i] += (row[i - bpp] + prev[i]) >> 1;
+				}
+				break;
+			case PNG_Filter::Filter_Paeth:
+				for (size_t i = 0; i < first; i++) {
+					row[i] += prev[i]; //Paeth(0, b, 0) is always b
+				}
+				for (size_t i = bpp; i < length; i++) {
+					row[i] += PaethPredictor(row[i - bpp], prev[i], prev[i - bpp]);
+				}
+				break;
+			default:
+				throw std::exception("Invalid filter type found!");
+			}
+		}
+
+
+
+		/* ======= Vector kernels ======= */
+#if IMAGELIB_X86
+		/* Sub, Average and Paeth only use 128-bit registers at every level (they carry a dependency from one pixel to the next), so those kernels need SSE4.1 at most
+		The wider levels only change Up
+		*/
+
+		/* Pixels of 3 and 6 bytes cannot be loaded directly without touching the next pixel (or reading past the end of the row), so they are put together from a 2 / 4 byte part and a 1 / 2 byte part */
+		template<unsigned int bpp>
+		IMAGELIB_TARGET("sse4.1") static inline __m128i LoadPixel(const uint8_t* p) {
+			if constexpr (bpp == 1) {
+				return _mm_cvtsi32_si128(*p);
+			}
+			else if constexpr (bpp == 2) {
+				uint16_t v;
+				memcpy(&v, p, 2);
+				return _mm_cvtsi32_si128(v);
+			}
+			else if constexpr (bpp == 3) {
+				uint16_t v;
+				memcpy(&v, p, 2);
+				return _mm_cvtsi32_si128(v | p[2] << 16);
+			}
+			else if constexpr (bpp == 4) {
+				uint32_t v;
+				memcpy(&v, p, 4);
+				return _mm_cvtsi32_si128(v);
+			}
+			else if constexpr (bpp == 6) {
+				uint32_t low;
+				uint16_t high;
+				memcpy(&low, p, 4);
+				memcpy(&high, p + 4, 2);
+				return _mm_insert_epi16(_mm_cvtsi32_si128(low), high, 2);
+			}
+			else {
+				return _mm_loadl_epi64((const __m128i*)p);
+			}
+		}
+		template<unsigned int bpp>
+		IMAGELIB_TARGET("sse4.1") static inline void StorePixel(uint8_t* p, const __m128i pixel) {
+			if constexpr (bpp == 8) {
+				_mm_storel_epi64((__m128i*)p, pixel);
+			}
+			else {
+				uint32_t v = _mm_cvtsi128_si32(pixel);
+				if constexpr (bpp == 1) { *p = (uint8_t)v; }
+				if constexpr (bpp == 2 || bpp == 3) { memcpy(p, &v, 2); }
+				if constexpr (bpp == 3) { p[2] = (uint8_t)(v >> 16); }
+				if constexpr (bpp == 4 || bpp == 6) { memcpy(p, &v, 4); }
+				if constexpr (bpp == 6) {
+					uint16_t high = (uint16_t)_mm_extract_epi16(pixel, 2);
+					memcpy(p + 4, &high, 2);
+				}
+			}
+		}
+
+		/* Up has no dependency along the row, so it is done a full register at a time */
+		IMAGELIB_TARGET("sse4.1") static void UnfilterUpSSE41(uint8_t* row, const uint8_t* prev, const size_t length) {
+			size_t i = 0;
+			for (; i + 16 <= length; i += 16) {
+				__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+				__m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+				_mm_storeu_si128((__m128i*)(row + i), _mm_add_epi8(x, b));
+			}
+			for (; i < length; i++) {
+				row[i] += prev[i];
+			}
+		}
+		IMAGELIB_TARGET("avx2") static void UnfilterUpAVX2(uint8_t* row, const uint8_t* prev, const size_t length) {
+			size_t i = 0;
+			for (; i + 32 <= length; i += 32) {
+				__m256i x = _mm256_loadu_si256((const __m256i*)(row + i));
+				__m256i b = _mm256_loadu_si256((const __m256i*)(prev + i));
+				_mm256_storeu_si256((__m256i*)(row + i), _mm256_add_epi8(x, b));
+			}
+			for (; i < length; i++) {
+				row[i] += prev[i];
+			}
+		}
+		/* The last (partial) 64 bytes go through a masked load / store rather than a byte loop */
+		IMAGELIB_TARGET("avx512f,avx512bw") static void UnfilterUpAVX512(uint8_t* row, const uint8_t* prev, const size_t length) {
+			size_t i = 0;
+			for (; i + 64 <= length; i += 64) {
+				__m512i x = _mm512_loadu_si512((const void*)(row + i));
+				__m512i b = _mm512_loadu_si512((const void*)(prev + i));
+				_mm512_storeu_si512((void*)(row + i), _mm512_add_epi8(x, b));
+			}
+			if (i < length) {
+				__mmask64 mask = ~0ULL >> (64 - (length - i));
+				__m512i x = _mm512_maskz_loadu_epi8(mask, row + i);
+				__m512i b = _mm512_maskz_loadu_epi8(mask, prev + i);
+				_mm512_mask_storeu_epi8(row + i, mask, _mm512_add_epi8(x, b));
+			}
+		}
+
+		/* Sub is a running sum of pixels, so for pixel sizes that divide 16 bytes it is computed as a prefix sum within the register (log2(16 / bpp) shifted adds)
+		and the last pixel is broadcast to carry into the next 16 bytes
+		*/
+		template<unsigned int bpp>
+		IMAGELIB_TARGET("sse4.1") static void UnfilterSubPrefix(uint8_t* row, const size_t length) {
+			__m128i carry = _mm_setzero_si128();
+			size_t i = 0;
+			for (; i + 16 <= length; i += 16) {
+				__m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+				if constexpr (bpp <= 1) { x = _mm_add_epi8(x, _mm_slli_si128(x, 1)); }
+				if constexpr (bpp <= 2) { x = _mm_add_epi8(x, _mm_slli_si128(x, 2)); }
+				if constexpr (bpp <= 4) { x = _mm_add_epi8(x, _mm_slli_si128(x, 4)); }
+				x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+				x = _mm_add_epi8(x, carry);
+				_mm_storeu_si128((__m128i*)(row + i), x);
+
+				if constexpr (bpp == 1) { carry = _mm_shuffle_epi8(x, _mm_set1_epi8(15)); }
+				if constexpr (bpp == 2) { carry = _mm_shuffle_epi8(x, _mm_set1_epi16(0x0F0E)); }
+				if constexpr (bpp == 4) { carry = _mm_shuffle_epi32(x, 0xFF); }
+				if constexpr (bpp == 8) { carry = _mm_unpackhi_epi64(x, x); }
+			}
+			for (i = i > 0 ? i : bpp; i < length; i++) {
+				row[i] += row[i - bpp];
+			}
+		}
+
+		/* 3 and 6 byte pixels don't tile a register, so the previous pixel (a) is carried along in a register one pixel at a time */
+		template<unsigned int bpp>
+		IMAGELIB_TARGET("sse4.1") static void UnfilterSubPixel(uint8_t* row, const size_t length) {
+			__m128i a = _mm_setzero_si128();
+			for (size_t i = 0; i + bpp <= length; i += bpp) {
+				a = _mm_add_epi8(a, LoadPixel<bpp>(row + i));
+				StorePixel<bpp>(row + i, a);
+			}
+		}
+
+		/* _mm_avg_epu8 rounds up, so the low bit of (a ^ b) is taken off to get the floor that the filter uses */
+		template<unsigned int bpp>
+		IMAGELIB_TARGET("sse4.1") static void UnfilterAverage(uint8_t* row, const uint8_t* prev, const size_t length) {
+			const __m128i one = _mm_set1_epi8(1);
+			__m128i a = _mm_setzero_si128();
+			for (size_t i = 0; i + bpp <= length; i += bpp) {
+				__m128i b = LoadPixel<bpp>(prev + i);
+				__m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+				a = _mm_add_epi8(LoadPixel<bpp>(row + i), avg);
+				StorePixel<bpp>(row + i, a);
+			}
+		}
+
+		/* Predictor chosen on 16-bit lanes: pa = |b - c|, pb = |a - c|, pc = |(b - c) + (a - c)|, taking a, then b, then c on ties (as the spec orders them) */
+		template<unsigned int bpp>
+		IMAGELIB_TARGET("sse4.1") static void UnfilterPaeth(uint8_t* row, const uint8_t* prev, const size_t length) {
+			const __m128i zero = _mm_setzero_si128();
+			__m128i a = zero;
+			__m128i c = zero;
+			for (size_t i = 0; i + bpp <= length; i += bpp) {
+				__m128i b = _mm_unpacklo_epi8(LoadPixel<bpp>(prev + i), zero);
+				__m128i x = LoadPixel<bpp>(row + i);
+
+				__m128i pa = _mm_sub_epi16(b, c);
+				__m128i pb = _mm_sub_epi16(a, c);
+				__m128i pc = _mm_abs_epi16(_mm_add_epi16(pa, pb));
+				pa = _mm_abs_epi16(pa);
+				pb = _mm_abs_epi16(pb);
+
+				__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+				__m128i nearest = _mm_blendv_epi8(c, b, _mm_cmpeq_epi16(pb, smallest));
+				nearest = _mm_blendv_epi8(nearest, a, _mm_cmpeq_epi16(pa, smallest));
+
+				x = _mm_add_epi8(x, _mm_packus_epi16(nearest, nearest));
+				StorePixel<bpp>(row + i, x);
+
+				a = _mm_unpacklo_epi8(x, zero);
+				c = b;
+			}
+		}
+
+		/* Average and Paeth on 1 and 2 byte pixels depend on the byte just written, so there is nothing to vectorise; a fixed bpp still lets the compiler keep a and c in registers */
+		template<unsigned int bpp>
+		static void UnfilterAverageSmall(uint8_t* row, const uint8_t* prev, const size_t length) {
+			for (size_t i = 0; i < bpp && i < length; i++) {
+				row[i] += prev[i] >> 1;
+			}
+			for (size_t i = bpp; i < length; i++) {
+				row[i] += (row[i - bpp] + prev[i]) >> 1;
+			}
+		}
+		template<unsigned int bpp>
+		static void UnfilterPaethSmall(uint8_t* row, const uint8_t* prev, const size_t length) {
+			for (size_t i = 0; i < bpp && i < length; i++) {
+				row[i] += prev[i];
+			}
+			for (size_t i = bpp; i < length; i++) {
+				row[i] += PaethPredictor(row[i - bpp], prev[i], prev[i - bpp]);
+			}
+		}
+
+		template<unsigned int bpp, SIMDLevel level>
+		static void UnfilterBpp(const PNG_Filter filter, uint8_t* row, const uint8_t* prev, const size_t length) {
+			switch (filter) {
+			case PNG_Filter::Filter_None:
+				break;
+			case PNG_Filter::Filter_Sub:
+				if constexpr (bpp == 3 || bpp == 6) {
+					UnfilterSubPixel<bpp>(row, length);
+				}
+				else {
+					UnfilterSubPrefix<bpp>(row, length);
+				}
+				break;
+			case PNG_Filter::Filter_Up:
+				if constexpr (level == SIMDLevel::AVX512) {
+					UnfilterUpAVX512(row, prev, length);
+				}
+				else if constexpr (level == SIMDLevel::AVX2) {
+					UnfilterUpAVX2(row, prev, length);
+				}
+				else {
+					UnfilterUpSSE41(row, prev, length);
+				}
+				break;
+			case PNG_Filter::Filter_Average:
+				if constexpr (bpp < 3) {
+					UnfilterAverageSmall<bpp>(row, prev, length);
+				}
+				else {
+					UnfilterAverage<bpp>(row, prev, length);
+				}
+				break;
+			case PNG_Filter::Filter_Paeth:
+				if constexpr (bpp < 3) {
+					UnfilterPaethSmall<bpp>(row, prev, length);
+				}
+				else {
+					UnfilterPaeth<bpp>(row, prev, length);
+				}
+				break;
+			default:
+				throw std::exception("Invalid filter type found!");
+			}
+		}
+
+		template<SIMDLevel level>
+		static void UnfilterLevel(const PNG_Filter filter, uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp) {
+			switch (bpp) {
+			case 1:
+				UnfilterBpp<1, level>(filter, row, prev, length);
+				break;
+			case 2:
+				UnfilterBpp<2, level>(filter, row, prev, length);
+				break;
+			case 3:
+				UnfilterBpp<3, level>(filter, row, prev, length);
+				break;
+			case 4:
+				UnfilterBpp<4, level>(filter, row, prev, length);
+				break;
+			case 6:
+				UnfilterBpp<6, level>(filter, row, prev, length);
+				break;
+			case 8:
+				UnfilterBpp<8, level>(filter, row, prev, length);
+				break;
+			default:
+				UnfilterScalar(filter, row, prev, length, bpp);
+				break;
+			}
+		}
+#endif
+
+		UnfilterFunction GetUnfilter(const SIMDLevel level) {
+#if IMAGELIB_X86
+			switch (level) {
+			case SIMDLevel::SSE41:
+				return UnfilterLevel<SIMDLevel::SSE41>;
+			case SIMDLevel::AVX2:
+				return UnfilterLevel<SIMDLevel::AVX2>;
+			case SIMDLevel::AVX512:
+				return UnfilterLevel<SIMDLevel::AVX512>;
+			default:
+				break;
+			}
+#endif
+			return UnfilterScalar;
+		}
+
+		/* Picked once at startup */
+		static const UnfilterFunction unfilterKernel = GetUnfilter(GetSIMDLevel());
+
+		void Unfilter(const PNG_Filter filter, uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp) {
+			unfilterKernel(filter, row, prev, length, bpp);
+		}
+
+
+		/* ======= Filtering ======= */
+
+		/* Size of a filtered byte for the adaptive heuristic: its distance from zero, taken as signed */
+		static inline unsigned int Magnitude(const uint8_t value) {
+			return value < 128 ? value : 256 - value;
+		}
+
+		static constexpr int all_filters = -1;
+
+		/* Filters bytes start to end of a scanline: with which set to a filter, only that one (into out[0]); with all_filters, Sub to Paeth into out[0] to out[3],
+		adding the magnitude of every output (None first) to sums
+		*/
+		template<int which>
+		static inline void FilterBytes(uint8_t* const* out, const uint8_t* row, const uint8_t* prev, const size_t start, const size_t end, const unsigned int bpp, uint64_t* sums) {
+			for (size_t i = start; i < end; i++) {
+				const int x = row[i];
+				const int a = i >= bpp ? row[i - bpp] : 0;
+				const int b = prev[i];
+				const int c = i >= bpp ? prev[i - bpp] : 0;
+				if constexpr (which == all_filters) {
+					const uint8_t sub = (uint8_t)(x - a);
+					const uint8_t up = (uint8_t)(x - b);
+					const uint8_t average = (uint8_t)(x - ((a + b) >> 1));
+					const uint8_t paeth = (uint8_t)(x - PaethPredictor(a, b, c));
+					out[0][i] = sub;
+					out[1][i] = up;
+					out[2][i] = average;
+					out[3][i] = paeth;
+					sums[0] += Magnitude((uint8_t)x);
+					sums[1] += Magnitude(sub);
+					sums[2] += Magnitude(up);
+					sums[3] += Magnitude(average);
+					sums[4] += Magnitude(paeth);
+				}
+				else if constexpr (which == (int)PNG_Filter::Filter_None) {
+					out[0][i] = (uint8_t)x;
+				}
+				else if constexpr (which == (int)PNG_Filter::Filter_Sub) {
+					out[0][i] = (uint8_t)(x - a);
+				}
+				else if constexpr (which == (int)PNG_Filter::Filter_Up) {
+					out[0][i] = (uint8_t)(x - b);
+				}
+				else if constexpr (which == (int)PNG_Filter::Filter_Average) {
+					out[0][i] = (uint8_t)(x - ((a + b) >> 1));
+				}
+				else {
+					out[0][i] = (uint8_t)(x - PaethPredictor(a, b, c));
+				}
+			}
+		}
+
+		static PNG_Filter Smallest(const uint64_t* sums) {
+			unsigned int best = 0;
+			for (unsigned int filter = 1; filter < 5; filter++) {
+				if (sums[filter] < sums[best]) {
+					best = filter;
+				}
+			}
+			return (PNG_Filter)best;
+		}
+
+		void FilterScalar(const PNG_Filter filter, uint8_t* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp) {
+			uint8_t* const target[1] = { out };
+			switch (filter) {
+			case PNG_Filter::Filter_None:
+				memcpy(out, row, length);
+				break;
+			case PNG_Filter::Filter_Sub:
+				FilterBytes<(int)PNG_Filter::Filter_Sub>(target, row, prev, 0, length, bpp, nullptr);
+				break;
+			case PNG_Filter::Filter_Up:
+				FilterBytes<(int)PNG_Filter::Filter_Up>(target, row, prev, 0, length, bpp, nullptr);
+				break;
+			case PNG_Filter::Filter_Average:
+				FilterBytes<(int)PNG_Filter::Filter_Average>(target, row, prev, 0, length, bpp, nullptr);
+				break;
+			case PNG_Filter::Filter_Paeth:
+				FilterBytes<(int)PNG_Filter::Filter_Paeth>(target, row, prev, 0, length, bpp, nullptr);
+				break;
+			default:
+				throw std::exception("Invalid filter type found!");
+			}
+		}
+
+		PNG_Filter FilterAdaptiveScalar(uint8_t* const* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp) {
+			uint64_t sums[5] = {};
+			FilterBytes<all_filters>(out, row, prev, 0, length, bpp, sums);
+			return Smallest(sums);
+		}
+
+#if IMAGELIB_X86
+		/* The neighbours of a whole register of bytes are loaded bpp bytes back (a from the row, c from prev), after the first pixel which has none
+		Magnitudes are min(v, -v) as unsigned bytes, summed by _mm_sad_epu8 against zero into 64-bit lanes
+		*/
+		IMAGELIB_TARGET("sse4.1") static inline __m128i PaethLanes(const __m128i a, const __m128i b, const __m128i c) {
+			__m128i pa = _mm_sub_epi16(b, c);
+			__m128i pb = _mm_sub_epi16(a, c);
+			__m128i pc = _mm_abs_epi16(_mm_add_epi16(pa, pb));
+			pa = _mm_abs_epi16(pa);
+			pb = _mm_abs_epi16(pb);
+
+			__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+			__m128i nearest = _mm_blendv_epi8(c, b, _mm_cmpeq_epi16(pb, smallest));
+			return _mm_blendv_epi8(nearest, a, _mm_cmpeq_epi16(pa, smallest));
+		}
+		IMAGELIB_TARGET("sse4.1") static inline __m128i PaethPredict(const __m128i a, const __m128i b, const __m128i c) {
+			const __m128i zero = _mm_setzero_si128();
+			__m128i low = PaethLanes(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+			__m128i high = PaethLanes(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+			return _mm_packus_epi16(low, high);
+		}
+		IMAGELIB_TARGET("sse4.1") static inline __m128i MagnitudeSum(const __m128i total, const __m128i v) {
+			const __m128i zero = _mm_setzero_si128();
+			return _mm_add_epi64(total, _mm_sad_epu8(_mm_min_epu8(v, _mm_sub_epi8(zero, v)), zero));
+		}
+
+		template<int which>
+		IMAGELIB_TARGET("sse4.1") static void FilterSSE41(uint8_t* const* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp, uint64_t* sums) {
+			const size_t first = bpp < length ? bpp : length;
+			FilterBytes<which>(out, row, prev, 0, first, bpp, sums);
+
+			const __m128i one = _mm_set1_epi8(1);
+			__m128i totals[5] = {};
+			size_t i = first;
+			for (; i + 16 <= length; i += 16) {
+				const __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+				const __m128i a = _mm_loadu_si128((const __m128i*)(row + i - bpp));
+				const __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+				if constexpr (which == all_filters || which == (int)PNG_Filter::Filter_Sub) {
+					const __m128i sub = _mm_sub_epi8(x, a);
+					_mm_storeu_si128((__m128i*)(out[0] + i), sub);
+					if constexpr (which == all_filters) {
+						totals[0] = MagnitudeSum(totals[0], x);
+						totals[1] = MagnitudeSum(totals[1], sub);
+					}
+				}
+				if constexpr (which == all_filters || which == (int)PNG_Filter::Filter_Up) {
+					const __m128i up = _mm_sub_epi8(x, b);
+					_mm_storeu_si128((__m128i*)(out[which == all_filters ? 1 : 0] + i), up);
+					if constexpr (which == all_filters) {
+						totals[2] = MagnitudeSum(totals[2], up);
+					}
+				}
+				if constexpr (which == all_filters || which == (int)PNG_Filter::Filter_Average) {
+					const __m128i average = _mm_sub_epi8(x, _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one)));
+					_mm_storeu_si128((__m128i*)(out[which == all_filters ? 2 : 0] + i), average);
+					if constexpr (which == all_filters) {
+						totals[3] = MagnitudeSum(totals[3], average);
+					}
+				}
+				if constexpr (which == all_filters || which == (int)PNG_Filter::Filter_Paeth) {
+					const __m128i c = _mm_loadu_si128((const __m128i*)(prev + i - bpp));
+					const __m128i paeth = _mm_sub_epi8(x, PaethPredict(a, b, c));
+					_mm_storeu_si128((__m128i*)(out[which == all_filters ? 3 : 0] + i), paeth);
+					if constexpr (which == all_filters) {
+						totals[4] = MagnitudeSum(totals[4], paeth);
+					}
+				}
+			}
+			FilterBytes<which>(out, row, prev, i, length, bpp, sums);
+
+			if constexpr (which == all_filters) {
+				for (unsigned int filter = 0; filter < 5; filter++) {
+					alignas(16) uint64_t lanes[2];
+					_mm_store_si128((__m128i*)lanes, totals[filter]);
+					sums[filter] += lanes[0] + lanes[1];
+				}
+			}
+		}
+
+		/* Unpacking & packing work within each 128-bit half, so the Paeth predictor comes back in the same byte order */
+		IMAGELIB_TARGET("avx2") static inline __m256i PaethLanesAVX2(const __m256i a, const __m256i b, const __m256i c) {
+			__m256i pa = _mm256_sub_epi16(b, c);
+			__m256i pb = _mm256_sub_epi16(a, c);
+			__m256i pc = _mm256_abs_epi16(_mm256_add_epi16(pa, pb));
+			pa = _mm256_abs_epi16(pa);
+			pb = _mm256_abs_epi16(pb);
+
+			__m256i smallest = _mm256_min_epi16(pc, _mm256_min_epi16(pa, pb));
+			__m256i nearest = _mm256_blendv_epi8(c, b, _mm256_cmpeq_epi16(pb, smallest));
+			return _mm256_blendv_epi8(nearest, a, _mm256_cmpeq_epi16(pa, smallest));
+		}
+		IMAGELIB_TARGET("avx2") static inline __m256i PaethPredictAVX2(const __m256i a, const __m256i b, const __m256i c) {
+			const __m256i zero = _mm256_setzero_si256();
+			__m256i low = PaethLanesAVX2(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero), _mm256_unpacklo_epi8(c, zero));
+			__m256i high = PaethLanesAVX2(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero), _mm256_unpackhi_epi8(c, zero));
+			return _mm256_packus_epi16(low, high);
+		}
+		IMAGELIB_TARGET("avx2") static inline __m256i MagnitudeSumAVX2(const __m256i total, const __m256i v) {
+			const __m256i zero = _mm256_setzero_si256();
+			return _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_min_epu8(v, _mm256_sub_epi8(zero, v)), zero));
+		}
+
+		template<int which>
+		IMAGELIB_TARGET("avx2") static void FilterAVX2(uint8_t* const* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp, uint64_t* sums) {
+			const size_t first = bpp < length ? bpp : length;
+			FilterBytes<which>(out, row, prev, 0, first, bpp, sums);
+
+			const __m256i one = _mm256_set1_epi8(1);
+			__m256i totals[5] = {};
+			size_t i = first;
+			for (; i + 32 <= length; i += 32) {
+				const __m256i x = _mm256_loadu_si256((const __m256i*)(row + i));
+				const __m256i a = _mm256_loadu_si256((const __m256i*)(row + i - bpp));
+				const __m256i b = _mm256_loadu_si256((const __m256i*)(prev + i));
+				if constexpr (which == all_filters || which == (int)PNG_Filter::Filter_Sub) {
+					const __m256i sub = _mm256_sub_epi8(x, a);
+					_mm256_storeu_si256((__m256i*)(out[0] + i), sub);
+					if constexpr (which == all_filters) {
+						totals[0] = MagnitudeSumAVX2(totals[0], x);
+						totals[1] = MagnitudeSumAVX2(totals[1], sub);
+					}
+				}
+				if constexpr (which == all_filters || which == (int)PNG_Filter::Filter_Up) {
+					const __m256i up = _mm256_sub_epi8(x, b);
+					_mm256_storeu_si256((__m256i*)(out[which == all_filters ? 1 : 0] + i), up);
+					if constexpr (which == all_filters) {
+						totals[2] = MagnitudeSumAVX2(totals[2], up);
+					}
+				}
+				if constexpr (which == all_filters || which == (int)PNG_Filter::Filter_Average) {
+					const __m256i average = _mm256_sub_epi8(x, _mm256_sub_epi8(_mm256_avg_epu8(a, b), _mm256_and_si256(_mm256_xor_si256(a, b), one)));
+					_mm256_storeu_si256((__m256i*)(out[which == all_filters ? 2 : 0] + i), average);
+					if constexpr (which == all_filters) {
+						totals[3] = MagnitudeSumAVX2(totals[3], average);
+					}
+				}
+				if constexpr (which == all_filters || which == (int)PNG_Filter::Filter_Paeth) {
+					const __m256i c = _mm256_loadu_si256((const __m256i*)(prev + i - bpp));
+					const __m256i paeth = _mm256_sub_epi8(x, PaethPredictAVX2(a, b, c));
+					_mm256_storeu_si256((__m256i*)(out[which == all_filters ? 3 : 0] + i), paeth);
+					if constexpr (which == all_filters) {
+						totals[4] = MagnitudeSumAVX2(totals[4], paeth);
+					}
+				}
+			}
+			FilterBytes<which>(out, row, prev, i, length, bpp, sums);
+
+			if constexpr (which == all_filters) {
+				for (unsigned int filter = 0; filter < 5; filter++) {
+					alignas(32) uint64_t lanes[4];
+					_mm256_store_si256((__m256i*)lanes, totals[filter]);
+					sums[filter] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+				}
+			}
+		}
+
+		/* AVX-512 runs the AVX2 kernels (filtering a row is bound by memory long before 64 byte registers would help) */
+		template<SIMDLevel level, int which>
+		static inline void FilterKernel(uint8_t* const* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp, uint64_t* sums) {
+			if constexpr (level >= SIMDLevel::AVX2) {
+				FilterAVX2<which>(out, row, prev, length, bpp, sums);
+			}
+			else {
+				FilterSSE41<which>(out, row, prev, length, bpp, sums);
+			}
+		}
+
+		template<SIMDLevel level>
+		static void FilterLevel(const PNG_Filter filter, uint8_t* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp) {
+			uint8_t* const target[1] = { out };
+			switch (filter) {
+			case PNG_Filter::Filter_None:
+				memcpy(out, row, length);
+				break;
+			case PNG_Filter::Filter_Sub:
+				FilterKernel<level, (int)PNG_Filter::Filter_Sub>(target, row, prev, length, bpp, nullptr);
+				break;
+			case PNG_Filter::Filter_Up:
+				FilterKernel<level, (int)PNG_Filter::Filter_Up>(target, row, prev, length, bpp, nullptr);
+				break;
+			case PNG_Filter::Filter_Average:
+				FilterKernel<level, (int)PNG_Filter::Filter_Average>(target, row, prev, length, bpp, nullptr);
+				break;
+			case PNG_Filter::Filter_Paeth:
+				FilterKernel<level, (int)PNG_Filter::Filter_Paeth>(target, row, prev, length, bpp, nullptr);
+				break;
+			default:
+				throw std::exception("Invalid filter type found!");
+			}
+		}
+
+		template<SIMDLevel level>
+		static PNG_Filter FilterAdaptiveLevel(uint8_t* const* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp) {
+			uint64_t sums[5] = {};
+			FilterKernel<level, all_filters>(out, row, prev, length, bpp, sums);
+			return Smallest(sums);
+		}
+#endif
+
+		FilterFunction GetFilter(const SIMDLevel level) {
+#if IMAGELIB_X86
+			if (level >= SIMDLevel::AVX2) {
+				return FilterLevel<SIMDLevel::AVX2>;
+			}
+			if (level >= SIMDLevel::SSE41) {
+				return FilterLevel<SIMDLevel::SSE41>;
+			}
+#endif
+			return FilterScalar;
+		}
+
+		AdaptiveFilterFunction GetAdaptiveFilter(const SIMDLevel level) {
+#if IMAGELIB_X86
+			if (level >= SIMDLevel::AVX2) {
+				return FilterAdaptiveLevel<SIMDLevel::AVX2>;
+			}
+			if (level >= SIMDLevel::SSE41) {
+				return FilterAdaptiveLevel<SIMDLevel::SSE41>;
+			}
+#endif
+			return FilterAdaptiveScalar;
+		}
+
+		static const FilterFunction filterKernel = GetFilter(GetSIMDLevel());
+		static const AdaptiveFilterFunction adaptiveFilterKernel = GetAdaptiveFilter(GetSIMDLevel());
+
+		void Filter(const PNG_Filter filter, uint8_t* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp) {
+			filterKernel(filter, out, row, prev, length, bpp);
+		}
+
+		PNG_Filter FilterAdaptive(uint8_t* const* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp) {
+			return adaptiveFilterKernel(out, row, prev, length, bpp);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "../cpu/cpu.h"
+
+namespace ImageLibrary {
+	namespace PNG {
+		enum class PNG_Filter : uint8_t {
+			Filter_None,
+			Filter_Sub,
+			Filter_Up,
+			Filter_Average,
+			Filter_Paeth
+		};
+
+		/* Reverses the filter of one scanline in place (row points just past the filter byte)
+		prev is the already unfiltered scanline above it in the same pass (all zeros for the first scanline of a pass)
+		bpp is the number of bytes per complete pixel, rounded up to 1 for bit depths under 8
+		Pixel sizes of 1, 2, 3, 4, 6 and 8 bytes (every size png can produce) each have their own vector kernels, for the SIMD level the CPU supports
+		*/
+		void Unfilter(const PNG_Filter filter, uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp);
+
+		/* Byte at a time reference version of Unfilter (the vector kernels are checked & benchmarked against it) */
+		void UnfilterScalar(const PNG_Filter filter, uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp);
+
+		using UnfilterFunction = void (*)(const PNG_Filter filter, uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp);
+
+		/* Unfilter kernels built for a given SIMD level (Unfilter itself uses the level from GetSIMDLevel at startup); the level must be supported by the CPU */
+		UnfilterFunction GetUnfilter(const Generic::cpu::SIMDLevel level);
+
+
+		/* Filters one scanline into out (which must not overlap row), as the encoder writes it; prev and bpp are as for Unfilter (prev being the unfiltered row above) */
+		void Filter(const PNG_Filter filter, uint8_t* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp);
+
+		/* Filters one scanline with Sub, Up, Average and Paeth in a single pass, into out[0] to out[3] (None is the row itself), and returns the filter to use for it:
+		the one whose output has the smallest sum of absolute values, taking each byte as signed (the heuristic the png specification recommends), None winning ties
+		Filtering has no dependency from one pixel to the next (it only reads the unfiltered row), so every pixel size is done a full register at a time
+		*/
+		PNG_Filter FilterAdaptive(uint8_t* const* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp);
+
+		/* Byte at a time reference versions */
+		void FilterScalar(const PNG_Filter filter, uint8_t* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp);
+		PNG_Filter FilterAdaptiveScalar(uint8_t* const* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp);
+
+		using FilterFunction = void (*)(const PNG_Filter filter, uint8_t* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp);
+		using AdaptiveFilterFunction = PNG_Filter(*)(uint8_t* const* out, const uint8_t* row, const uint8_t* prev, const size_t length, const unsigned int bpp);
+
+		FilterFunction GetFilter(const Generic::cpu::SIMDLevel level);
+		AdaptiveFilterFunction GetAdaptiveFilter(const Generic::cpu::SIMDLevel level);
+	}
+}
\ No newline at end of file
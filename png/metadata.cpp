@@ -0,0 +1,266 @@
+#include "metadata.h"
+
+using namespace Generic;
+using namespace std;
+
+namespace ImageLibrary {
+	namespace PNG {
+
+		static const uint64_t signature = 0x0A1A0A0D474E5089;
+
+		/* Inflates a whole zlib stream (compressed text & profiles), throwing once it goes over the limits */
+		vector<uint8_t> ChunkIndex::Inflate(const uint8_t* compressed, const size_t length) const {
+			static const unsigned int read_size = 16384;
+
+			uint64_t limit = limits.maxAncillaryChunk;
+			if (limits.maxInflateRatio != 0 && (limit == 0 || (uint64_t)length * limits.maxInflateRatio < limit)) {
+				limit = (uint64_t)length * limits.maxInflateRatio;
+			}
+
+			vector<uint8_t> result;
+			Data<span<const uint8_t>, uint8_t, Mode::Read> source(compressed, length);
+			zlib::ZLIBStream<span<const uint8_t>, Mode::Read> stream(&source);
+
+			unsigned int amount = 0;
+			do {
+				size_t size = result.size();
+				result.resize(size + read_size);
+				amount = stream.ReadAvailable(result.data() + size, read_size);
+				result.resize(size + amount);
+				if (limit != 0 && result.size() > limit) {
+					throw exception("Inflated data over limit");
+				}
+			} while (amount > 0);
+			return result;
+		}
+
+		/* Null-terminated string starting at position (which is moved past the terminator); false if there is no terminator */
+		static bool ReadString(span<const uint8_t> data, size_t& position, string& out) {
+			const uint8_t* end = (const uint8_t*)memchr(data.data() + position, 0, data.size() - position);
+			if (end == nullptr) {
+				return false;
+			}
+			out.assign((const char*)data.data() + position, end - (data.data() + position));
+			position = end - data.data() + 1;
+			return true;
+		}
+
+		ChunkIndex::ChunkIndex(span<const uint8_t> data, const DecodeLimits& limits) : data(data), limits(limits) {
+			Build();
+		}
+
+		ChunkIndex::ChunkIndex(const string& filePath, const DecodeLimits& limits) : mapped(make_unique<MappedFile>(filePath)), limits(limits) {
+			data = mapped->View();
+			Build();
+		}
+
+		void ChunkIndex::Build() {
+			uint64_t sig = 0;
+			if (data.size() >= 8) {
+				memcpy(&sig, data.data(), 8);
+			}
+			if (sig != signature) {
+				throw exception("Invalid Signature");
+			}
+
+			size_t position = 8;
+			while (position + 12 <= data.size()) {
+				ChunkEntry chunk;
+				chunk.offset = position;
+				chunk.length = ConvertEndian(data.data() + position);
+				memcpy(&chunk.type, data.data() + position + 4, 4); //chunk starts aren't aligned
+				if (chunk.length > 0x7FFFFFFF || chunk.length > data.size() - position - 12) {
+					return; //truncated
+				}
+				chunks.push_back(chunk);
+
+				position += (size_t)chunk.length + 12;
+				if (chunk.type == ChunkType::IEND) {
+					complete = true;
+					return;
+				}
+			}
+		}
+
+		CRCStatus ChunkIndex::CheckCRC(const size_t chunk) {
+			ChunkEntry& entry = chunks.at(chunk);
+			if (entry.crc == CRCStatus::Unchecked) {
+				const uint8_t* start = data.data() + entry.offset + 4; //crc covers the type & data
+				const bool valid = checksum::CRC32(start, (size_t)entry.length + 4, 0) == ConvertEndian(start + 4 + entry.length);
+				entry.crc = valid ? CRCStatus::Valid : CRCStatus::Invalid;
+			}
+			return entry.crc;
+		}
+
+		span<const uint8_t> ChunkIndex::ChunkData(ChunkEntry& chunk) {
+			if ((limits.maxAncillaryChunk != 0 && chunk.length > limits.maxAncillaryChunk) || CheckCRC(&chunk - chunks.data()) != CRCStatus::Valid) {
+				return {};
+			}
+			return data.subspan(chunk.offset + 8, chunk.length);
+		}
+
+		/* First chunk of the type (the metadata chunks other than text can only appear once) */
+		ChunkEntry* ChunkIndex::Find(const ChunkType type) {
+			for (ChunkEntry& chunk : chunks) {
+				if (chunk.type == type) {
+					return &chunk;
+				}
+			}
+			return nullptr;
+		}
+
+		vector<TextEntry> ChunkIndex::Text() {
+			vector<TextEntry> text;
+			for (ChunkEntry& chunk : chunks) {
+				if (chunk.type != ChunkType::tEXt && chunk.type != ChunkType::zTXt && chunk.type != ChunkType::iTXt) {
+					continue;
+				}
+				const span<const uint8_t> body = ChunkData(chunk);
+				TextEntry entry;
+				entry.type = chunk.type;
+				size_t position = 0;
+				if (body.empty() || !ReadString(body, position, entry.keyword)) {
+					continue;
+				}
+
+				try {
+					bool compressed = chunk.type == ChunkType::zTXt;
+					if (chunk.type == ChunkType::iTXt) {
+						if (position + 2 > body.size()) {
+							continue;
+						}
+						compressed = body[position] != 0;
+						position += 2; //compression flag & method
+						if (!ReadString(body, position, entry.language) || !ReadString(body, position, entry.translatedKeyword)) {
+							continue;
+						}
+					}
+					else if (compressed) {
+						if (position + 1 > body.size() || body[position] != 0) {
+							continue; //deflate is the only compression method
+						}
+						position++;
+					}
+
+					if (compressed) {
+						const vector<uint8_t> inflated = Inflate(body.data() + position, body.size() - position);
+						entry.text.assign((const char*)inflated.data(), inflated.size());
+					}
+					else {
+						entry.text.assign((const char*)body.data() + position, body.size() - position);
+					}
+				}
+				catch (std::exception e) {
+					continue; //corrupt compressed text
+				}
+				text.push_back(move(entry));
+			}
+			return text;
+		}
+
+		ICCProfile ChunkIndex::Profile() {
+			ICCProfile profile;
+			ChunkEntry* chunk = Find(ChunkType::iCCP);
+			if (chunk == nullptr) {
+				return profile;
+			}
+			const span<const uint8_t> body = ChunkData(*chunk);
+			size_t position = 0;
+			if (body.empty() || !ReadString(body, position, profile.name) || position + 1 > body.size() || body[position] != 0) {
+				return profile;
+			}
+
+			try {
+				profile.profile = Inflate(body.data() + position + 1, body.size() - position - 1);
+				profile.valid = true;
+			}
+			catch (std::exception e) {
+				profile.profile.clear();
+			}
+			return profile;
+		}
+
+		Gamma ChunkIndex::GammaValue() {
+			Gamma gamma;
+			ChunkEntry* chunk = Find(ChunkType::gAMA);
+			if (chunk != nullptr && chunk->length == 4) {
+				const span<const uint8_t> body = ChunkData(*chunk);
+				if (!body.empty()) {
+					gamma.gamma = ConvertEndian(body.data());
+					gamma.valid = gamma.gamma != 0;
+				}
+			}
+			return gamma;
+		}
+
+		Chromaticities ChunkIndex::Chroma() {
+			Chromaticities chroma;
+			ChunkEntry* chunk = Find(ChunkType::cHRM);
+			if (chunk != nullptr && chunk->length == 32) {
+				const span<const uint8_t> body = ChunkData(*chunk);
+				if (!body.empty()) {
+					unsigned int* values[8] = { &chroma.whiteX, &chroma.whiteY, &chroma.redX, &chroma.redY, &chroma.greenX, &chroma.greenY, &chroma.blueX, &chroma.blueY };
+					for (unsigned int i = 0; i < 8; i++) {
+						*values[i] = ConvertEndian(body.data() + i * 4);
+					}
+					chroma.valid = true;
+				}
+			}
+			return chroma;
+		}
+
+		SRGBIntent ChunkIndex::RenderingIntent() {
+			SRGBIntent intent;
+			ChunkEntry* chunk = Find(ChunkType::sRGB);
+			if (chunk != nullptr && chunk->length == 1) {
+				const span<const uint8_t> body = ChunkData(*chunk);
+				if (!body.empty() && body[0] <= 3) {
+					intent.intent = body[0];
+					intent.valid = true;
+				}
+			}
+			return intent;
+		}
+
+		PhysicalSize ChunkIndex::Physical() {
+			PhysicalSize physical;
+			ChunkEntry* chunk = Find(ChunkType::pHYs);
+			if (chunk != nullptr && chunk->length == 9) {
+				const span<const uint8_t> body = ChunkData(*chunk);
+				if (!body.empty() && body[8] <= 1) {
+					physical.x = ConvertEndian(body.data());
+					physical.y = ConvertEndian(body.data() + 4);
+					physical.unit = body[8];
+					physical.valid = true;
+				}
+			}
+			return physical;
+		}
+
+		Timestamp ChunkIndex::Time() {
+			Timestamp time;
+			ChunkEntry* chunk = Find(ChunkType::tIME);
+			if (chunk != nullptr && chunk->length == 7) {
+				const span<const uint8_t> body = ChunkData(*chunk);
+				if (!body.empty()) {
+					time.year = body[0] << 8 | body[1];
+					time.month = body[2];
+					time.day = body[3];
+					time.hour = body[4];
+					time.minute = body[5];
+					time.second = body[6];
+					time.valid = time.month >= 1 && time.month <= 12 && time.day >= 1 && time.day <= 31 && time.hour <= 23 && time.minute <= 59 && time.second <= 60;
+				}
+			}
+			return time;
+		}
+
+		span<const uint8_t> ChunkIndex::Exif() {
+			ChunkEntry* chunk = Find(ChunkType::eXIf);
+			if (chunk == nullptr) {
+				return {};
+			}
+			return ChunkData(*chunk);
+		}
+	}
+}
\ No newline at end of file
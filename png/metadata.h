@@ -0,0 +1,115 @@
+#pragma once
+
+#include "png.h"
+#include "../interface/mapped-file.h"
+#include <span>
+
+namespace ImageLibrary {
+	namespace PNG {
+		enum class CRCStatus : uint8_t {
+			Unchecked, //data not read yet (image data is never read)
+			Valid,
+			Invalid
+		};
+
+		struct ChunkEntry {
+			ChunkType type = ChunkType::NONE;
+			size_t offset = 0; //of the chunk's length field, from the start of the file
+			unsigned int length = 0; //of the chunk's data
+			CRCStatus crc = CRCStatus::Unchecked;
+		};
+
+		/* tEXt, zTXt or iTXt (compressed text is inflated); text is latin-1, except for iTXt where it is utf-8 */
+		struct TextEntry {
+			ChunkType type = ChunkType::NONE;
+			std::string keyword;
+			std::string text;
+			std::string language; //iTXt only
+			std::string translatedKeyword; //iTXt only (utf-8)
+		};
+
+		struct ICCProfile {
+			bool valid = false;
+			std::string name;
+			std::vector<uint8_t> profile; //inflated
+		};
+
+		/* Values are times 100000, as stored */
+		struct Gamma {
+			bool valid = false;
+			unsigned int gamma = 0;
+		};
+
+		struct Chromaticities {
+			bool valid = false;
+			unsigned int whiteX = 0;
+			unsigned int whiteY = 0;
+			unsigned int redX = 0;
+			unsigned int redY = 0;
+			unsigned int greenX = 0;
+			unsigned int greenY = 0;
+			unsigned int blueX = 0;
+			unsigned int blueY = 0;
+		};
+
+		struct SRGBIntent {
+			bool valid = false;
+			uint8_t intent = 0; //0 perceptual, 1 relative colorimetric, 2 saturation, 3 absolute colorimetric
+		};
+
+		struct PhysicalSize {
+			bool valid = false;
+			unsigned int x = 0; //pixels per unit
+			unsigned int y = 0;
+			uint8_t unit = 0; //0 unknown (aspect ratio only), 1 metre
+		};
+
+		struct Timestamp {
+			bool valid = false;
+			unsigned short year = 0;
+			uint8_t month = 0;
+			uint8_t day = 0;
+			uint8_t hour = 0;
+			uint8_t minute = 0;
+			uint8_t second = 0;
+		};
+
+		/* Index of every chunk in a png held in memory (or mapped, when given a path), for reading metadata without decoding the image
+		Only chunk headers are touched when indexing (chunk lengths are used to jump over the data, so image data in a mapped file is never even paged in)
+		Each metadata chunk is only read (and its CRC checked) when asked for; chunks with a bad CRC or invalid contents are left out,
+		as are chunks over DecodeLimits::maxAncillaryChunk and compressed text or profiles that inflate past it (or past maxInflateRatio)
+		*/
+		class ChunkIndex {
+		private:
+			std::unique_ptr<Generic::MappedFile> mapped;
+			std::span<const uint8_t> data;
+			DecodeLimits limits;
+			std::vector<ChunkEntry> chunks;
+			bool complete = false;
+		private:
+			void Build();
+			std::span<const uint8_t> ChunkData(ChunkEntry& chunk); //empty if the CRC doesn't match, or the chunk is over the limit
+			ChunkEntry* Find(const ChunkType type);
+			std::vector<uint8_t> Inflate(const uint8_t* compressed, const size_t length) const;
+		public:
+			/* data must stay valid while the index is used; throws if it doesn't start with a png signature */
+			ChunkIndex(std::span<const uint8_t> data, const DecodeLimits& limits = {});
+			ChunkIndex(const std::string& filePath, const DecodeLimits& limits = {});
+
+			const std::vector<ChunkEntry>& Chunks() const { return chunks; }
+			bool Complete() const { return complete; } //false if the file ends (or a chunk length runs past the end) before IEND
+
+			/* Checks the CRC of a chunk from Chunks() (eg. image data, which is otherwise left unchecked) */
+			CRCStatus CheckCRC(const size_t chunk);
+
+			std::vector<TextEntry> Text();
+			ICCProfile Profile();
+			Gamma GammaValue();
+			Chromaticities Chroma();
+			SRGBIntent RenderingIntent();
+			PhysicalSize Physical();
+			Timestamp Time();
+			std::span<const uint8_t> Exif(); //raw eXIf data (empty if there is none), pointing into the file
+		};
+	}
+}
\ No newline at end of file
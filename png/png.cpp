@@ -1,7 +1,5 @@
 #include "png.h"
 #include <bit>
-#include <xmmintrin.h>
-#include <immintrin.h>
 
 using namespace Generic;
 using namespace std;
@@ -10,6 +8,79 @@ namespace ImageLibrary {
 	/* For fatal errors, may want to use jmp to get out of the zlib code and back to the png stream that owns it (since if fatal, cannot continue processing) */
 	namespace PNG {
 
+		static const Adam7Pass adam7[7] = {
+			{ 0, 0, 8, 8, 8, 8 },
+			{ 0, 4, 8, 8, 8, 4 },
+			{ 4, 0, 8, 4, 4, 4 },
+			{ 0, 2, 4, 4, 4, 2 },
+			{ 2, 0, 4, 2, 2, 2 },
+			{ 0, 1, 2, 2, 2, 1 },
+			{ 1, 0, 2, 1, 1, 1 }
+		};
+
+		/* Everything but buffers goes back to how it is when constructed (buffers are only cleared, and are all resized before use) */
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::ResetState() {
+			/* Frames still decoding refer to frames, so have to finish first (the pool itself is kept for the next animation) */
+			for (future<vector<uint8_t>>& frame : decodedFrames) {
+				frame.wait();
+			}
+			decodedFrames.clear();
+
+			state = PNGStreamState();
+			deflate.Reset(this);
+			zlib_started = false;
+
+			out = nullptr;
+			opt = nullptr;
+			buffer = ImageBuffer();
+			current = ImageData();
+			currentImageInfo = ImageReturnInfo();
+			c16 = false;
+
+			narrow16 = false;
+			memset(significantBits, 0, sizeof(significantBits));
+			memset(narrowShifts, 0, sizeof(narrowShifts));
+			expandFrom = 0;
+			expandTo = 0;
+
+			palette.clear();
+			paletteSize = 0;
+			paletteAlpha = false;
+
+			seenChunks = ChunkFlag::NONE;
+			prevChunk = ChunkHeader();
+			currentChunk = ChunkHeader();
+			crc = 0;
+
+			_pointer = 0;
+			_max = 0;
+			_remaining_length = 0;
+			_last_read_count = 0;
+			chunkBytes = 0;
+			compressedBytes = 0;
+			inflatedBytes = 0;
+
+			interlaced = false;
+			interlacePass = 0;
+			iPreProcessed = false;
+			interlacedImage.clear();
+
+			firstIDAT = true;
+			actualbpp = 0;
+
+			animationFrames = 0;
+			animationPlays = 0;
+			animating = false;
+			defaultImageIsFrame = false;
+			nextSequence = 0;
+			frames.clear();
+			queuedFrames = 0;
+			nextFrame = 0;
+			canvas.clear();
+			returnedImage = nullptr;
+		}
+
 		template<typename Backing>
 		void PNGStream<Backing, Mode::Read>::BaseRead(uint8_t* out, const int length, const bool updateCRC) {
 			Data<Backing, uint8_t, Mode::Read>::Read(out, length);
@@ -18,23 +89,46 @@ namespace ImageLibrary {
 			}
 
 			if (updateCRC) {
-				//crc = currentChunk.CRC; //temp (until crc is actually calculated)
+				crc = Generic::checksum::CRC32(out, length, crc);
 			}
 		}
 		template<typename Backing>
 		void PNGStream<Backing, Mode::Read>::CheckCRC() {
 			BaseRead((uint8_t*)&currentChunk.CRC, 4, false);
-			crc = currentChunk.CRC; //temp
+			currentChunk.CRC = Generic::ConvertEndian((uint8_t*)&currentChunk.CRC);
 			if (currentChunk.CRC != crc) {  //if CRCs do not match, file may be corrupted
 				throw std::exception("CRC Mismatch");
 			}
 		}
 
+		/* Size of a buffer about to be allocated, once checked against ImageOptions::limits */
+		template<typename Backing>
+		size_t PNGStream<Backing, Mode::Read>::Allocation(const uint64_t bytes) const {
+			if (opt->limits.maxAllocation != 0 && bytes > opt->limits.maxAllocation) {
+				throw exception("Allocation over limit");
+			}
+			return (size_t)bytes;
+		}
+
 		template<typename Backing>
 		ImageReturnInfo PNGStream<Backing, Mode::Read>::ReadData(ImageData* out, const ImageOptions* const options) {
 			this->out = out;
 			opt = options;
+			buffer = ImageBuffer();
+			return ReadImage();
+		}
 
+		/* Rows are written straight into the buffer (so a row sink is not used); with receiveInterlaced, the buffer holds the full image between passes, so the same one must be given each call */
+		template<typename Backing>
+		ImageReturnInfo PNGStream<Backing, Mode::Read>::ReadData(ImageData* out, const ImageBuffer& buffer, const ImageOptions* const options) {
+			this->out = out;
+			opt = options;
+			this->buffer = buffer;
+			return ReadImage();
+		}
+
+		template<typename Backing>
+		ImageReturnInfo PNGStream<Backing, Mode::Read>::ReadImage() {
 			currentImageInfo.valid = true;
 			currentImageInfo.final = false;
 
@@ -43,6 +137,9 @@ namespace ImageLibrary {
 					while (state.next != NextAction::Finished) {
 						Loop();
 					}
+					if (animating) {
+						ComposeFrame();
+					}
 				}
 				catch (ReturnInterlacedPass i) { //return interlaced pass if this exception is passed
 					if (state.next != NextAction::Finished) {
@@ -73,7 +170,7 @@ namespace ImageLibrary {
 				}
 			}
 			if (state.next == NextAction::Finished) {
-				currentImageInfo.final = true;
+				currentImageInfo.final = !animating || nextFrame == frames.size();
 				currentImageInfo.valid = true;
 			}
 
@@ -83,7 +180,7 @@ namespace ImageLibrary {
 		template<typename Backing>
 		void PNGStream<Backing, Mode::Read>::Loop() {
 			if (currentChunk.type != ChunkType::NONE) {
-				chunkHistory[currentChunk.type] = currentChunk;
+				FlagCurrentChunk(seenChunks);
 				prevChunk = currentChunk;
 			}
 			uint64_t sig = 0;
@@ -114,8 +211,13 @@ namespace ImageLibrary {
 		template<typename Backing>
 		void PNGStream<Backing, Mode::Read>::ReadChunkHeaders() {
 			BaseRead((uint8_t*)&currentChunk.length, 4, false);
+			crc = 0;
 			BaseRead((uint8_t*)&currentChunk.type, 4, true); //crc computed over chunk type and data (not length)
 			currentChunk.length = Generic::ConvertEndian((uint8_t*)&currentChunk.length);
+			if (currentChunk.length > 0x7FFFFFFF) { throw exception("Invalid chunk length"); }
+
+			chunkBytes += (uint64_t)currentChunk.length + 12;
+			if (opt->limits.maxChunkBytes != 0 && chunkBytes > opt->limits.maxChunkBytes) { throw exception("Chunks over limit"); }
 			int breakpoint = 0;
 
 			//if length is fixed (ie. currentChunk.length shouldn't be used), then this should not happen
@@ -127,8 +229,8 @@ namespace ImageLibrary {
 
 		template<typename Backing>
 		void PNGStream<Backing, Mode::Read>::ProcessChunk() {
-			if (currentChunk.type != ChunkType::IHDR && !chunkHistory.contains(ChunkType::IHDR)) { throw std::exception("IHDR not first chunk!"); } //IHDR always first
-			if (chunkHistory.contains(ChunkType::IEND)) { throw std::exception("IEND should be last!"); } //IEND should always be last
+			if (currentChunk.type != ChunkType::IHDR && (seenChunks & ChunkFlag::IHDR) == ChunkFlag::NONE) { throw std::exception("IHDR not first chunk!"); } //IHDR always first
+			if ((seenChunks & ChunkFlag::IEND) != ChunkFlag::NONE) { throw std::exception("IEND should be last!"); } //IEND should always be last
 			if (!firstIDAT && currentChunk.type == ChunkType::IDAT && prevChunk.type != ChunkType::IDAT) { throw exception("IDAT chunks should be next to each other"); }
 
 			bool isCritical = !((unsigned int)currentChunk.type & 0x00000020); //if first letter uppercase, chunk is critical (5th bit)
@@ -143,7 +245,9 @@ namespace ImageLibrary {
 
 		template<typename Backing>
 		void PNGStream<Backing, Mode::Read>::ProcessCriticalChunk() {
-			if (chunkHistory.contains(currentChunk.type)) { throw std::exception("Duplicate chunk type"); }
+			ChunkFlag flag = ChunkFlag::NONE;
+			FlagCurrentChunk(flag);
+			if ((seenChunks & flag) != ChunkFlag::NONE) { throw std::exception("Duplicate chunk type"); }
 			
 			switch (currentChunk.type) {
 			case ChunkType::IHDR:
@@ -156,7 +260,10 @@ namespace ImageLibrary {
 				CheckCRC();
 				break;
 			case ChunkType::IDAT:
-				if (firstIDAT) {
+				if (firstIDAT && animating) {
+					ReadFrameIDAT();
+				}
+				else if (firstIDAT) {
 					BeginReadIDAT();
 				}
 				else {
@@ -177,6 +284,12 @@ namespace ImageLibrary {
 			BaseRead((uint8_t*)&current.dimensions.height, 4, true);
 			current.dimensions.width = Generic::ConvertEndian((uint8_t*)&current.dimensions.width);
 			current.dimensions.height = Generic::ConvertEndian((uint8_t*)&current.dimensions.height);
+			if (current.dimensions.width == 0 || current.dimensions.height == 0 || current.dimensions.width > 0x7FFFFFFF || current.dimensions.height > 0x7FFFFFFF) {
+				throw exception("Invalid image dimensions");
+			}
+			if (opt->limits.maxPixels != 0 && (uint64_t)current.dimensions.width * current.dimensions.height > opt->limits.maxPixels) {
+				throw exception("Image dimensions over limit");
+			}
 
 			uint8_t bpc = 0;
 			Color_Type color_t = (Color_Type)0;
@@ -251,6 +364,8 @@ namespace ImageLibrary {
 					};
 				}
 				break;
+			default:
+				throw std::exception("Invalid Format Settings");
 			}
 
 			uint8_t compression = 0;
@@ -266,6 +381,10 @@ namespace ImageLibrary {
 			if (interlacing > 1) { throw std::exception("Unsupported interlacing method found"); }
 			interlaced = interlacing; //should be interlaced for i file name scheme (something not right here)
 			currentImageInfo.isInterlaced = interlaced;
+
+			/* Scanline lengths are worked out in 32 bits */
+			const unsigned int readBpp = color_type == Color_Type::IndexedColor ? paletteBPC : actualbpp;
+			if ((uint64_t)current.dimensions.width * readBpp + 7 > 0xFFFFFFFF) { throw exception("Image too wide"); }
 		}
 
 		template<typename Backing>
@@ -282,15 +401,160 @@ namespace ImageLibrary {
 			if (color_type == Color_Type::Greyscale || color_type == Color_Type::GreyscaleAlpha) { FlagCurrentChunk(state.chunkErrors); return; } //flag non-fatal error and skip
 
 			unsigned int pSize = currentChunk.length / 3;
-			palette = vector<PaletteEntry>(pSize);
+			if (pSize == 0 || pSize > 256) { throw std::exception("Invalid palette size"); }
+			paletteSize = pSize;
+			palette.assign(256, PaletteEntry{ { 0, 0, 0, 0xFF } });
 
 			for (int i = 0; i < pSize; i++) {
 				BaseRead(palette[i].color, 3, true); //read the 3 bytes of data into palette (corresponding to rgb)
 			}
 		}
 
+		/* Only palette transparency is applied; greyscale & truecolor keys are skipped (like any unhandled ancillary chunk)
+		tRNS is not allowed for formats that already have alpha, and for indexed color it must come after PLTE with at most one entry per palette entry
+		*/
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::tRNSGetTransparency() {
+			if (color_type == Color_Type::GreyscaleAlpha || color_type == Color_Type::TruecolorAlpha ||
+				(color_type == Color_Type::IndexedColor && (palette.empty() || currentChunk.length > paletteSize))) {
+				FlagCurrentChunk(state.chunkErrors);
+			}
+			if (color_type != Color_Type::IndexedColor || palette.empty() || currentChunk.length > paletteSize) {
+				Data<Backing, uint8_t, Mode::Read>::Seek(currentChunk.length + 4);
+				return;
+			}
+
+			uint8_t alpha[256] = {};
+			BaseRead(alpha, currentChunk.length, true);
+			CheckCRC();
+
+			for (unsigned int i = 0; i < currentChunk.length; i++) {
+				palette[i].color[(uint8_t)Palette::Alpha] = alpha[i];
+			}
+			paletteAlpha = true;
+			current.format = {
+				.bitsPerPixel = 32,
+				.formatting = FormatDetails::RGBA8
+			};
+		}
+
+		/* One value per channel (rgb for indexed color), each between 1 and the sample depth; only used when narrowing 16-bit images */
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::sBITGetSignificantBits() {
+			unsigned int channels = 3;
+			unsigned int depth = c16 ? 16 : 8;
+			switch (color_type) {
+			case Color_Type::Greyscale:
+				channels = 1;
+				depth = actualbpp;
+				break;
+			case Color_Type::GreyscaleAlpha:
+				channels = 2;
+				break;
+			case Color_Type::TruecolorAlpha:
+				channels = 4;
+				break;
+			default:
+				break;
+			}
+			if (color_type == Color_Type::IndexedColor) { depth = 8; }
+
+			if (currentChunk.length != channels) {
+				FlagCurrentChunk(state.chunkErrors);
+				Data<Backing, uint8_t, Mode::Read>::Seek(currentChunk.length + 4);
+				return;
+			}
+
+			uint8_t bits[4] = {};
+			BaseRead(bits, channels, true);
+			CheckCRC();
+
+			for (unsigned int c = 0; c < channels; c++) {
+				if (bits[c] == 0 || bits[c] > depth) {
+					FlagCurrentChunk(state.chunkErrors);
+					return;
+				}
+			}
+			memcpy(significantBits, bits, sizeof(significantBits));
+		}
+
+		static unsigned int ChannelCount(const FormatDetails formatting) {
+			unsigned int channels = 0;
+			if ((formatting & FormatDetails::hasGray) != FormatDetails::Any) { channels++; }
+			if ((formatting & FormatDetails::hasRGB) != FormatDetails::Any) { channels += 3; }
+			if ((formatting & FormatDetails::hasAlpha) != FormatDetails::Any) { channels++; }
+			return channels;
+		}
+
+		/* Works out the narrowing & channel expansion that give ImageOptions::target (or ImageOptions::narrow16 without a target), and makes it the output format
+		Palettes are expanded straight to rgba by giving every entry alpha, everything else gets its channels added after the rest of the row conversion
+		*/
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::SetTargetFormat() {
+			const FormatDetails target = opt->target.formatting;
+			if (target == FormatDetails::Any) {
+				narrow16 = c16 && opt->narrow16;
+				return;
+			}
+
+			const FormatDetails targetDepth = (FormatDetails)((unsigned short)target & 0xFF);
+			const unsigned int from = ChannelCount(current.format.formatting);
+			const unsigned int to = ChannelCount(target);
+			const bool grey = (current.format.formatting & FormatDetails::hasGray) != FormatDetails::Any;
+			const bool targetGrey = (target & FormatDetails::hasGray) != FormatDetails::Any;
+			const bool alpha = (current.format.formatting & FormatDetails::hasAlpha) != FormatDetails::Any;
+			const bool targetAlpha = (target & FormatDetails::hasAlpha) != FormatDetails::Any;
+
+			/* Every channel of the image has to be in the target (grey can become rgb, but not the other way), and the depth can only stay or go from 16 to 8 bits */
+			if ((targetDepth != FormatDetails::has8 && targetDepth != FormatDetails::has16) || (targetGrey && to != 1 && to != 2) || (targetGrey && !grey) ||
+				(alpha && !targetAlpha) || to < from || (targetDepth == FormatDetails::has16 && !c16)) {
+				throw std::exception("Unsupported target format");
+			}
+
+			narrow16 = c16 && targetDepth == FormatDetails::has8;
+			if (color_type == Color_Type::IndexedColor) {
+				paletteAlpha = paletteAlpha || to == 4;
+			}
+			else if (to != from) {
+				expandFrom = from;
+				expandTo = to;
+			}
+
+			/* Narrowing halves bitsPerPixel after this */
+			current.format = {
+				.bitsPerPixel = (unsigned short)(to * (c16 ? 16 : 8)),
+				.formatting = (FormatDetails)(((unsigned short)target & ~0xFF) | (c16 ? (unsigned short)FormatDetails::has16 : (unsigned short)FormatDetails::has8))
+			};
+		}
+
+		/* Called once the chunks before the image data (which can change the output format) have all been read */
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::SetOutputFormat() {
+			if (color_type == Color_Type::IndexedColor && palette.empty()) { throw std::exception("No palette for indexed format"); }
+
+			SetTargetFormat();
+
+			/* Output format drops to 8 bits per channel when narrowing; with sBIT, tables map the significant bits of each channel to the rounded 8-bit value */
+			if (narrow16) {
+				current.format.bitsPerPixel /= 2;
+				current.format.formatting = (FormatDetails)(((unsigned short)current.format.formatting & ~(unsigned short)FormatDetails::has16) | (unsigned short)FormatDetails::has8);
+
+				if (significantBits[0] != 0) {
+					for (unsigned int c = 0; c < actualbpp / 16u; c++) {
+						unsigned int maximum = (1 << significantBits[c]) - 1;
+						narrowShifts[c] = 16 - significantBits[c];
+						narrowTables[c].resize(maximum + 1);
+						for (unsigned int value = 0; value <= maximum; value++) {
+							narrowTables[c][value] = (uint8_t)((value * 510 + maximum) / (maximum * 2));
+						}
+					}
+				}
+			}
+		}
+
 		template<typename Backing>
 		void PNGStream<Backing, Mode::Read>::BeginReadIDAT() {
+			SetOutputFormat();
 			_remaining_length = currentChunk.length;
 			UpdateCurrentBuffer();
 			state.next = NextAction::Read_From_Zlib;
@@ -321,12 +585,13 @@ namespace ImageLibrary {
 				}
 
 				unsigned int amount = _remaining_length;
-				if (_remaining_length > buffer_size)
-					amount = buffer_size;
+				if (amount > (unsigned int)(buffer_size - _max)) //several small chunks can go into one buffer
+					amount = buffer_size - _max;
 
 				if (_remaining_length != 0) {
 					BaseRead(_current + _max, amount, true);
 					_max += amount;
+					compressedBytes += amount;
 					_remaining_length -= amount;
 				}
 				else {
@@ -343,8 +608,8 @@ namespace ImageLibrary {
 			unsigned int currentLength = length;
 			while (currentLength > 0) {
 				unsigned int stop = _max;
-				if (stop - _pointer > length) {
-					stop = _pointer + length;
+				if (stop - _pointer > currentLength) {
+					stop = _pointer + currentLength;
 				}
 
 				unsigned int amountWritten = stop - _pointer;
@@ -387,480 +652,883 @@ namespace ImageLibrary {
 			return _last_read_count;
 		}
 
-		/* Largest format is 128bpp so accounting for overflow, need to use mm256i vector operations and then shorten back to mm128i 
-		If options set to receive interlaced images, will break early by throwing exception to return pass
-		If not interlaced, ignores the pass given in and will just loop for width & height given in out
-		*/
+		/* Pulls one whole filtered scanline (filter byte + row bytes) out of the sliding window, which may take several copies if the row is longer than what has been inflated so far */
 		template<typename Backing>
-		template<typename Pixel> void PNGStream<Backing, Generic::Read>::FilterPass() {
-			unsigned int width;
-			unsigned int height;
-
-			uint8_t actualReadBpp = actualbpp;
-			if (palette.size() > 0) {
-				actualReadBpp = paletteBPC;
+		bool PNGStream<Backing, Mode::Read>::ReadScanline(uint8_t* row, const unsigned int length) {
+			unsigned int filled = 0;
+			while (filled < length) {
+				unsigned int amount = deflate.ReadAvailable(row + filled, length - filled);
+				if (amount == 0) {
+					return false;
+				}
+				filled += amount;
 			}
 
-			if (!interlaced) {
-				out->image = vector<uint8_t>(out->dimensions.width * out->dimensions.height * ((actualbpp + 7) / 8));
+			inflatedBytes += length;
+			if (opt->limits.maxInflateRatio != 0 && inflatedBytes > compressedBytes * opt->limits.maxInflateRatio) {
+				throw exception("Image data over inflate ratio limit");
 			}
+			return true;
+		}
 
-			Pixel* target = (Pixel*)out->image.data();
-			uint24_t* rgbTarget = (uint24_t*)out->image.data();
+		/* Writes an unfiltered scanline to the output, stride bytes apart (so interlace passes can skip the columns filled by other passes)
+		Samples under 8 bits are widened by left bit replication, palette indices are expanded to rgb8 (rgba8 with tRNS), and 16-bit samples are swapped from network byte order
+		(or narrowed to 8 bits)
+		skip drops that many pixels from the start of the row (for regions starting part way into a byte of sub-byte pixels); columns does not include them
+		*/
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::ConvertRow(RowBuffers& buffers, const uint8_t* row, uint8_t* target, const unsigned int columns, const unsigned int stride, const unsigned int skip) const {
+			const unsigned int bytesPerPixel = current.format.bitsPerPixel / 8;
+
+			/* Rows of interlace passes are converted as a whole into a buffer, and then spread out */
+			if (stride != bytesPerPixel || skip != 0) {
+				ConvertRow(buffers, row, buffers.converted.data(), columns + skip, bytesPerPixel);
+				const uint8_t* pixel = buffers.converted.data() + (size_t)skip * bytesPerPixel;
+				if (stride == bytesPerPixel) {
+					memcpy(target, pixel, (size_t)columns * bytesPerPixel);
+					return;
+				}
+				for (unsigned int x = 0; x < columns; x++, target += stride, pixel += bytesPerPixel) {
+					memcpy(target, pixel, bytesPerPixel);
+				}
+				return;
+			}
 
-			/* If pixel is smaller than byte, make an array to hold the bit values (loop backwards since left = high-order bits) */
-			vector<uint8_t> pixelBits(0);
-			if (actualReadBpp != sizeof(Pixel) * 8) {
-				pixelBits = vector<uint8_t>(8 / actualReadBpp);
+			/* Converted into the image's own format (into a buffer, unless it needs no conversion), and then widened straight into the target */
+			if (expandFrom != expandTo) {
+				const uint8_t* native = row;
+				if (actualbpp < 8) {
+					UnpackSamples(buffers.unpacked.data(), row, columns, actualbpp, true);
+					native = buffers.unpacked.data();
+				}
+				else if (c16) {
+					const unsigned int samples = columns * expandFrom;
+					if (narrow16 && significantBits[0] != 0) {
+						const uint8_t* tables[4] = { narrowTables[0].data(), narrowTables[1].data(), narrowTables[2].data(), narrowTables[3].data() };
+						Narrow16To8Tables(buffers.expanded.data(), row, columns, expandFrom, tables, narrowShifts);
+					}
+					else if (narrow16) {
+						Narrow16To8(buffers.expanded.data(), row, samples);
+					}
+					else {
+						SwapBytes16(buffers.expanded.data(), row, (size_t)samples * 2);
+					}
+					native = buffers.expanded.data();
+				}
+				ExpandChannels(target, native, columns, expandFrom, expandTo, c16 && !narrow16 ? 2 : 1);
+				return;
 			}
 
-			uint8_t bitAnd = 0;
-			switch (actualReadBpp) {
-			case 1:
-				bitAnd = 1;
-				break;
-			case 2:
-				bitAnd = 3;
-				break;
-			case 4:
-				bitAnd = 15;
-				break;
-			default:
-				break;
+			if (color_type == Color_Type::IndexedColor) { //truecolor images may also carry a (suggested) palette, which is not applied
+				const uint8_t* indices = row;
+				if (paletteBPC < 8) {
+					UnpackSamples(buffers.unpacked.data(), row, columns, paletteBPC, false);
+					indices = buffers.unpacked.data();
+				}
+				ExpandPalette(target, indices, columns, (const uint8_t*)palette.data(), paletteAlpha);
+			}
+			else if (actualbpp < 8) {
+				UnpackSamples(target, row, columns, actualbpp, true);
 			}
+			else if (narrow16 && significantBits[0] != 0) {
+				const uint8_t* tables[4] = { narrowTables[0].data(), narrowTables[1].data(), narrowTables[2].data(), narrowTables[3].data() };
+				Narrow16To8Tables(target, row, columns, actualbpp / 16, tables, narrowShifts);
+			}
+			else if (narrow16) {
+				Narrow16To8(target, row, (size_t)columns * (actualbpp / 16));
+			}
+			else if (c16) {
+				SwapBytes16(target, row, (size_t)columns * bytesPerPixel);
+			}
+			else {
+				memcpy(target, row, (size_t)columns * bytesPerPixel);
+			}
+		}
 
-			/* Do loop runs once per interlace pass (or only once for non-interlaced) 
-			A lot of the stuff may be able to go outside this do loop
+		/* Each scanline is read whole, unfiltered in place against the previous scanline of the same pass, and then converted into the output
+		Interlace passes are written straight to their positions in the full image, so no pass keeps its own copy
+		If options set to receive interlaced images, will break early by throwing exception to return pass (gathered from the full image, which is kept between passes)
+		If not interlaced, ignores the pass given in and will just loop for width & height given in out
+		With a row sink, no image is stored in out (non-interlaced rows are converted into a single row buffer and given to the sink as they are read)
+		With a region, rows above it are only unfiltered (later rows depend on them), only its columns are converted, and reading stops after its last row
+		When downscaling, rows are added to the scaler as they are converted (interlaced images are assembled first), and only finished output rows are stored;
+		interlaced images scaled to the size of the first pass just return that pass, without reading the others
+		*/
+		template<typename Backing>
+		void PNGStream<Backing, Generic::Read>::FilterPass() {
+			uint8_t actualReadBpp = actualbpp;
+			if (color_type == Color_Type::IndexedColor) {
+				actualReadBpp = paletteBPC;
+			}
+			const unsigned int filterBpp = actualReadBpp < 8 ? 1 : actualReadBpp / 8; //filters work on bytes, so sub-byte pixels use the previous byte
+			const unsigned int bytesPerPixel = current.format.bitsPerPixel / 8;
+
+			rect region = { 0, 0, current.dimensions.width, current.dimensions.height };
+			if (opt->region.width != 0) {
+				region = opt->region;
+				if (region.height == 0 || region.x > current.dimensions.width || region.width > current.dimensions.width - region.x ||
+					region.y > current.dimensions.height || region.height > current.dimensions.height - region.y) {
+					throw exception("Region outside of image");
+				}
+			}
+			const bool fullImage = region.width == current.dimensions.width && region.height == current.dimensions.height;
+
+			size output = { region.width, region.height };
+			const bool scaling = opt->scaleTo.width != 0 && (opt->scaleTo.width != region.width || opt->scaleTo.height != region.height);
+			if (scaling) {
+				output = opt->scaleTo;
+				if (output.height == 0 || output.width > region.width || output.height > region.height) {
+					throw exception("Unsupported scale");
+				}
+			}
+			const bool firstPassOnly = scaling && interlaced && fullImage && output.width == passes[0].reduced.width && output.height == passes[0].reduced.height;
+			const bool streamRows = !interlaced || firstPassOnly; //rows are final as soon as they are read
+			const bool scaleRows = scaling && !firstPassOnly;
+			const bool sinkRows = opt->rowSink != nullptr && buffer.data == nullptr;
+			const bool returnPasses = interlaced && opt->receiveInterlaced && !sinkRows && fullImage && !scaling;
+			const size_t outputPitch = (size_t)output.width * bytesPerPixel;
+			out->dimensions = output;
+			Allocation(max((uint64_t)current.dimensions.width * bytesPerPixel, ((uint64_t)current.dimensions.width * actualReadBpp + 7) / 8 + 1)); //every row buffer is at most this long
+
+			/* Before anything is allocated, the scanlines that will be read are checked against what is left of the stream (when the backing knows),
+			as at most maxInflateRatio bytes can come out of each byte left (chunk headers & CRCs included, so this never stops a valid image)
 			*/
-			do {
+			if (interlacePass == 0 && opt->limits.maxInflateRatio != 0) {
+				const uint64_t remaining = Data<Backing, uint8_t, Mode::Read>::Remaining();
+				if (remaining != unknown_length) {
+					uint64_t needed = 0;
+					for (unsigned int pass = 0; pass < (interlaced && !firstPassOnly ? 7u : 1u); pass++) {
+						const unsigned int columns = interlaced ? passes[pass].reduced.width : current.dimensions.width;
+						unsigned int rows = interlaced ? passes[pass].reduced.height : current.dimensions.height;
+						if (streamRows || pass == 6) { //reading stops after the region's last row
+							const unsigned int rowStart = interlaced ? adam7[pass].rowStart : 0;
+							const unsigned int rowIncrement = interlaced ? adam7[pass].rowIncrement : 1;
+							const unsigned int bottom = region.y + region.height;
+							rows = min(rows, bottom > rowStart ? (bottom - rowStart + rowIncrement - 1) / rowIncrement : 0);
+						}
+						if (columns != 0) {
+							needed += (((uint64_t)columns * actualReadBpp + 7) / 8 + 1) * rows;
+						}
+					}
+					if (needed / opt->limits.maxInflateRatio > remaining + (_max - _pointer)) {
+						throw exception("Image data over inflate ratio limit");
+					}
+				}
+			}
 
-				width = out->dimensions.width;
-				height = out->dimensions.height;
-				int rwidth = width;
+			/* Finished rows go into the caller's buffer if given, otherwise to the sink or into out (for returned passes, out gets the full image once assembled) */
+			uint8_t* destination = nullptr;
+			size_t pitch = outputPitch;
+			bool growImage = false;
+			if (buffer.data != nullptr) {
+				if (buffer.pitch < outputPitch || buffer.size < buffer.pitch * (output.height - 1) + outputPitch) {
+					throw exception("Buffer too small for image");
+				}
+				destination = buffer.data;
+				pitch = buffer.pitch;
+				if (returnPasses && interlacePass == 0 && opt->progressive == Progressive::Sparkle) {
+					for (unsigned int y = 0; y < output.height; y++) {
+						memset(destination + y * pitch, 0, outputPitch); //pixels not yet received are shown as zero
+					}
+				}
+			}
+			else if (returnPasses) {
+				if (interlacePass == 0) {
+					interlacedImage.assign(Allocation((uint64_t)outputPitch * output.height), 0);
+				}
+				destination = interlacedImage.data();
+			}
+			else if (!sinkRows) {
+				/* Reuses the image the caller gave, if any; it grows to each row as the row is written (into memory reserved up front, so it never moves),
+				so an image that runs out of data part way never has the rest of it touched (each interlace pass works down from the top, and every row is in some pass)
+				*/
+				out->image.clear();
+				out->image.reserve(Allocation((uint64_t)outputPitch * output.height));
+				growImage = true;
+				destination = out->image.data();
+			}
+			const auto grow = [&](const unsigned int y) {
+				if (growImage && out->image.size() < (y + 1) * outputPitch) {
+					out->image.resize((y + 1) * outputPitch);
+				}
+			};
 
-				if (interlaced) {
-					width = passes[interlacePass].dimensions.width;
-					height = passes[interlacePass].dimensions.height;
+			const auto emit = [&](const unsigned int y, const uint8_t* row) {
+				grow(y);
+				if (destination != nullptr) {
+					memcpy(destination + y * pitch, row, outputPitch);
+				}
+				else {
+					opt->rowSink->Row(y, row, outputPitch);
+				}
+			};
+
+			/* Interlaced images are assembled at region size where the rows can't be written straight out (to a sink, or before scaling) */
+			uint8_t* target = destination;
+			size_t targetPitch = pitch;
+			if (!streamRows && (destination == nullptr || scaling)) {
+				if (interlacePass == 0) {
+					interlacedImage.assign(Allocation((uint64_t)region.width * region.height * bytesPerPixel), 0);
 				}
+				target = interlacedImage.data();
+				targetPitch = (size_t)region.width * bytesPerPixel;
+			}
+			if (scaleRows || (streamRows && destination == nullptr)) {
+				outputRow.resize((size_t)region.width * bytesPerPixel);
+			}
+			if (scaleRows && interlacePass == 0) {
+				const unsigned int sampleBytes = (current.format.formatting & FormatDetails::has16) != FormatDetails::Any ? 2 : 1;
+				scaler.Begin(region.width, region.height, output.width, output.height, bytesPerPixel / sampleBytes, sampleBytes);
+			}
 
-				if (width == 0) { /* Empty interlace pass */
-					passes[interlacePass] = passes[interlacePass - 1];
+			/* With ImageOptions::pipeline, another thread inflates every scanline (reading chunks & checking CRCs as it goes) into a ring, while this one unfilters and converts them
+			Only used when the whole image is decoded in this call, as returning a pass would leave the inflating thread part way through the stream
+			*/
+			const bool pipelined = opt->pipeline && !returnPasses;
+			unique_ptr<RowRing> ring;
+			thread inflater;
+			string inflateError;
+			if (pipelined) {
+				vector<unsigned int> lengths; //every scanline (filter byte included), in stream order
+				size_t longest = 0;
+				for (unsigned int pass = 0; pass < (firstPassOnly ? 1u : 7u); pass++) {
+					const unsigned int columns = interlaced ? passes[pass].reduced.width : current.dimensions.width;
+					const unsigned int rows = interlaced ? passes[pass].reduced.height : current.dimensions.height;
+					if (columns == 0 || rows == 0) {
+						continue;
+					}
+					lengths.insert(lengths.end(), rows, (columns * actualReadBpp + 7) / 8 + 1);
+					longest = max(longest, (size_t)lengths.back());
+					if (!interlaced) {
+						break;
+					}
+				}
 
-					/* Set output to this if receiving interlaced stuff, but don't explicitly return (only return right at end, or when new non-empty pass) */
-					if ((interlaced && opt->receiveInterlaced) || (interlaced && interlacePass == 6)) {
-						out->dimensions.width = passes[interlacePass].dimensions.width;
-						out->dimensions.height = passes[interlacePass].dimensions.height;
-						out->image = passes[interlacePass].image;
+				ring = make_unique<RowRing>(pipelineRows, longest);
+				inflater = thread([this, &ring, &inflateError, lengths = move(lengths)]() {
+					try {
+						for (const unsigned int length : lengths) {
+							uint8_t* slot = ring->Acquire();
+							if (slot == nullptr || !ReadScanline(slot, length)) {
+								break; //cancelled, or out of image data (which the unfiltering side reports when it runs out of rows)
+							}
+							ring->Publish();
+						}
 					}
-					if (interlaced && interlacePass == 6) {
-						currentImageInfo.final = true;
-						state.next = NextAction::Finished;
-						interlacePass++;
-						throw ReturnInterlacedPass();
+					catch (std::exception e) {
+						inflateError = e.what();
 					}
+					ring->Close();
+				});
+			}
 
-					continue;
+			/* However FilterPass exits (finished, stopped early, returning or throwing), the inflating thread is stopped before the ring goes away */
+			struct StopInflater {
+				unique_ptr<RowRing>& ring;
+				thread& inflater;
+				~StopInflater() {
+					if (inflater.joinable()) {
+						ring->Cancel();
+						inflater.join();
+					}
 				}
+			} stopInflater{ ring, inflater };
 
+			/* Do loop runs once per interlace pass (or only once for non-interlaced) */
+			do {
 				unsigned int rowIncrement = 1;
 				unsigned int colIncrement = 1;
+				unsigned int rowStart = 0;
+				unsigned int colStart = 0;
+				unsigned int columns = current.dimensions.width; /* pixels stored in each scanline of this pass */
+				unsigned int rows = current.dimensions.height;
 
-				unsigned int totalPixels = width * height;
-				unsigned int currentPixelI = 1; /* 1-indexed here */
-				unsigned int currentRow = 0;
-				unsigned int currentPixelStart = 1;
 				if (interlaced) {
-					width = passes[interlacePass].dimensions.width;
-					height = passes[interlacePass].dimensions.height;
-					rwidth = passes[interlacePass].reduced.width;
-					totalPixels = passes[interlacePass].reduced.width * passes[interlacePass].reduced.height;
-					target = (Pixel*)passes[interlacePass].image.data();
-					rgbTarget = (uint24_t*)passes[interlacePass].image.data();
-
-					/* Put pixels from previous pass into correct place in this image's pass & prepare new pass indexing */
-					if (interlacePass > 0) {
-						Pixel* prevPass = (Pixel*)passes[interlacePass - 1].image.data();
-						uint24_t* prevRgbPass = (uint24_t*)passes[interlacePass - 1].image.data();
-
-						if (interlacePass == 1 || interlacePass == 3 || interlacePass == 5) {
-							/* These passes insert columns */
-							colIncrement = 2;
-							currentPixelI = 2; //new data on odd col
-							currentPixelStart = 2;
-
-							unsigned int prevIndex = 0;
-							for (unsigned int cRow = 0; cRow < height; cRow++) {
-								for (unsigned int cCol = 0; cCol < width; cCol+= 2) { /* original data on even col */		
-									if (palette.size() == 0) {
-										target[(cRow * width) + cCol] = prevPass[prevIndex++];
-									}
-									else {
-										rgbTarget[(cRow * width) + cCol] = prevRgbPass[prevIndex++];
-									}
-								}
+					rowIncrement = adam7[interlacePass].rowIncrement;
+					colIncrement = adam7[interlacePass].colIncrement;
+					rowStart = adam7[interlacePass].rowStart;
+					colStart = adam7[interlacePass].colStart;
+					columns = passes[interlacePass].reduced.width;
+					rows = passes[interlacePass].reduced.height;
+				}
+
+				/* Empty interlace passes have no scanlines at all */
+				if (columns != 0 && rows != 0) {
+					/* Scanline buffers are sized for the widest pass; previousScanline starts zeroed since the first row of a pass filters against nothing */
+					const unsigned int rowBytes = (columns * actualReadBpp + 7) / 8;
+					if (scanline.size() < rowBytes + 1) {
+						scanline.resize(rowBytes + 1);
+						previousScanline.resize(rowBytes + 1);
+					}
+					rowBuffers.Reserve(columns, bytesPerPixel);
+					memset(previousScanline.data(), 0, rowBytes + 1);
+
+					/* Pixels of this pass inside the region: scanline columns first to last - 1, starting skip pixels into the byte at offset */
+					const unsigned int first = region.x > colStart ? min(columns, (region.x - colStart + colIncrement - 1) / colIncrement) : 0;
+					const unsigned int last = region.x + region.width > colStart ? min(columns, (region.x + region.width - colStart + colIncrement - 1) / colIncrement) : 0;
+					const size_t offset = (size_t)first * actualReadBpp / 8;
+					const unsigned int skip = actualReadBpp < 8 ? (first * actualReadBpp % 8) / actualReadBpp : 0;
+					const bool lastPass = streamRows || interlacePass == 6;
+
+					uint8_t* previousSlot = nullptr; //previous scanline of this pass, when pipelined (still held in the ring)
+					for (unsigned int row = 0; row < rows; row++) {
+						const unsigned int y = rowStart + row * rowIncrement;
+						if (y >= region.y + region.height && lastPass) {
+							break; //nothing after this is needed
+						}
+
+						uint8_t* line = scanline.data();
+						const uint8_t* previous = previousScanline.data();
+						if (pipelined) {
+							line = ring->Next();
+							if (line == nullptr) {
+								throw exception(inflateError.empty() ? "Not enough image data!" : inflateError.c_str());
+							}
+							if (previousSlot != nullptr) {
+								previous = previousSlot;
 							}
+						}
+						else if (!ReadScanline(line, rowBytes + 1)) {
+							throw exception("Not enough image data!");
+						}
 
+						/* Rows below the region are still read, as later passes come after them */
+						if (y < region.y + region.height) {
+							/* Filter_None needs no work, the row is copied straight out of the scanline buffer */
+							PNG_Filter filter = (PNG_Filter)line[0];
+							if (filter != PNG_Filter::Filter_None) {
+								Unfilter(filter, line + 1, previous + 1, rowBytes, filterBpp);
+							}
 						}
-						else {
-							/* These passes insert rows */
-							rowIncrement = 2;
-							currentRow = 1; //new data on odd rows
-
-							unsigned int prevIndex = 0;
-							for (unsigned int cRow = 0; cRow < height; cRow+= 2) { /* original data on even row */
-								for (unsigned int cCol = 0; cCol < width; cCol ++) {
-									if (palette.size() == 0) {
-										target[(cRow * width) + cCol] = prevPass[prevIndex++];
-									}
-									else {
-										rgbTarget[(cRow * width) + cCol] = prevRgbPass[prevIndex++];
-									}
+
+						if (y >= region.y && y < region.y + region.height && last > first) {
+							const uint8_t* source = line + 1 + offset;
+							const unsigned int outputY = firstPassOnly ? row : y - region.y;
+							if (streamRows && scaleRows) {
+								unsigned int scaledY = 0;
+								ConvertRow(rowBuffers, source, outputRow.data(), last - first, bytesPerPixel, skip);
+								if (const uint8_t* scaled = scaler.AddRow(outputRow.data(), scaledY)) {
+									emit(scaledY, scaled);
+								}
+							}
+							else if (streamRows && destination == nullptr) {
+								ConvertRow(rowBuffers, source, outputRow.data(), last - first, bytesPerPixel, skip);
+								emit(outputY, outputRow.data());
+							}
+							else if (streamRows) {
+								grow(outputY);
+								ConvertRow(rowBuffers, source, destination + outputY * pitch, last - first, bytesPerPixel, skip);
+							}
+							else {
+								if (target == destination) {
+									grow(y - region.y);
+								}
+								uint8_t* rowTarget = target + (size_t)(y - region.y) * targetPitch + (size_t)(colStart + first * colIncrement - region.x) * bytesPerPixel;
+								ConvertRow(rowBuffers, source, rowTarget, last - first, colIncrement * bytesPerPixel, skip);
+								if (returnPasses && opt->progressive == Progressive::Rectangle) {
+									FillRectangles(target, targetPitch, y, columns);
 								}
 							}
 						}
+
+						if (pipelined) {
+							if (previousSlot != nullptr) {
+								ring->Release();
+							}
+							previousSlot = line;
+						}
+						else {
+							swap(scanline, previousScanline);
+						}
+					}
+					if (previousSlot != nullptr) {
+						ring->Release(); //the next pass starts from a zero row
 					}
 				}
 
+				if (firstPassOnly) {
+					currentImageInfo.final = true;
+					state.next = NextAction::Finished;
+					interlacePass = 7;
+					throw ReturnInterlacedPass();
+				}
 
-				std::vector<uint8_t> prevRow(sizeof(__m128i) * (rwidth + 1)); /* +1, since will index (currentPixelI - 1) for upper left */
-				Pixel* prevRowPixels = (Pixel*)prevRow.data();
-				__m128i* prevRowView = (__m128i*)prevRow.data();
-
-				std::vector<uint8_t> prev(sizeof(__m128i));
-				Pixel* prevPixel = (Pixel*)prev.data();
-				__m128i* prevPixelView = (__m128i*)prev.data();
-
-				std::vector<uint8_t> current(sizeof(__m128i));
-				Pixel* currentPixel = (Pixel*)current.data();
-				__m128i* currentPixelView = (__m128i*)current.data();
-
-				std::vector<uint8_t> result(sizeof(__m256i));
-				__m256i* fullResultView = (__m256i*)result.data();
-				__m128i* narrowResultView = (__m128i*)result.data();
-
-				/*for narrowing to m128i from m256i*/
-				__m256i shuffle = _mm256_setr_epi8(
-					0, 2, 4, 6, 8, 10, 12, 14,
-					-1, -1, -1, -1, -1, -1, -1, -1,
-					16, 18, 20, 22, 24, 26, 28, 30,
-					-1, -1, -1, -1, -1, -1, -1, -1);
-
-				unsigned int readAmount = sizeof(uint8_t); /* Set to read filter byte */
-				bool newColumn = true;
-				while (deflate.TryRead(current.data(), readAmount)) {				
-					readAmount = sizeof(Pixel);
-
-					int loop = pixelBits.size() - 1;
-					do {
-						totalPixels--;
-
-						if (newColumn) {
-							newColumn = false;
-							currentFilter = (PNG_Filter)current[0];
-							if (!deflate.TryRead(current.data(), readAmount)) {
-								throw exception("No data for new scanline");
+				/* Return the pixels received so far if receiveInterlaced (only for passes with data, and always for the last one); otherwise only return after the last pass */
+				if (interlaced && (interlacePass == 6 || (returnPasses && columns != 0 && rows != 0))) {
+					if (returnPasses) {
+						const ImagePass& pass = passes[interlacePass];
+						const Adam7Pass& a = adam7[interlacePass];
+						out->dimensions = opt->progressive != Progressive::Off ? current.dimensions : pass.dimensions; //the last pass is full size either way
+						if (opt->progressive == Progressive::Off && interlacePass != 6) {
+							out->image.resize((size_t)pass.dimensions.width * pass.dimensions.height * bytesPerPixel);
+							uint8_t* gathered = out->image.data();
+							for (unsigned int y = 0; y < pass.dimensions.height; y++) {
+								const uint8_t* source = target + (size_t)y * a.rowStep * targetPitch;
+								for (unsigned int x = 0; x < pass.dimensions.width; x++, gathered += bytesPerPixel) {
+									memcpy(gathered, source + (size_t)x * a.colStep * bytesPerPixel, bytesPerPixel);
+								}
 							}
 						}
-
-						/* If actualbpp < 8, then will loop to use up bits in current.data accordingly (make a copy first and then re-set current.data with padded byte of bits value?)
-						If then results in new scanline, ignore the rest of the bits in current byte
-						The left-most pixel is in the high-order bits
-						*/
-						if (actualReadBpp != readAmount * 8) {
-							/* Put data into pixelBits vector in correct order (low-order bits first, since looping pixelBits from back to front) */
-							if (loop == pixelBits.size() - 1) {
-								uint8_t index = 0;
-								for (int i = 0; i < 8; i += actualReadBpp) {
-									pixelBits[index] = (current[0] & (bitAnd << i)) >> i;
-
-									/* Scale up by using left bit replication
-									Begin by left shifting, then repeating most significant bits into the open bits
-									*/
-									if (palette.size() == 0) { /*shouldn't replicate for palette indices (not sure if this should be skipped for other things too or not)*/
-										pixelBits[index] = pixelBits[index] << (8 - actualReadBpp);
-										for (int j = 0; j < 8 / actualReadBpp; j++) {
-											pixelBits[index] |= pixelBits[index] >> actualReadBpp;
-										}
-									}
-									index++;
+						else if (buffer.data != nullptr) {
+							out->image.clear(); //full size images are already in the buffer
+						}
+						else if (interlacePass == 6) {
+							out->image = move(interlacedImage);
+						}
+						else if (opt->reuseImage && interlacePass > 0 && out->image.data() == returnedImage && out->image.size() == interlacedImage.size()) {
+							/* The image returned for the last pass is promised to be as it was, so only this pass's pixels (& the blocks they fill) are copied into it */
+							for (unsigned int row = 0; row < rows; row++) {
+								const unsigned int y = a.rowStart + row * a.rowIncrement;
+								for (unsigned int x = 0; x < columns; x++) {
+									const size_t offset = (size_t)y * targetPitch + (size_t)(a.colStart + x * a.colIncrement) * bytesPerPixel;
+									memcpy(out->image.data() + offset, target + offset, bytesPerPixel);
+								}
+								if (opt->progressive == Progressive::Rectangle) {
+									FillRectangles(out->image.data(), targetPitch, y, columns);
 								}
 							}
-
-							current[0] = pixelBits[loop--];
 						}
-						else if (c16) { //reverse bit order for endianness (for 16-bit channel samples since 16-bit samples are stored in network byte order (MSB first)
-							uint8_t temp[sizeof(Pixel)];
+						else {
+							out->image = interlacedImage;
+						}
+						returnedImage = out->image.data();
+					}
 
-							for (int i = 0; i < sizeof(Pixel); i+=2) {
-								temp[i] = current[i + 1];
-								temp[i + 1] = current[i];
+					/* Assembled images are given out now (scaled first if needed) */
+					if (interlacePass == 6 && target != destination) {
+						for (unsigned int y = 0; y < region.height; y++) {
+							const uint8_t* row = interlacedImage.data() + y * targetPitch;
+							if (scaleRows) {
+								unsigned int scaledY = 0;
+								if (const uint8_t* scaled = scaler.AddRow(row, scaledY)) {
+									emit(scaledY, scaled);
+								}
 							}
-							for (int i = 0; i < sizeof(Pixel); i++) { //copy temp to current
-								current[i] = temp[i];
+							else {
+								emit(y, row);
 							}
 						}
+						interlacedImage.clear();
+					}
 
-						
-						switch (currentFilter) {
-						case PNG_Filter::Filter_None:
-							break;
-						case PNG_Filter::Filter_Sub:
-							*currentPixelView = _mm_add_epi8(*currentPixelView, *prevPixelView);
-							break;
-						case PNG_Filter::Filter_Up:
-							*currentPixelView = _mm_add_epi8(*currentPixelView, *(prevRowView + 1)); //prevRowView points to upper left
-							break;
-						case PNG_Filter::Filter_Average: {
-							/* Widen first (not allowing overflow until the final addition) */
-							__m256i a = _mm256_cvtepu8_epi16(*prevPixelView);
-							__m256i b = _mm256_cvtepu8_epi16(*(prevRowView + 1));
-							__m256i pix = _mm256_cvtepu8_epi16(*currentPixelView);
-
-							__m256i avg = _mm256_avg_epu16(a, b);
-							*fullResultView = _mm256_add_epi8(pix, avg); //allow overflow here
-
-							*fullResultView = _mm256_shuffle_epi8(*fullResultView, shuffle);
-							*fullResultView = _mm256_permute4x64_epi64(*fullResultView, 8);
-
-							*currentPixelView = *narrowResultView;
-							break;
-						}
-						case PNG_Filter::Filter_Paeth: {
-							/* Widen first (not allowing overflow until the final addition) */
-							__m256i a = _mm256_cvtepu8_epi16(*prevPixelView);
-							__m256i b = _mm256_cvtepu8_epi16(*(prevRowView + 1));
-							__m256i c = _mm256_cvtepu8_epi16(*prevRowView);
+					if (interlacePass == 6) {
+						currentImageInfo.final = true;
+						state.next = NextAction::Finished;
+					}
+					interlacePass++;
+					throw ReturnInterlacedPass();
+				}
+				interlacePass++;
+
+			} while (interlacePass < 7 && interlaced);
+		}
 
-							__m256i pix = _mm256_cvtepu8_epi16(*currentPixelView);
+		/* Progressive::Rectangle: copies each pixel of a row just written by the current pass over the rowStep x colStep block it stands for
+		(clipped to the image), which only holds pixels that later passes have not delivered yet
+		*/
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::FillRectangles(uint8_t* image, const size_t pitch, const unsigned int y, const unsigned int columns) {
+			const Adam7Pass& a = adam7[interlacePass];
+			const unsigned int width = current.dimensions.width;
+			const unsigned int bytesPerPixel = current.format.bitsPerPixel / 8;
+			const size_t rowLength = (size_t)width * bytesPerPixel;
+			uint8_t* row = image + (size_t)y * pitch;
+
+			/* Across first: the row then holds whole blocks (and is contiguous from colStart if the blocks touch) */
+			for (unsigned int x = 0; x < columns; x++) {
+				const unsigned int col = a.colStart + x * a.colIncrement;
+				const uint8_t* pixel = row + (size_t)col * bytesPerPixel;
+				for (unsigned int c = col + 1; c < col + a.colStep && c < width; c++) {
+					memcpy(row + (size_t)c * bytesPerPixel, pixel, bytesPerPixel);
+				}
+			}
 
-							__m256i pa = _mm256_sub_epi16(b, c);
-							__m256i pb = _mm256_sub_epi16(a, c);
-							__m256i pc = _mm256_sub_epi16(pa, pb);
+			/* Then down */
+			for (unsigned int r = y + 1; r < y + a.rowStep && r < current.dimensions.height; r++) {
+				uint8_t* below = image + (size_t)r * pitch;
+				if (a.colStep == a.colIncrement) {
+					memcpy(below + (size_t)a.colStart * bytesPerPixel, row + (size_t)a.colStart * bytesPerPixel, rowLength - (size_t)a.colStart * bytesPerPixel);
+				}
+				else {
+					for (unsigned int x = 0; x < columns; x++) {
+						const size_t offset = (size_t)(a.colStart + x * a.colIncrement) * bytesPerPixel;
+						memcpy(below + offset, row + offset, (size_t)min((unsigned int)a.colStep, width - (a.colStart + x * a.colIncrement)) * bytesPerPixel);
+					}
+				}
+			}
+		}
 
-							pa = _mm256_abs_epi16(pa);
-							pb = _mm256_abs_epi16(pb);
-							pc = _mm256_abs_epi16(pc);
+		/* This should only be called once, after the first IDAT chunk header has been parsed */
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::GetUnfilteredData() {
+			state.next = NextAction::Read_Chunks;
+			out->dimensions = current.dimensions; /* Copy image details from current (the image itself is always written by FilterPass) */
+			out->format = current.format;
 
-							__m256i not_pa_le_pb = _mm256_cmpgt_epi16(pa, pb); //!(pa <= pb)
-							__m256i not_pa_le_pc = _mm256_cmpgt_epi16(pa, pc); //!(pa <= pc)
-							__m256i not_pb_le_pc = _mm256_cmpgt_epi16(pb, pc); //!(pb <= pc)
+			unsigned int width = current.dimensions.width;
+			unsigned int height = current.dimensions.height;
+			if (interlaced && !iPreProcessed) {
+				/* Pixels in each pass (0 wide or high for passes that start beyond the image), and in the grid received once it is done */
+				iPreProcessed = true;
 
-							__m256i not_take_a = _mm256_or_si256(not_pa_le_pb, not_pa_le_pc); //if pa > pb or pa > pc, don't take a (remember the signs are switched from <= to >)
-							__m256i t = _mm256_blendv_epi8(b, c, not_pb_le_pc); //take b or c depending on whether or not !(pb <= pc) -- the second if statement
+				for (int pass = 0; pass < 7; pass++) {
+					const Adam7Pass& a = adam7[pass];
+					passes[pass].reduced.width = width > a.colStart ? (width - a.colStart + a.colIncrement - 1) / a.colIncrement : 0;
+					passes[pass].reduced.height = height > a.rowStart ? (height - a.rowStart + a.rowIncrement - 1) / a.rowIncrement : 0;
+					passes[pass].dimensions.width = (width + a.colStep - 1) / a.colStep;
+					passes[pass].dimensions.height = (height + a.rowStep - 1) / a.rowStep;
+				}
+			}
 
-							__m256i chosen = _mm256_blendv_epi8(a, t, not_take_a); //final comparison here (if not_take_a then it will take either b or c)
-							*fullResultView = _mm256_add_epi8(pix, chosen); //allow overflow here
+			FilterPass();
 
-							*fullResultView = _mm256_shuffle_epi8(*fullResultView, shuffle); //cannot use shuffle for the entire conversion, since they repeat across 32-bit boundaries
-							*fullResultView = _mm256_permute4x64_epi64(*fullResultView, 8);
+			state.next = NextAction::Finished;
+		}
 
-							*currentPixelView = *narrowResultView;
-							break;
-						}
-						default:
-							throw exception("Invalid filter type found!");
-						}
 
-						/* Write pixel to output */
-						if (palette.size() == 0) {
-							target[(currentRow * width) + (currentPixelI - 1)] = *currentPixel;
-						}
-						else { /*is palette index (resulting color will always be rgb8)*/
-							if (current[0] >= palette.size())
-								throw exception("Invalid palette index!");
-							rgbTarget[(currentRow * width) + (currentPixelI - 1)] = palette[current[0]].colors;
-						}
-						
 
-						/* Set prevRow (upper left), prevPixel */
-						*prevRowView = *prevPixelView;
-						prevRowView++; //not using rowIncrement because filtering works based off of prev scanline in same pass (ie. not complete image)
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::ProcessAncillaryChunk() {
+			if (opt->limits.maxAncillaryChunk != 0 && currentChunk.length > opt->limits.maxAncillaryChunk && currentChunk.type != ChunkType::fdAT) {
+				Data<Backing, uint8_t, Mode::Read>::Seek(currentChunk.length + 4); //skipped like an unknown chunk
+				return;
+			}
 
-						*prevPixelView = *currentPixelView;
+			switch (currentChunk.type) {
+			case ChunkType::tRNS:
+				tRNSGetTransparency();
+				break;
+			case ChunkType::sBIT:
+				sBITGetSignificantBits();
+				break;
+			case ChunkType::acTL:
+				acTLGetAnimation();
+				break;
+			case ChunkType::fcTL:
+				fcTLGetFrameControl();
+				break;
+			case ChunkType::fdAT:
+				fdATGetFrameData();
+				break;
+			default:
+				Data<Backing, uint8_t, Mode::Read>::Seek(currentChunk.length + 4); //to make processing chunks faster, skip unknown ones and don't check the CRC either
+			}
+		}
 
-						currentPixelI += colIncrement;
 
-						if (currentPixelI > width) {
-							currentPixelI = currentPixelStart;
-							currentRow += rowIncrement;
-							newColumn = true;
-							readAmount = sizeof(uint8_t); /* Set to read filter byte next iteration */
-							*prevRowView = *prevPixelView;
-							prevRowView = (__m128i*)prevRow.data();
 
-							memset(prev.data(), 0, sizeof(__m128i));
-							memset(pixelBits.data(), 0, pixelBits.size());
-							loop = -1; //break out of loop (ignore low-order bits)
-							memset(current.data(), 0, sizeof(__m128i)); //current[0] = 0;
+		/* Must come before the image data; without receiveAnimation, only the default image is decoded (frame chunks are skipped) */
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::acTLGetAnimation() {
+			if (currentChunk.length != 8 || !firstIDAT || animationFrames != 0) {
+				FlagCurrentChunk(state.chunkErrors);
+				Data<Backing, uint8_t, Mode::Read>::Seek(currentChunk.length + 4);
+				return;
+			}
 
+			uint8_t control[8] = {};
+			BaseRead(control, 8, true);
+			CheckCRC();
 
-							/* Then, set the ImageData image to the current pass (if receiveInterlaced; otherwise, only do this for the last pass (pass 7)) */
-							if (totalPixels == 0 && ((interlaced && opt->receiveInterlaced) || (interlaced && interlacePass == 6))) {
-								out->dimensions.width = passes[interlacePass].dimensions.width;
-								out->dimensions.height = passes[interlacePass].dimensions.height;
-								out->image = passes[interlacePass].image;
+			animationFrames = Generic::ConvertEndian(control);
+			animationPlays = Generic::ConvertEndian(control + 4);
+			if (animationFrames == 0) {
+				FlagCurrentChunk(state.chunkErrors);
+				return;
+			}
+			animating = opt->receiveAnimation;
+		}
 
-								if (interlacePass == 6) {
-									currentImageInfo.final = true;
-									state.next = NextAction::Finished;
-								}
-								interlacePass++;
-								throw ReturnInterlacedPass();
-							}
-						}
-					} while (loop >= 0);
-				}
+		/* Starts a new frame; one before the image data makes the image data the first frame (which then has to cover the whole image) */
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::fcTLGetFrameControl() {
+			if (!animating) {
+				Data<Backing, uint8_t, Mode::Read>::Seek(currentChunk.length + 4);
+				return;
+			}
+			if (currentChunk.length != 26) { throw exception("Invalid frame control"); }
+
+			uint8_t control[26] = {};
+			BaseRead(control, 26, true);
+			CheckCRC();
+			if (Generic::ConvertEndian(control) != nextSequence++) { throw exception("Animation chunks out of sequence"); }
+
+			Frame frame;
+			frame.control.area = {
+				.x = Generic::ConvertEndian(control + 12),
+				.y = Generic::ConvertEndian(control + 16),
+				.width = Generic::ConvertEndian(control + 4),
+				.height = Generic::ConvertEndian(control + 8)
+			};
+			frame.control.delayNumerator = control[20] << 8 | control[21];
+			frame.control.delayDenominator = control[22] << 8 | control[23];
+			frame.control.dispose = (DisposeOp)control[24];
+			frame.control.blend = (BlendOp)control[25];
+
+			const rect& area = frame.control.area;
+			if (area.width == 0 || area.height == 0 || area.x > current.dimensions.width || area.width > current.dimensions.width - area.x ||
+				area.y > current.dimensions.height || area.height > current.dimensions.height - area.y || control[24] > 2 || control[25] > 1) {
+				throw exception("Invalid frame control");
+			}
+			if (frames.size() == animationFrames) { throw exception("More frames than given in acTL"); }
 
-				if (totalPixels != 0) {
-					throw exception("Not enough image data!");
+			if (firstIDAT) {
+				if (!frames.empty() || area.x != 0 || area.y != 0 || area.width != current.dimensions.width || area.height != current.dimensions.height) {
+					throw exception("Invalid frame control for the default image");
 				}
+				defaultImageIsFrame = true;
+			}
+			else if (!frames.empty() && frames.back().compressed.empty()) {
+				throw exception("Frame without frame data");
+			}
+			frames.push_back(move(frame));
+		}
 
-			} while (interlacePass < 7 && interlaced);
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::fdATGetFrameData() {
+			if (!animating) {
+				Data<Backing, uint8_t, Mode::Read>::Seek(currentChunk.length + 4);
+				return;
+			}
+			if (firstIDAT || frames.empty() || (defaultImageIsFrame && frames.size() == 1)) { throw exception("Frame data without a frame control"); }
+			if (currentChunk.length < 4) { throw exception("Invalid frame data"); }
+
+			uint8_t sequence[4] = {};
+			BaseRead(sequence, 4, true);
+			if (Generic::ConvertEndian(sequence) != nextSequence++) { throw exception("Animation chunks out of sequence"); }
+			ReadFrameData(frames.back(), currentChunk.length - 4);
+			CheckCRC();
 		}
 
-		/* This should only be called once, after the first IDAT chunk header has been parsed */
 		template<typename Backing>
-		void PNGStream<Backing, Mode::Read>::GetUnfilteredData() {
-			state.next = NextAction::Read_Chunks;
-			*out = current; /* Copy image details from current */
+		void PNGStream<Backing, Mode::Read>::ReadFrameData(Frame& frame, const unsigned int length) {
+			const size_t start = frame.compressed.size();
+			frame.compressed.resize(Allocation((uint64_t)start + length));
+			BaseRead(frame.compressed.data() + start, length, true);
+		}
 
-			unsigned int width = current.dimensions.width;
-			unsigned int height = current.dimensions.height;
-			if (interlaced && !iPreProcessed) {
-				/* Give correct width & height and resize image vector, for each interlace pass (including setting width = 0 for empty passes) */
-				iPreProcessed = true;
+		/* With receiveAnimation, the image data is only kept if it is the first frame (otherwise it is the image shown by decoders without APNG support), and the rest of the chunks are read as usual */
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::ReadFrameIDAT() {
+			SetOutputFormat();
+			firstIDAT = false;
+			while (currentChunk.type == ChunkType::IDAT) {
+				if (defaultImageIsFrame) {
+					ReadFrameData(frames[0], currentChunk.length);
+					CheckCRC();
+				}
+				else {
+					Data<Backing, uint8_t, Mode::Read>::Seek(currentChunk.length + 4);
+				}
+				FlagCurrentChunk(state.processedChunks);
+				ReadChunkHeaders();
+			}
+			ProcessChunk();
+		}
 
-				for (int pass = 0; pass < 7; pass++) {
-					passes[pass].dimensions.width = 1;
+		/* Inflates, unfilters and converts a frame into its own area-sized image in the output format; only reads stream state that is fixed once the image data starts,
+		so frames can be decoded on several threads at once (each with its own row buffers)
+		*/
+		template<typename Backing>
+		vector<uint8_t> PNGStream<Backing, Mode::Read>::DecodeFrame(const Frame& frame, RowBuffers& buffers) const {
+			const unsigned int width = frame.control.area.width;
+			const unsigned int height = frame.control.area.height;
+			const unsigned int readBpp = color_type == Color_Type::IndexedColor ? paletteBPC : actualbpp;
+			const unsigned int filterBpp = readBpp < 8 ? 1 : readBpp / 8;
+			const unsigned int bytesPerPixel = current.format.bitsPerPixel / 8;
+			vector<uint8_t> pixels((size_t)width * height * bytesPerPixel);
+
+			Data<span<const uint8_t>, uint8_t, Mode::Read> source(frame.compressed.data(), frame.compressed.size());
+			zlib::ZLIBStream<span<const uint8_t>, Mode::Read> inflate(&source);
+			vector<uint8_t> line;
+			vector<uint8_t> previous;
+			for (unsigned int pass = 0; pass < (interlaced ? 7u : 1u); pass++) {
+				const Adam7Pass a = interlaced ? adam7[pass] : Adam7Pass{ 0, 0, 1, 1, 1, 1 };
+				const unsigned int columns = width > a.colStart ? (width - a.colStart + a.colIncrement - 1) / a.colIncrement : 0;
+				const unsigned int rows = height > a.rowStart ? (height - a.rowStart + a.rowIncrement - 1) / a.rowIncrement : 0;
+				if (columns == 0 || rows == 0) {
+					continue;
 				}
 
-				if (width < 5) {
-					passes[1].dimensions.width = 0;
-					if (width < 3) {
-						passes[3].dimensions.width = 0;
-						if (width < 2) {
-							passes[5].dimensions.width = 0;
+				const unsigned int rowBytes = (columns * readBpp + 7) / 8;
+				line.assign(rowBytes + 1, 0);
+				previous.assign(rowBytes + 1, 0);
+				buffers.Reserve(columns, bytesPerPixel);
+				for (unsigned int row = 0; row < rows; row++) {
+					for (unsigned int filled = 0; filled < rowBytes + 1;) {
+						const unsigned int amount = inflate.ReadAvailable(line.data() + filled, rowBytes + 1 - filled);
+						if (amount == 0) {
+							throw exception("Not enough frame data!");
 						}
+						filled += amount;
 					}
-				}
-				if (height < 5) {
-					passes[2].dimensions.width = 0;
-					if (height < 3) {
-						passes[4].dimensions.width = 0;
-						if (height < 2) {
-							passes[6].dimensions.width = 0;
-						}
+
+					const PNG_Filter filter = (PNG_Filter)line[0];
+					if (filter != PNG_Filter::Filter_None) {
+						Unfilter(filter, line.data() + 1, previous.data() + 1, rowBytes, filterBpp);
 					}
+					const unsigned int y = a.rowStart + row * a.rowIncrement;
+					ConvertRow(buffers, line.data() + 1, pixels.data() + ((size_t)y * width + a.colStart) * bytesPerPixel, columns, a.colIncrement * bytesPerPixel);
+					swap(line, previous);
 				}
+			}
+			return pixels;
+		}
 
-				/* Calculate width & height for non-empty passes */
-				ImageData prevPass;
-				for (int pass = 0; pass < 7; pass++) {
-					/* Get reduced count */
-					unsigned int storeWidth = width;
-					unsigned int storeHeight = height;
+		/* Keeps a couple of frames per pool thread decoding ahead of the compositor (the pool is only started for animations with more than one frame) */
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::QueueFrames() {
+			if (framePool == nullptr) {
+				const unsigned int threads = opt->frameThreads != 0 ? opt->frameThreads : thread::hardware_concurrency();
+				if (threads <= 1 || frames.size() <= 1) {
+					return;
+				}
+				framePool = make_unique<ThreadPool>((unsigned int)min<size_t>(threads, frames.size()));
+			}
 
-					if (passes[pass].dimensions.width == 0) {
-						continue;
-					}
-					else {
-						passes[pass].dimensions.width == 0;
-					}
+			while (queuedFrames < frames.size() && queuedFrames < nextFrame + (size_t)framePool->Size() * 2) {
+				const Frame* frame = &frames[queuedFrames++];
+				decodedFrames.push_back(framePool->Submit([this, frame]() {
+					RowBuffers buffers;
+					return DecodeFrame(*frame, buffers);
+				}));
+			}
+		}
 
-					switch (pass) {
-					case 0:
-						passes[pass].reduced.width = (storeWidth + 7) / 8;
-						passes[pass].reduced.height = (storeHeight + 7) / 8;
-						passes[pass].dimensions = passes[pass].reduced;
-						break;
-					case 1:
-						storeWidth -= 4; //offset
-						passes[pass].reduced.width = ((storeWidth + 7) / 8);
-						passes[pass].reduced.height = prevPass.dimensions.height;
-						passes[pass].dimensions = passes[pass].reduced;
-						passes[pass].dimensions.width += prevPass.dimensions.width;
-						break;
-					case 2:
-						storeHeight -= 4;
-						passes[pass].reduced.width = prevPass.dimensions.width;
-						passes[pass].reduced.height = ((storeHeight + 7) / 8);
-						passes[pass].dimensions = passes[pass].reduced;
-						passes[pass].dimensions.height += prevPass.dimensions.height;
-						break;
-					case 3:
-						storeWidth -= 2;
-						passes[pass].reduced.width = ((storeWidth +3) / 4);
-						passes[pass].reduced.height = prevPass.dimensions.height;
-						passes[pass].dimensions = passes[pass].reduced;
-						passes[pass].dimensions.width += prevPass.dimensions.width;
-						break;
-					case 4:
-						storeHeight -= 2;
-						passes[pass].reduced.width = prevPass.dimensions.width;
-						passes[pass].reduced.height = ((storeHeight + 3) / 4);
-						passes[pass].dimensions = passes[pass].reduced;
-						passes[pass].dimensions.height += prevPass.dimensions.height;
-						break;
-					case 5:
-						storeWidth -= 1;
-						passes[pass].reduced.width = ((storeWidth + 1) / 2);
-						passes[pass].reduced.height = prevPass.dimensions.height;
-						passes[pass].dimensions = passes[pass].reduced;
-						passes[pass].dimensions.width += prevPass.dimensions.width;
-						break;
-					case 6:
-						storeHeight -= 1;
-						passes[pass].reduced.width = prevPass.dimensions.width;
-						passes[pass].reduced.height = ((storeHeight + 1) / 2);
-						passes[pass].dimensions = passes[pass].reduced;
-						passes[pass].dimensions.height += prevPass.dimensions.height;
-						break;
+		/* Disposes of the previous frame's area and draws the next frame into its own area, leaving the rest of the canvas as it is
+		The canvas is the caller's buffer if given (so the same buffer has to be given for every frame), and is copied out to the image otherwise;
+		with ImageOptions::reuseImage (the image returned last time comes back as it was), only the two areas changed are copied into it
+		*/
+		template<typename Backing>
+		void PNGStream<Backing, Mode::Read>::ComposeFrame() {
+			if (frames.size() != animationFrames) { throw exception("Frame count does not match acTL"); }
+			if (nextFrame == frames.size()) { throw exception("No frames left in animation"); }
+
+			const unsigned int bytesPerPixel = current.format.bitsPerPixel / 8;
+			const size_t rowLength = (size_t)current.dimensions.width * bytesPerPixel;
+
+			/* Every frame (and the canvas) is at most the size of the image, and each frame's compressed size is known before any are inflated */
+			if (nextFrame == 0) {
+				Allocation((uint64_t)rowLength * current.dimensions.height);
+				if (opt->limits.maxInflateRatio != 0) {
+					const unsigned int readBpp = color_type == Color_Type::IndexedColor ? paletteBPC : actualbpp;
+					for (const Frame& frame : frames) {
+						const uint64_t inflated = (((uint64_t)frame.control.area.width * readBpp + 7) / 8 + 1) * frame.control.area.height;
+						if (inflated > (uint64_t)frame.compressed.size() * opt->limits.maxInflateRatio) { throw exception("Frame data over inflate ratio limit"); }
 					}
+				}
+			}
 
-					passes[pass].passNumber = pass;
-					passes[pass].image = vector<uint8_t>(passes[pass].dimensions.width * passes[pass].dimensions.height * (current.format.bitsPerPixel / 8));
-					prevPass = passes[pass];
+			uint8_t* image = nullptr;
+			size_t pitch = rowLength;
+			if (buffer.data != nullptr) {
+				if (buffer.pitch < rowLength || buffer.size < buffer.pitch * (current.dimensions.height - 1) + rowLength) {
+					throw exception("Buffer too small for image");
+				}
+				image = buffer.data;
+				pitch = buffer.pitch;
+			}
+			else {
+				if (canvas.empty()) {
+					canvas.assign(rowLength * current.dimensions.height, 0);
 				}
+				image = canvas.data();
 			}
 
-			unsigned short bytesPerPixel = current.format.bitsPerPixel / 8;
-			if (palette.size() > 0)
-				bytesPerPixel = 1; //max palette range is 1-255 so 8 bit depth max
-			switch (bytesPerPixel) {
-			case 1:
-				FilterPass<uint8_t>();
-				break;
-			case 2:
-				FilterPass<uint16_t>();
-				break;
-			case 3:
-				FilterPass<uint24_t>();
-				break;
-			case 4:
-				FilterPass<uint32_t>();
-				break;
-			case 6:
-				FilterPass<uint48_t>();
-				break;
-			case 8:
-				FilterPass<uint64_t>();
-				break;
-			case 16:
-				FilterPass<__m128i>();
-				break;
+			/* The canvas starts out transparent black */
+			if (nextFrame == 0 && buffer.data != nullptr) {
+				for (unsigned int y = 0; y < current.dimensions.height; y++) {
+					memset(image + y * pitch, 0, rowLength);
+				}
+			}
+			rect disposed = {}; //area of the previous frame put back on the canvas (if any)
+			if (nextFrame > 0 && frames[nextFrame - 1].control.dispose != DisposeOp::None) {
+				disposed = frames[nextFrame - 1].control.area;
+			}
+			if (disposed.width != 0) {
+				const FrameControl& last = frames[nextFrame - 1].control;
+				const size_t areaLength = (size_t)last.area.width * bytesPerPixel;
+				for (unsigned int y = 0; y < last.area.height; y++) {
+					uint8_t* row = image + (size_t)(last.area.y + y) * pitch + (size_t)last.area.x * bytesPerPixel;
+					if (last.dispose == DisposeOp::Background) {
+						memset(row, 0, areaLength);
+					}
+					else if (last.dispose == DisposeOp::Previous) {
+						memcpy(row, previousArea.data() + y * areaLength, areaLength);
+					}
+				}
 			}
 
-			state.next = NextAction::Finished;
-		}
+			QueueFrames();
+			Frame& frame = frames[nextFrame];
+			vector<uint8_t> pixels;
+			if (!decodedFrames.empty()) {
+				pixels = decodedFrames.front().get();
+				decodedFrames.pop_front();
+			}
+			else {
+				pixels = DecodeFrame(frame, rowBuffers);
+			}
 
+			/* A first frame can't go back to a previous canvas, so it is cleared instead */
+			FrameControl& control = frame.control;
+			if (nextFrame == 0 && control.dispose == DisposeOp::Previous) {
+				control.dispose = DisposeOp::Background;
+			}
 
+			const bool alpha = (current.format.formatting & FormatDetails::hasAlpha) != FormatDetails::Any;
+			const unsigned int sampleBytes = (current.format.formatting & FormatDetails::has16) != FormatDetails::Any ? 2 : 1;
+			const size_t areaLength = (size_t)control.area.width * bytesPerPixel;
+			if (control.dispose == DisposeOp::Previous) {
+				previousArea.resize(areaLength * control.area.height);
+			}
+			for (unsigned int y = 0; y < control.area.height; y++) {
+				uint8_t* row = image + (size_t)(control.area.y + y) * pitch + (size_t)control.area.x * bytesPerPixel;
+				const uint8_t* source = pixels.data() + y * areaLength;
+				if (control.dispose == DisposeOp::Previous) {
+					memcpy(previousArea.data() + y * areaLength, row, areaLength);
+				}
+				if (control.blend == BlendOp::Over && alpha) {
+					BlendOver(row, source, control.area.width, bytesPerPixel / sampleBytes, sampleBytes);
+				}
+				else {
+					memcpy(row, source, areaLength);
+				}
+			}
 
-		template<typename Backing>
-		void PNGStream<Backing, Mode::Read>::ProcessAncillaryChunk() {
-			switch (currentChunk.type) {
-			default:
-				Data<Backing, uint8_t, Mode::Read>::Seek(currentChunk.length + 4); //to make processing chunks faster, skip unknown ones and don't check the CRC either
+			out->dimensions = current.dimensions;
+			out->format = current.format;
+			if (buffer.data != nullptr) {
+				out->image.clear();
 			}
+			else if (opt->reuseImage && nextFrame > 0 && out->image.data() == returnedImage && out->image.size() == canvas.size()) {
+				for (const rect& area : { disposed, control.area }) {
+					for (unsigned int y = area.y; y < area.y + area.height; y++) {
+						const size_t offset = (size_t)y * rowLength + (size_t)area.x * bytesPerPixel;
+						memcpy(out->image.data() + offset, canvas.data() + offset, (size_t)area.width * bytesPerPixel);
+					}
+				}
+			}
+			else {
+				out->image = canvas;
+			}
+			returnedImage = out->image.data();
+
+			AnimationInfo& info = currentImageInfo.animInfo;
+			info.hasAnimation = true;
+			info.animationID = (unsigned int)nextFrame;
+			info.relativeX = control.area.x;
+			info.relativeY = control.area.y;
+			info.width = control.area.width;
+			info.height = control.area.height;
+			info.applyTransparency = control.blend == BlendOp::Over;
+			info.overAction = control.dispose == DisposeOp::Background ? AnimationFinish::FINISHED_CLEAR_TO_BLACK :
+				control.dispose == DisposeOp::Previous ? AnimationFinish::REPLACED_BY_PREVIOUS : AnimationFinish::DRAWN_OVER_BY_NEXT;
+			info.delayNumerator = control.delayNumerator;
+			info.delayDenominator = control.delayDenominator;
+			info.frames = animationFrames;
+			info.plays = animationPlays;
+			nextFrame++;
 		}
 
 
@@ -925,8 +1593,8 @@ namespace ImageLibrary {
 			case ChunkType::sPLT:
 				toChange |= ChunkFlag::sPLT;
 				break;
-			case ChunkType::eXlf:
-				toChange |= ChunkFlag::eXlf;
+			case ChunkType::eXIf:
+				toChange |= ChunkFlag::eXIf;
 				break;
 			case ChunkType::tIME:
 				toChange |= ChunkFlag::tIME;
@@ -964,8 +1632,110 @@ namespace ImageLibrary {
 
 
 
+		template<typename Backing>
+		ImageProbe PNGStream<Backing, Mode::Read>::Probe(const uint8_t* data, const size_t length) {
+			ImageProbe probe;
+			if (length < 33) {
+				return probe;
+			}
+
+			/* data (and so every chunk in it) can start at any address, so fields wider than a byte are copied out rather than read through wider pointers */
+			uint64_t sig = 0;
+			memcpy(&sig, data, 8);
+			if (sig != signature) {
+				return probe;
+			}
+
+			/* IHDR must be first, with its 13 bytes of data intact */
+			const uint8_t* ihdr = data + 8;
+			unsigned int ihdrType = 0;
+			memcpy(&ihdrType, ihdr + 4, 4);
+			if (Generic::ConvertEndian(ihdr) != 13 || ihdrType != (unsigned int)ChunkType::IHDR ||
+				Generic::checksum::CRC32(ihdr + 4, 17, 0) != Generic::ConvertEndian(ihdr + 21)) {
+				return probe;
+			}
+			const unsigned int width = Generic::ConvertEndian(ihdr + 8);
+			const unsigned int height = Generic::ConvertEndian(ihdr + 12);
+			const uint8_t bpc = ihdr[16];
+			const Color_Type colorType = (Color_Type)ihdr[17];
+			if (width == 0 || height == 0 || ihdr[18] != 0 || ihdr[19] != 0 || ihdr[20] > 1) {
+				return probe;
+			}
+
+			/* Same formats as IHDRFillMetadata gives (samples under 8 bits are widened to 8, palettes are expanded to rgb8) */
+			unsigned short channels = 0;
+			unsigned short channelBits = 0;
+			switch (colorType) {
+			case Color_Type::Greyscale:
+				channels = 1;
+				channelBits = 0b10000;
+				if (!(bpc == 1 || bpc == 2 || bpc == 4 || bpc == 8 || bpc == 16)) { return probe; }
+				break;
+			case Color_Type::Truecolor:
+				channels = 3;
+				channelBits = 0b01110;
+				if (!(bpc == 8 || bpc == 16)) { return probe; }
+				break;
+			case Color_Type::IndexedColor:
+				channels = 3;
+				channelBits = 0b01110;
+				if (!(bpc == 1 || bpc == 2 || bpc == 4 || bpc == 8)) { return probe; }
+				break;
+			case Color_Type::GreyscaleAlpha:
+				channels = 2;
+				channelBits = 0b10001;
+				if (!(bpc == 8 || bpc == 16)) { return probe; }
+				break;
+			case Color_Type::TruecolorAlpha:
+				channels = 4;
+				channelBits = 0b01111;
+				if (!(bpc == 8 || bpc == 16)) { return probe; }
+				break;
+			default:
+				return probe;
+			}
+			const unsigned short sampleBits = (colorType == Color_Type::IndexedColor || bpc < 8) ? 8 : bpc;
+
+			probe.dimensions = { width, height };
+			probe.interlaced = ihdr[20] == 1;
+			probe.transparency = colorType == Color_Type::GreyscaleAlpha || colorType == Color_Type::TruecolorAlpha;
+
+			/* Only chunk headers are looked at (lengths are used to skip over the data) */
+			size_t position = 33;
+			while (position + 8 <= length) {
+				const unsigned int chunkLength = Generic::ConvertEndian(data + position);
+				ChunkType type;
+				memcpy(&type, data + position + 4, 4); //chunk starts aren't aligned
+				if (type == ChunkType::IDAT || type == ChunkType::IEND || chunkLength > 0x7FFFFFFF) {
+					break;
+				}
+				if (type == ChunkType::acTL) {
+					probe.animated = true;
+				}
+				else if (type == ChunkType::tRNS) {
+					probe.transparency = true;
+				}
+				position += (size_t)chunkLength + 12;
+			}
+
+			/* Palette transparency adds an alpha channel to the output */
+			if (colorType == Color_Type::IndexedColor && probe.transparency) {
+				channels = 4;
+				channelBits = 0b01111;
+			}
+			probe.format = {
+				.bitsPerPixel = (unsigned short)(channels * sampleBits),
+				.formatting = (FormatDetails)(channelBits << 8 | sampleBits)
+			};
+			probe.valid = true;
+			return probe;
+		}
+
+
+
 		/* Explicit template instantiations */
 		template class PNGStream<vector<uint8_t>, Mode::Read>;
+		template class PNGStream<span<const uint8_t>, Mode::Read>;
 		template class PNGStream<basic_ifstream<uint8_t, std::char_traits<uint8_t>>, Mode::Read>;
 	}
 }
\ No newline at end of file
@@ -2,6 +2,13 @@
 
 #include "../interface/image-stream-interface.h"
 #include "../zlib/zlib.h"
+#include "filter.h"
+#include "convert.h"
+#include "scale.h"
+#include "../thread/row-ring.h"
+#include "../thread/thread-pool.h"
+#include <thread>
+#include <memory>
 #include <unordered_map>
 
 namespace ImageLibrary {
@@ -24,36 +31,39 @@ namespace ImageLibrary {
 		*/
 		enum class ChunkFlag: unsigned int{
 			NONE = 0,
-			IHDR = 0b1,
-			PLTE = 0b01,
-			IDAT = 0b001,
-			IEND = 0b0001,
-			UNKNOWN_CRITICAL = 0b00001,
-			tRNS = 0b000001,
-			cHRM = 0b0000001,
-			gAMA = 0b00000001,
-			iCCP = 0b000000001,
-			sBIT = 0b0000000001,
-			sRGB = 0b00000000001,
-			cICP = 0b000000000001,
-			mDCV = 0b0000000000001,
-			iTXt = 0b00000000000001,
-			tEXt = 0b000000000000001,
-			zTXt = 0b0000000000000001,
-			bKGD = 0b00000000000000001,
-			hlST = 0b000000000000000001,
-			pHYs = 0b0000000000000000001,
-			sPLT = 0b00000000000000000001,
-			eXlf = 0b000000000000000000001,
-			tIME = 0b0000000000000000000001,
-			acTL = 0b00000000000000000000001,
-			fcTL = 0b000000000000000000000001,
-			fdAT = 0b0000000000000000000000001,
-			UNKNOWN_ANCILLARY = 0b00000000000000000000000001,
+			IHDR = 1u << 0,
+			PLTE = 1u << 1,
+			IDAT = 1u << 2,
+			IEND = 1u << 3,
+			UNKNOWN_CRITICAL = 1u << 4,
+			tRNS = 1u << 5,
+			cHRM = 1u << 6,
+			gAMA = 1u << 7,
+			iCCP = 1u << 8,
+			sBIT = 1u << 9,
+			sRGB = 1u << 10,
+			cICP = 1u << 11,
+			mDCV = 1u << 12,
+			iTXt = 1u << 13,
+			tEXt = 1u << 14,
+			zTXt = 1u << 15,
+			bKGD = 1u << 16,
+			hlST = 1u << 17,
+			pHYs = 1u << 18,
+			sPLT = 1u << 19,
+			eXIf = 1u << 20,
+			tIME = 1u << 21,
+			acTL = 1u << 22,
+			fcTL = 1u << 23,
+			fdAT = 1u << 24,
+			UNKNOWN_ANCILLARY = 1u << 25,
 		};
 		inline ChunkFlag& operator|=(ChunkFlag& a, ChunkFlag b) {
 			return a = (ChunkFlag)((unsigned int)a | (unsigned int)b);
 		}
+		inline ChunkFlag operator&(ChunkFlag a, ChunkFlag b) {
+			return (ChunkFlag)((unsigned int)a & (unsigned int)b);
+		}
 
 		enum class Filter : uint8_t {
 			FILTER_NONE = 0,
@@ -85,7 +95,7 @@ namespace ImageLibrary {
 			hlST = 0x54536C68,
 			pHYs = 0x73594870,
 			sPLT = 0x544C5073,
-			eXlf = 0x666C5865,
+			eXIf = 0x66495865,
 			tIME = 0x454D4974,
 			acTL = 0x4C546361,
 			fcTL = 0x4C546366,
@@ -117,22 +127,100 @@ namespace ImageLibrary {
 		enum class Palette : uint8_t {
 			Red,
 			Green,
-			Blue
+			Blue,
+			Alpha
 		};
 
-		enum class PNG_Filter : uint8_t {
-			Filter_None,
-			Filter_Sub,
-			Filter_Up,
-			Filter_Average,
-			Filter_Paeth
+		class ReturnInterlacedPass : std::exception {};
+
+		/* Adam7 pass geometry: pass p covers rows rowStart + n * rowIncrement and columns colStart + n * colIncrement of the image
+		Once it is done, every rowStep'th row and colStep'th column of the image has been received
+		*/
+		struct Adam7Pass {
+			uint8_t rowStart;
+			uint8_t colStart;
+			uint8_t rowIncrement;
+			uint8_t colIncrement;
+			uint8_t rowStep;
+			uint8_t colStep;
 		};
 
-		class ReturnInterlacedPass : std::exception {};
+		struct ImagePass {
+			size reduced; //pixels in the scanlines of this pass alone
+			size dimensions; //pixels received once this pass is done (returned with receiveInterlaced)
+		};
 
-		struct ImagePass : ImageData {
-			uint8_t passNumber;
-			size reduced;
+		/* APNG frame control (fcTL): how a frame is placed on the canvas, and what happens to its area afterwards */
+		enum class DisposeOp : uint8_t {
+			None, //left as it is
+			Background, //cleared to transparent black
+			Previous //restored to what it was before the frame
+		};
+
+		enum class BlendOp : uint8_t {
+			Source, //replaces the area, alpha included
+			Over //composited over the area
+		};
+
+		struct FrameControl {
+			rect area;
+			unsigned short delayNumerator;
+			unsigned short delayDenominator;
+			DisposeOp dispose;
+			BlendOp blend;
+		};
+
+		/* Compressed data of a frame (its IDAT or fdAT chunks, joined together without the sequence numbers), decoded independently of every other frame */
+		struct Frame {
+			FrameControl control;
+			std::vector<uint8_t> compressed;
+		};
+
+		/* Intermediate rows used while converting scanlines to the output format (each thread converting rows needs its own) */
+		struct RowBuffers {
+			std::vector<uint8_t> unpacked; //sub-byte samples / palette indices, a byte each
+			std::vector<uint8_t> converted; //a row in the output format, for interlace passes which fill every other column (or rows that start part way into a byte)
+			std::vector<uint8_t> expanded; //a row in the image's own format, before channels are added for the target format
+
+			void Reserve(const unsigned int columns, const unsigned int bytesPerPixel) {
+				if (unpacked.size() < columns) {
+					unpacked.resize(columns);
+				}
+				const size_t rowLength = (size_t)columns * bytesPerPixel; //the format can change between images of a reset stream
+				if (converted.size() < rowLength) {
+					converted.resize(rowLength);
+					expanded.resize(rowLength);
+				}
+			}
+		};
+
+		/* How the rows of an image being encoded are put into the file's format & filtered */
+		struct EncodeLayout {
+			unsigned int stride = 0; //bytes of a row in the file, without its filter type
+			unsigned int bpp = 1; //bytes per pixel (at least 1) that filters look back by
+			unsigned int depth = 8; //of the image's samples
+			unsigned int channels = 1;
+			uint8_t paletteDepth = 0; //bits per index when written with a palette, 0 otherwise
+			size_t inputStride = 0; //bytes of a row of the image given
+			PNG_Filter filter = PNG_Filter::Filter_None; //used for every row unless adaptive
+			bool adaptive = false;
+		};
+
+		/* Scanlines in the file's format (when the image's own rows can't be used as they are: 16-bit samples, which png stores in network byte order, and palette indices)
+		The current & previous rows are swapped after each row, and each filter has its own output row for the adaptive filter to pick from (each thread filtering rows needs its own)
+		*/
+		struct FilterBuffers {
+			std::vector<uint8_t> scanline;
+			std::vector<uint8_t> previousScanline;
+			std::vector<uint8_t> filtered[4];
+
+			void Reserve(const unsigned int stride) {
+				scanline.resize(stride);
+				previousScanline.resize(stride);
+				for (std::vector<uint8_t>& row : filtered) {
+					row.resize(stride);
+				}
+			}
 		};
 
 		template<typename Backing>
@@ -147,25 +235,36 @@ namespace ImageLibrary {
 			
 			ImageData* out;
 			const ImageOptions* opt;
+			ImageBuffer buffer; //caller owned memory to decode into (data is null when decoding into out)
 			ImageData current;
 			ImageReturnInfo currentImageInfo;
 			ImageFormat baseFormat;
 			Color_Type color_type;
 			bool c16 = false; //flag for if channels have 16-bit samples and therefore will be stored in network-byte order
 
+			/* 16 to 8-bit narrowing (ImageOptions::narrow16); with sBIT, each channel goes through a table built for its significant bits */
+			bool narrow16 = false;
+			uint8_t significantBits[4] = {}; //from sBIT (0 if not present)
+			std::vector<uint8_t> narrowTables[4];
+			uint8_t narrowShifts[4] = {};
+
+			/* Channels of the image & of ImageOptions::target, when the target adds channels (grey to rgb etc.) */
+			unsigned int expandFrom = 0;
+			unsigned int expandTo = 0;
+
+			/* Always 256 entries once PLTE is read (unused ones are opaque black), so that no index needs a bounds check; alpha comes from tRNS (opaque otherwise) */
 			struct PaletteEntry {
-				union {
-					uint8_t color[3];
-					Generic::uint24_t colors;
-				};	
+				uint8_t color[4];
 			};
 			std::vector<PaletteEntry> palette;
+			unsigned short paletteSize = 0; //entries actually given in PLTE
+			bool paletteAlpha = false; //set if tRNS gave any entries an alpha value (output becomes rgba8)
 			uint8_t paletteBPC;
 
-			std::unordered_map<ChunkType, ChunkHeader> chunkHistory;
+			ChunkFlag seenChunks = ChunkFlag::NONE; //every chunk type finished so far
 			ChunkHeader prevChunk; //specifically to ensure that multiple IDAT chunks are consecutive
 			ChunkHeader currentChunk;
-			unsigned int crc; //will calculate crc for each chunk based on data inside and allow comparison to crc recorded in currentChunk
+			unsigned int crc = 0; //will calculate crc for each chunk based on data inside and allow comparison to crc recorded in currentChunk
 
 			/* chunk data is handled this way in case of extremely large (and/or erroneous) chunk length values */
 			/* Also, for IDAT, it will be faster to chunk read (if from file, but will do this anyway) and use _current to pass data to zlib */
@@ -175,17 +274,50 @@ namespace ImageLibrary {
 			unsigned int _remaining_length = 0;
 			unsigned int _last_read_count = 0;
 
+			/* Counted against ImageOptions::limits */
+			uint64_t chunkBytes = 0;
+			uint64_t compressedBytes = 0; //image data given to zlib
+			uint64_t inflatedBytes = 0; //scanline bytes out of zlib
+
 			bool interlaced = false;
 			std::vector<ImagePass> passes = std::vector<ImagePass>(7);
 			uint8_t interlacePass = 0; /* 0-6 */
 			bool iPreProcessed = false;
-			PNG_Filter currentFilter;
+			std::vector<uint8_t> interlacedImage; //the full image, when receiveInterlaced (each returned pass is gathered or copied from it)
+
+			/* Filtered scanlines are read whole (filter byte first) and unfiltered in place against the previous one, so two are kept and swapped after each row */
+			std::vector<uint8_t> scanline;
+			std::vector<uint8_t> previousScanline;
+			RowBuffers rowBuffers;
+			std::vector<uint8_t> outputRow; //a row given to the row sink
+			RowScaler scaler; //for ImageOptions::scaleTo
+			constexpr static unsigned int pipelineRows = 8; //scanlines in flight between the inflating & unfiltering threads (ImageOptions::pipeline)
 
 			bool firstIDAT = true;
 			short actualbpp = 0;
+
+			/* APNG (receiveAnimation): every frame's data is read before the first is returned, frames are then decoded on framePool ahead of the compositor,
+			which draws each one onto canvas within its own area only
+			*/
+			unsigned int animationFrames = 0; //from acTL (0 if not animated)
+			unsigned int animationPlays = 0;
+			bool animating = false; //receiveAnimation with an acTL before the image data
+			bool defaultImageIsFrame = false; //fcTL came before IDAT, so the image data is also the first frame
+			unsigned int nextSequence = 0; //of fcTL & fdAT chunks
+			std::vector<Frame> frames;
+			std::deque<std::future<std::vector<uint8_t>>> decodedFrames; //frames queued for decoding, in order from nextFrame
+			size_t queuedFrames = 0;
+			size_t nextFrame = 0; //next frame to composite
+			std::vector<uint8_t> canvas; //when not composited straight into the caller's buffer
+			std::vector<uint8_t> previousArea; //what was under a frame disposed to Previous
+			const uint8_t* returnedImage = nullptr; //image returned last time (a frame, or a full size interlace pass), which only needs its changed areas updated if it comes back (ImageOptions::reuseImage)
+			std::unique_ptr<Generic::ThreadPool> framePool; //after everything frames read, so its workers finish first
 		private:
+			void ResetState();
+
 			void BaseRead(uint8_t* out, const int length, const bool updateCRC); //will also update current crc if needed for validation
 			void CheckCRC();
+			size_t Allocation(const uint64_t bytes) const;
 
 			void ReadChunkHeaders();
 
@@ -197,8 +329,21 @@ namespace ImageLibrary {
 
 			void IHDRFillMetadata();
 			void PLTEGetPalette();
+			void tRNSGetTransparency();
+			void sBITGetSignificantBits();
+			void SetTargetFormat();
+			void SetOutputFormat();
 			void BeginReadIDAT();
 
+			void acTLGetAnimation();
+			void fcTLGetFrameControl();
+			void fdATGetFrameData();
+			void ReadFrameIDAT();
+			void ReadFrameData(Frame& frame, const unsigned int length);
+			std::vector<uint8_t> DecodeFrame(const Frame& frame, RowBuffers& buffers) const;
+			void QueueFrames();
+			void ComposeFrame();
+
 			void UpdateCurrentBuffer();
 			void GetNextIDAT();
 
@@ -206,18 +351,36 @@ namespace ImageLibrary {
 
 			void FlagCurrentChunk(ChunkFlag& toChange);
 
-			template<typename Pixel>
+			bool ReadScanline(uint8_t* row, const unsigned int length); //false if the zlib stream ends first
+			void ConvertRow(RowBuffers& buffers, const uint8_t* row, uint8_t* target, const unsigned int columns, const unsigned int stride, const unsigned int skip = 0) const;
 			void FilterPass();
+			void FillRectangles(uint8_t* image, const size_t pitch, const unsigned int y, const unsigned int columns);
+			ImageReturnInfo ReadImage();
 		public:
 			using Generic::Data<Backing, uint8_t, Generic::Mode::Read>::Data; //inherit Data constructor
 
+			/* Starts over on a new image (source given as it would be to the constructor), keeping the capacity of every buffer
+			Decoding one image after another then doesn't allocate, other than for the returned image (none if decoded into an ImageBuffer), a pipelined inflating thread and animation frames
+			*/
+			template<typename... Source>
+			void Reset(Source&&... source) {
+				Generic::Data<Backing, uint8_t, Generic::Mode::Read>::Reset(std::forward<Source>(source)...);
+				ResetState();
+			}
+
 			ImageReturnInfo ReadData(ImageData* out, const ImageOptions* const options) override;
+			ImageReturnInfo ReadData(ImageData* out, const ImageBuffer& buffer, const ImageOptions* const options) override;
 			ImageStreamState QueryState() override;
 
 
 			/* Extension methods */
 			PNGStreamState ExtQueryState();
 
+			/* Reads only the signature & IHDR (and the chunk headers up to the first IDAT, for acTL & tRNS) from the start of a file, without setting up a stream
+			Only as much of the file as is available needs to be given; the first 33 bytes hold everything but the animation & transparency flags
+			*/
+			static ImageProbe Probe(const uint8_t* data, const size_t length);
+
 
 			/* for internal use (will return compressed IDAT data to zlib decompression stream)
 			whenever this is called, it will filter the deflated data from the sliding window that is about to be overwritten, before providing new data (or longjmp if it needs to return interlaced pass)
@@ -231,12 +394,51 @@ namespace ImageLibrary {
 		template<typename Backing>
 		class PNGStream<Backing, Generic::Mode::Write> : public Generic::Data<Backing, uint8_t, Generic::Mode::Write>, public ImageStreamInterface<Backing, Generic::Mode::Write> {
 		private:
-			const static uint64_t signature = 0x89504E470D0A1A0A;
-		public:
-			using Generic::Data<Backing, uint8_t, Generic::Mode::Read>::Data; //inherit Data constructor
+			constexpr static uint64_t signature = 0x0A1A0A0D474E5089; // 0x89504E470D0A1A0A;
+			ImageStreamState state;
+
+			zlib::ZLIBStream<Backing, Generic::Mode::Write> deflate = zlib::ZLIBStream<Backing, Generic::Mode::Write>(this);
+
+			/* Compressed data from deflate, gathered into IDAT chunks of chunkSize */
+			std::vector<uint8_t> idat;
+			unsigned int chunkSize = 1 << 16;
+
+			FilterBuffers filterBuffers;
+
+			/* Colours in order of their palette index, with any that aren't opaque first (so tRNS can stop at the last of them) */
+			std::vector<uint32_t> palette;
+			std::unordered_map<uint32_t, uint8_t> paletteIndices;
 
+			std::unique_ptr<Generic::ThreadPool> stripPool; //kept between images, started once an image has more than one strip
+		private:
+			void WriteChunk(const ChunkType type, const uint8_t* data, const unsigned int length);
+			void WriteHeader(const ImageData& in, const Color_Type colorType, const uint8_t bitDepth);
+			void WritePalette();
+			bool BuildPalette(const ImageData& in, const unsigned int channels);
+			void PaletteRow(uint8_t* out, const uint8_t* row, const unsigned int width, const unsigned int channels, const uint8_t bitDepth) const;
+			template<typename Sink>
+			void FilterRows(const ImageData& in, const EncodeLayout& layout, FilterBuffers& buffers, const unsigned int first, const unsigned int end, Sink&& sink) const;
+			void WriteImageData(const ImageData& in, const EncodeLayout& layout);
+			void WriteStrips(const ImageData& in, const EncodeLayout& layout, const EncodeOptions& options, const unsigned int rowsPerStrip, const unsigned int threads);
+		public:
+			using Generic::Data<Backing, uint8_t, Generic::Mode::Write>::Data; //inherit Data constructor
+
+			/* Starts over on a new destination (given as it would be to the constructor, eg. another file path), keeping the capacity of every buffer */
+			template<typename... Destination>
+			void Reset(Destination&&... destination) {
+				Generic::Data<Backing, uint8_t, Generic::Mode::Write>::Reset(std::forward<Destination>(destination)...);
+				state = {};
+			}
+
+			/* Writes in as a whole png file (signature to IEND), with the settings in options.encode
+			Images can be grey (1, 2, 4, 8 or 16 bits), grey-alpha, rgb or rgba (8 or 16 bits); rows are packed as ReadData returns them, with 16-bit samples in native byte order
+			Images larger than options.encode.stripSize are compressed in strips across threads, the calling thread writing them out in order as they finish
+			*/
 			ImageStreamState EncodeData(const ImageData& in, const ImageOptions& options) override;
-			ImageStreamState QueryState();
+			ImageStreamState QueryState() override;
+
+			/* for internal use (receives compressed data from deflate, and writes it out as IDAT chunks) */
+			void Write(const uint8_t* in, const unsigned int length) override;
 		};
 	}
 }
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include "scale.h"
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+namespace ImageLibrary {
+	namespace PNG {
+		void RowScaler::Begin(const unsigned int width, const unsigned int height, const unsigned int outputWidth, const unsigned int outputHeight, const unsigned int channels, const unsigned int sampleBytes) {
+			if (outputWidth == 0 || outputHeight == 0 || outputWidth > width || outputHeight > height) {
+				throw std::exception("Unsupported scale");
+			}
+			this->width = width;
+			this->height = height;
+			this->outputWidth = outputWidth;
+			this->outputHeight = outputHeight;
+			this->channels = channels;
+			this->sampleBytes = sampleBytes;
+
+			outputColumn.resize(width);
+			columnCount.assign(outputWidth, 0);
+			for (unsigned int x = 0; x < width; x++) {
+				outputColumn[x] = (uint32_t)((uint64_t)x * outputWidth / width);
+				columnCount[outputColumn[x]]++;
+			}
+			sums.assign((size_t)outputWidth * channels, 0);
+			result.resize((size_t)outputWidth * channels * sampleBytes);
+			inputRow = 0;
+			rowCount = 0;
+		}
+
+		const uint8_t* RowScaler::AddRow(const uint8_t* row, unsigned int& outputY) {
+			if (inputRow >= height) {
+				return nullptr;
+			}
+
+			if (sampleBytes == 1) {
+				for (unsigned int x = 0; x < width; x++) {
+					uint64_t* sum = sums.data() + (size_t)outputColumn[x] * channels;
+					for (unsigned int c = 0; c < channels; c++) {
+						sum[c] += *row++;
+					}
+				}
+			}
+			else {
+				for (unsigned int x = 0; x < width; x++) {
+					uint64_t* sum = sums.data() + (size_t)outputColumn[x] * channels;
+					for (unsigned int c = 0; c < channels; c++, row += 2) {
+						sum[c] += row[0] | row[1] << 8;
+					}
+				}
+			}
+			rowCount++;
+
+			/* The output row is done once the next input row maps onto the next one (or this was the last input row) */
+			const unsigned int y = (unsigned int)((uint64_t)inputRow * outputHeight / height);
+			inputRow++;
+			if (inputRow < height && (unsigned int)((uint64_t)inputRow * outputHeight / height) == y) {
+				return nullptr;
+			}
+
+			for (unsigned int x = 0; x < outputWidth; x++) {
+				const uint64_t count = (uint64_t)columnCount[x] * rowCount;
+				for (unsigned int c = 0; c < channels; c++) {
+					const size_t i = (size_t)x * channels + c;
+					const uint32_t value = (uint32_t)((sums[i] + count / 2) / count);
+					if (sampleBytes == 1) {
+						result[i] = (uint8_t)value;
+					}
+					else {
+						result[i * 2] = (uint8_t)value;
+						result[i * 2 + 1] = (uint8_t)(value >> 8);
+					}
+				}
+			}
+			memset(sums.data(), 0, sums.size() * sizeof(uint64_t));
+			rowCount = 0;
+			outputY = y;
+			return result.data();
+		}
+	}
+}
\ No newline at end of file
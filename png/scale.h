@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace ImageLibrary {
+	namespace PNG {
+		/* Box filter for downscaling as rows are decoded: each output pixel is the rounded average of the block of input pixels that maps onto it
+		(input x goes to output x * outputWidth / width, likewise for rows), so only one row of sums is held rather than the full size image
+		*/
+		class RowScaler {
+		private:
+			unsigned int width = 0;
+			unsigned int height = 0;
+			unsigned int outputWidth = 0;
+			unsigned int outputHeight = 0;
+			unsigned int channels = 0;
+			unsigned int sampleBytes = 1;
+
+			std::vector<uint64_t> sums; //outputWidth * channels, for the output row being accumulated (64 bits, as a block can be the whole of a 16-bit image)
+			std::vector<uint32_t> outputColumn; //output column of each input column
+			std::vector<uint32_t> columnCount; //input columns in each output column
+			std::vector<uint8_t> result;
+			unsigned int inputRow = 0;
+			unsigned int rowCount = 0; //input rows added to sums so far
+		public:
+			/* sampleBytes is 1 or 2 (16-bit samples in little-endian, as they are output); output size must be no larger than the input */
+			void Begin(const unsigned int width, const unsigned int height, const unsigned int outputWidth, const unsigned int outputHeight, const unsigned int channels, const unsigned int sampleBytes);
+
+			/* Adds the next input row; once that completes an output row, returns it (valid until the next call) and sets outputY, otherwise returns nullptr */
+			const uint8_t* AddRow(const uint8_t* row, unsigned int& outputY);
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "filter-benchmark.h"
+#include "../filter.h"
+#include <vector>
+#include <random>
+#include <chrono>
+#include <iomanip>
+
+using namespace std;
+
+namespace ImageLibrary {
+	namespace PNG {
+		using Kernel = void (*)(const PNG_Filter, uint8_t*, const uint8_t*, const size_t, const unsigned int);
+
+		/* Unfilters the whole image (each row against the one above it) several times, and returns the best time in seconds */
+		static double TimeKernel(Kernel kernel, const PNG_Filter filter, const vector<uint8_t>& filtered, vector<uint8_t>& image, const size_t rowBytes, const unsigned int bpp) {
+			const int repeats = 5;
+			const vector<uint8_t> zeros(rowBytes);
+			double best = 1e30;
+
+			for (int r = 0; r < repeats; r++) {
+				image = filtered;
+				auto start = chrono::steady_clock::now();
+
+				const uint8_t* prev = zeros.data();
+				for (size_t offset = 0; offset < image.size(); offset += rowBytes) {
+					kernel(filter, image.data() + offset, prev, rowBytes, bpp);
+					prev = image.data() + offset;
+				}
+
+				chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+				if (elapsed.count() < best) { best = elapsed.count(); }
+			}
+			return best;
+		}
+
+		void FilterBenchmark(std::ostream& out, const unsigned int width, const unsigned int height) {
+			static const char* filterNames[] = { "None", "Sub", "Up", "Average", "Paeth" };
+			static const unsigned int sizes[] = { 1, 2, 3, 4, 6, 8 };
+
+			/* Every level up to what this CPU runs (Scalar is the byte-wise reference) */
+			vector<Generic::cpu::SIMDLevel> levels;
+			for (int level = 0; level <= (int)Generic::cpu::GetSIMDLevel(); level++) {
+				levels.push_back((Generic::cpu::SIMDLevel)level);
+			}
+
+			mt19937 rng(0x504E47);
+			out << "Unfilter benchmark (" << width << "x" << height << ", MB/s of unfiltered data)\n";
+			out << left << setw(6) << "bpp" << setw(10) << "filter" << right;
+			for (Generic::cpu::SIMDLevel level : levels) {
+				out << setw(10) << Generic::cpu::SIMDLevelName(level);
+			}
+			out << setw(10) << "speedup" << "\n";
+
+			for (unsigned int bpp : sizes) {
+				const size_t rowBytes = (size_t)width * bpp;
+				vector<uint8_t> filtered(rowBytes * height);
+				for (uint8_t& byte : filtered) { byte = (uint8_t)rng(); }
+
+				vector<uint8_t> reference;
+				vector<uint8_t> result;
+				for (int f = (int)PNG_Filter::Filter_Sub; f <= (int)PNG_Filter::Filter_Paeth; f++) {
+					double megabytes = filtered.size() / 1e6;
+					double scalar = TimeKernel(UnfilterScalar, (PNG_Filter)f, filtered, reference, rowBytes, bpp);
+					double best = scalar;
+					bool mismatch = false;
+
+					out << left << setw(6) << bpp << setw(10) << filterNames[f] << right << fixed << setprecision(0) << setw(10) << megabytes / scalar;
+					for (size_t l = 1; l < levels.size(); l++) {
+						double time = TimeKernel(GetUnfilter(levels[l]), (PNG_Filter)f, filtered, result, rowBytes, bpp);
+						if (time < best) { best = time; }
+						mismatch |= reference != result;
+						out << setw(10) << megabytes / time;
+					}
+					out << setprecision(2) << setw(9) << scalar / best << "x";
+					if (mismatch) {
+						out << "  MISMATCH";
+					}
+					out << "\n";
+				}
+			}
+			out << flush;
+		}
+	}
+}
\ No newline at end of file
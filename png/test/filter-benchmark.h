@@ -0,0 +1,12 @@
+#pragma once
+
+#include <ostream>
+
+namespace ImageLibrary {
+	namespace PNG {
+		/* Times the unfilter kernels of every SIMD level this CPU supports (against UnfilterScalar) for every filter type & pixel size, over a width x height image of random filtered data
+		Prints throughput (of unfiltered bytes) for each level, and checks that they all produce the same output as the scalar version
+		*/
+		void FilterBenchmark(std::ostream& out, const unsigned int width = 1920, const unsigned int height = 1080);
+	}
+}
\ No newline at end of file
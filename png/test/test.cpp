@@ -0,0 +1,136 @@
+#include "test.h"
+#include "../png.h"
+#include <fstream>
+#include <iterator>
+#include <string>
+
+using namespace Generic;
+using namespace std;
+
+namespace ImageLibrary {
+	namespace PNG {
+		struct EncoderCase {
+			string name;
+			EncodeOptions encode;
+		};
+
+		/* Every filter strategy at the fastest, lowest & highest levels, then the options that change how the file is laid out */
+		static vector<EncoderCase> EncoderCases() {
+			static const char* filterNames[] = { "Adaptive", "None", "Sub", "Up", "Average", "Paeth" };
+			vector<EncoderCase> cases;
+			for (unsigned int filter = 0; filter < 6; filter++) {
+				for (const unsigned int level : { 0u, 1u, 9u }) {
+					EncoderCase encoderCase = { string(filterNames[filter]) + " level " + to_string(level) };
+					encoderCase.encode.filter = (FilterStrategy)filter;
+					encoderCase.encode.level = level;
+					cases.push_back(encoderCase);
+				}
+			}
+
+			EncoderCase palette = { "palette" };
+			palette.encode.palette = true;
+			cases.push_back(palette);
+
+			EncoderCase smallChunks = { "chunk size 1" };
+			smallChunks.encode.chunkSize = 1;
+			cases.push_back(smallChunks);
+
+			/* Deflate strategies, coded with tables built per block & with the precomputed table */
+			static const char* strategyNames[] = { "Default", "HuffmanOnly", "RLE" };
+			for (const DeflateStrategy strategy : { DeflateStrategy::HuffmanOnly, DeflateStrategy::RLE }) {
+				for (const bool precomputedCodes : { false, true }) {
+					EncoderCase coded = { string(strategyNames[(int)strategy]) + (precomputedCodes ? " precomputed codes" : "") };
+					coded.encode.strategy = strategy;
+					coded.encode.precomputedCodes = precomputedCodes;
+					cases.push_back(coded);
+				}
+			}
+
+			EncoderCase fastest = { "Fastest" };
+			fastest.encode = EncodeOptions::Fastest();
+			cases.push_back(fastest);
+
+			/* Strips of a row or a few rows, so images are split into several (compressed across threads, each primed with the data before it) */
+			for (const unsigned int level : { 0u, 6u, 9u }) {
+				for (const unsigned int stripSize : { 64u, 1024u }) {
+					EncoderCase strips = { to_string(stripSize) + " byte strips level " + to_string(level) };
+					strips.encode.level = level;
+					strips.encode.threads = 4;
+					strips.encode.stripSize = stripSize;
+					cases.push_back(strips);
+				}
+			}
+			return cases;
+		}
+
+		/* The decoded image, or an empty one (with the reason in error) if it isn't valid */
+		static ImageData Decode(const uint8_t* data, const size_t length, const ImageFormat target, string& error) {
+			PNGStream<span<const uint8_t>, Mode::Read> stream(data, length);
+			ImageOptions options = { .receiveInterlaced = false, .receiveAnimation = false, .target = target };
+			ImageData image;
+			if (!stream.ReadData(&image, &options).valid) {
+				error = stream.QueryState().err;
+				return {};
+			}
+			return image;
+		}
+
+		bool EncoderTest(std::ostream& out, const std::filesystem::path& directory) {
+			const vector<EncoderCase> cases = EncoderCases();
+			unsigned int images = 0;
+			unsigned int failures = 0;
+
+			out << "Encoder round trip test (" << cases.size() << " settings per image)\n";
+			for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+				if (entry.path().extension() != ".png") {
+					continue;
+				}
+				ifstream file(entry.path(), ios_base::binary);
+				const vector<uint8_t> bytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+				string error;
+				const ImageData original = Decode(bytes.data(), bytes.size(), {}, error);
+				if (original.image.empty()) {
+					continue; //the suite's deliberately broken files
+				}
+				images++;
+
+				const string fileName = entry.path().filename().generic_string();
+				PNGStream<vector<uint8_t>, Mode::Write> encoder;
+				for (const EncoderCase& encoderCase : cases) {
+					ImageOptions options = { .receiveInterlaced = false, .receiveAnimation = false };
+					options.encode = encoderCase.encode;
+					encoder.Reset();
+
+					string problem;
+					const ImageStreamState state = encoder.EncodeData(original, options);
+					if (state.hasError) {
+						problem = "encoding failed: " + state.err;
+					}
+					else {
+						/* Decoded to the original's format, as palettes come back as rgb8 or rgba8 (and opaque rgba8 loses its alpha without tRNS) */
+						const ImageData decoded = Decode(encoder.source.data(), encoder.source.size(), original.format, error);
+						if (decoded.image.empty()) {
+							problem = "decoding failed: " + error;
+						}
+						else if (decoded.dimensions.width != original.dimensions.width || decoded.dimensions.height != original.dimensions.height ||
+							decoded.format.formatting != original.format.formatting) {
+							problem = "decoded with a different size or format";
+						}
+						else if (decoded.image != original.image) {
+							problem = "decoded pixels differ";
+						}
+					}
+
+					if (!problem.empty()) {
+						out << "  FAIL " << fileName << " (" << encoderCase.name << "): " << problem << "\n";
+						failures++;
+					}
+				}
+			}
+
+			out << images << " images, " << images * cases.size() << " encodes, " << failures << " failed\n" << flush;
+			return failures == 0;
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <ostream>
+#include <filesystem>
+
+namespace ImageLibrary {
+	namespace PNG {
+		/* Decodes every png in directory, encodes it under each filter strategy at levels 0, 1 & 9, with a palette, in 1 byte IDAT chunks, with the HuffmanOnly & RLE strategies
+		(with & without precomputed codes), with EncodeOptions::Fastest, and in strips across threads; then decodes each result and checks it gives back the same pixels
+		Prints any failures, and returns whether everything passed
+		*/
+		bool EncoderTest(std::ostream& out, const std::filesystem::path& directory);
+	}
+}
\ No newline at end of file
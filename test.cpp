@@ -5,6 +5,9 @@
 
 #include <iostream>
 #include "png/png.h"
+#include "png/test/filter-benchmark.h"
+#include "png/test/test.h"
+#include "zlib/test/test.h"
 #include <filesystem>
 
 #include <thread>
@@ -84,6 +87,9 @@ void GetInput(std::shared_ptr<GLFWwindow> window) {
 			std::cout << "    Run test on all files from current directory (press Enter)\n";
 			std::cout << "    Run test on specific file from directory (cd [filename.ext])\n";
 			std::cout << "    Run test on specific file from any directory (cd [filepath/filename.ext])\n";
+			std::cout << "    Benchmark png unfiltering kernels (bench)\n";
+			std::cout << "    Test parallel & multi-member gzip inflate against sequential inflate (inflate)\n";
+			std::cout << "    Round trip every png in current directory through the encoder (encode)\n";
 			std::cout << "    Press ctrl+x and enter to exit\n" << std::endl;
 			run = true;
 		}
@@ -118,7 +124,17 @@ void GetInput(std::shared_ptr<GLFWwindow> window) {
 
 			std::string command = input.substr(0, 3);
 			std::string rest = input.substr(3, input.length() - 3);
-			if (command == "cd ") {
+			if (input == "bench") {
+				PNG::FilterBenchmark(std::cout);
+			}
+			else if (input == "inflate") {
+				zlib::ParallelInflateTest(std::cout);
+				zlib::GZIPMemberTest(std::cout);
+			}
+			else if (input == "encode") {
+				PNG::EncoderTest(std::cout, cwd);
+			}
+			else if (command == "cd ") {
 				abs = cwd / std::filesystem::path(rest);
 				abs = std::filesystem::absolute(abs);
 				if (!std::filesystem::exists(abs)) {
@@ -0,0 +1,59 @@
+#include "row-ring.h"
+
+namespace Generic {
+
+	RowRing::RowRing(const unsigned int slots, const size_t slotSize) : storage((size_t)slots * slotSize), slotSize(slotSize), slots(slots) {}
+
+	/* The signal is read before checking, so anything the consumer does after the check changes it and ends the wait */
+	uint8_t* RowRing::Acquire() {
+		const uint64_t row = published.load(std::memory_order_relaxed);
+		while (true) {
+			const uint32_t signal = toProducer.load(std::memory_order_acquire);
+			if (cancelled.load(std::memory_order_acquire)) {
+				return nullptr;
+			}
+			if (row - released.load(std::memory_order_acquire) < slots) {
+				return storage.data() + (row % slots) * slotSize;
+			}
+			toProducer.wait(signal, std::memory_order_acquire);
+		}
+	}
+
+	void RowRing::Publish() {
+		published.fetch_add(1, std::memory_order_release);
+		toConsumer.fetch_add(1, std::memory_order_release);
+		toConsumer.notify_one();
+	}
+
+	void RowRing::Close() {
+		closed.store(true, std::memory_order_release);
+		toConsumer.fetch_add(1, std::memory_order_release);
+		toConsumer.notify_one();
+	}
+
+	uint8_t* RowRing::Next() {
+		while (true) {
+			const uint32_t signal = toConsumer.load(std::memory_order_acquire);
+			const bool done = closed.load(std::memory_order_acquire); //read before published, so rows published before closing are seen
+			if (published.load(std::memory_order_acquire) > taken) {
+				return storage.data() + (taken++ % slots) * slotSize;
+			}
+			if (done) {
+				return nullptr;
+			}
+			toConsumer.wait(signal, std::memory_order_acquire);
+		}
+	}
+
+	void RowRing::Release() {
+		released.fetch_add(1, std::memory_order_release);
+		toProducer.fetch_add(1, std::memory_order_release);
+		toProducer.notify_one();
+	}
+
+	void RowRing::Cancel() {
+		cancelled.store(true, std::memory_order_release);
+		toProducer.fetch_add(1, std::memory_order_release);
+		toProducer.notify_one();
+	}
+}
\ No newline at end of file
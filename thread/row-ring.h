@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace Generic {
+	/* Lock-free single producer, single consumer ring of fixed-size row buffers, for handing rows from one pipeline stage (thread) to the next
+	The producer fills the slot from Acquire and then Publishes it; the consumer takes rows in order with Next, and Releases them oldest first
+	(so it can keep a row it has already taken, eg. the previous scanline, until it is done with it). Waiting uses atomic wait / notify rather than locks
+	*/
+	class RowRing {
+	private:
+		std::vector<uint8_t> storage;
+		size_t slotSize;
+		unsigned int slots;
+
+		/* Running counts of rows, the slot of row n being n % slots */
+		std::atomic<uint64_t> published = 0;
+		std::atomic<uint64_t> released = 0;
+		uint64_t taken = 0; //consumer only
+
+		std::atomic<bool> closed = false; //producer has no more rows
+		std::atomic<bool> cancelled = false; //consumer wants no more rows
+
+		/* Bumped on every change the other side may be waiting for (atomic wait only wakes on a changed value, and closing / cancelling changes no count) */
+		std::atomic<uint32_t> toConsumer = 0;
+		std::atomic<uint32_t> toProducer = 0;
+	public:
+		RowRing(const unsigned int slots, const size_t slotSize);
+
+		RowRing(const RowRing&) = delete;
+		RowRing& operator=(const RowRing&) = delete;
+
+		/* Producer: waits for a free slot; nullptr if the consumer cancelled */
+		uint8_t* Acquire();
+		void Publish();
+		void Close();
+
+		/* Consumer: waits for the next row; nullptr once the producer closes without one */
+		uint8_t* Next();
+		void Release();
+		void Cancel();
+	};
+}
\ No newline at end of file
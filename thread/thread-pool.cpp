@@ -0,0 +1,50 @@
+#include "thread-pool.h"
+
+namespace Generic {
+	static thread_local const ThreadPool* currentPool = nullptr; //pool the calling thread works for, if any
+
+	ThreadPool::ThreadPool(unsigned int threads) {
+		if (threads == 0) {
+			threads = std::thread::hardware_concurrency();
+			if (threads == 0) { threads = 1; } //hardware_concurrency is allowed to return 0 if unknown
+		}
+
+		workers.reserve(threads);
+		for (unsigned int i = 0; i < threads; i++) {
+			workers.emplace_back(&ThreadPool::Work, this);
+		}
+	}
+
+	ThreadPool::~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		available.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+
+	bool ThreadPool::IsWorker() const {
+		return currentPool == this;
+	}
+
+	/* Workers drain remaining tasks before exiting, so every future handed out is always satisfied */
+	void ThreadPool::Work() {
+		currentPool = this;
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				available.wait(guard, [this]() { return stopping || !tasks.empty(); });
+				if (tasks.empty()) {
+					return;
+				}
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+}
\ No newline at end of file
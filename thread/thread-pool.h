@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+namespace Generic {
+	/* Fixed-size pool of worker threads consuming tasks in submission order
+	Results come back through std::future, so callers can keep output ordered by waiting on the futures in the order they were submitted
+	*/
+	class ThreadPool {
+	private:
+		std::vector<std::thread> workers;
+		std::deque<std::function<void()>> tasks;
+		std::mutex lock;
+		std::condition_variable available;
+		bool stopping = false;
+	private:
+		void Work();
+	public:
+		/* 0 threads uses the hardware concurrency of the machine */
+		ThreadPool(unsigned int threads = 0);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		unsigned int Size() const { return (unsigned int)workers.size(); }
+
+		/* Whether the calling thread is one of this pool's workers, which must not wait on tasks of the same pool (they may be queued behind it) */
+		bool IsWorker() const;
+
+		template<typename Task>
+		auto Submit(Task&& task) -> std::future<decltype(task())> {
+			/* packaged_task is move-only, so it is shared to fit inside std::function */
+			auto packaged = std::make_shared<std::packaged_task<decltype(task())()>>(std::forward<Task>(task));
+			std::future<decltype(task())> result = packaged->get_future();
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				tasks.emplace_back([packaged]() { (*packaged)(); });
+			}
+			available.notify_one();
+			return result;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "work-stealing-pool.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Generic {
+
+	/* Set while a worker runs, so tasks submitted from inside a task go onto that worker's own queue */
+	static thread_local WorkStealingPool* currentPool = nullptr;
+	static thread_local unsigned int currentWorker = 0;
+
+	/* Pins the calling thread to one logical processor (left to the OS on platforms without an affinity call) */
+	static void PinCurrentThread(const unsigned int processor) {
+#if defined(_WIN32)
+		GROUP_AFFINITY group = {};
+		group.Group = (WORD)(processor / 64); //processors beyond the first 64 are in later groups
+		group.Mask = (KAFFINITY)1 << (processor % 64);
+		SetThreadGroupAffinity(GetCurrentThread(), &group, nullptr);
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(processor, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+	}
+
+	WorkStealingPool::WorkStealingPool(unsigned int threads, const std::vector<unsigned int>& affinity) : affinity(affinity) {
+		if (threads == 0) {
+			threads = std::thread::hardware_concurrency();
+			if (threads == 0) { threads = 1; } //hardware_concurrency is allowed to return 0 if unknown
+		}
+
+		queues.reserve(threads);
+		for (unsigned int i = 0; i < threads; i++) {
+			queues.push_back(std::make_unique<Queue>());
+		}
+
+		workers.reserve(threads);
+		for (unsigned int i = 0; i < threads; i++) {
+			workers.emplace_back(&WorkStealingPool::Work, this, i);
+		}
+	}
+
+	WorkStealingPool::~WorkStealingPool() {
+		{
+			std::lock_guard<std::mutex> guard(sleepLock);
+			stopping = true;
+		}
+		available.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+
+	void WorkStealingPool::Submit(Task task) {
+		/* Counted before it is queued (so the count never drops below zero when a worker takes it straight away),
+		and the sleep lock is passed through before notifying, so a worker about to sleep either sees the task or is woken for it
+		*/
+		queued.fetch_add(1, std::memory_order_release);
+
+		const unsigned int worker = currentPool == this ? currentWorker : nextQueue.fetch_add(1, std::memory_order_relaxed) % Size();
+		{
+			std::lock_guard<std::mutex> guard(queues[worker]->lock);
+			queues[worker]->tasks.push_back(std::move(task));
+		}
+		{
+			std::lock_guard<std::mutex> guard(sleepLock);
+		}
+		available.notify_one();
+	}
+
+	/* Own queue from the back, then every other queue from the front (starting with the next worker along, so thieves spread out) */
+	bool WorkStealingPool::Take(const unsigned int worker, Task& task) {
+		{
+			Queue& own = *queues[worker];
+			std::lock_guard<std::mutex> guard(own.lock);
+			if (!own.tasks.empty()) {
+				task = std::move(own.tasks.back());
+				own.tasks.pop_back();
+				return true;
+			}
+		}
+
+		for (unsigned int i = 1; i < Size(); i++) {
+			Queue& victim = *queues[(worker + i) % Size()];
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (!victim.tasks.empty()) {
+				task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/* Workers drain remaining tasks before exiting, so every submitted task always runs */
+	void WorkStealingPool::Work(const unsigned int worker) {
+		if (!affinity.empty()) {
+			PinCurrentThread(affinity[worker % affinity.size()]);
+		}
+		currentPool = this;
+		currentWorker = worker;
+
+		while (true) {
+			Task task;
+			if (Take(worker, task)) {
+				queued.fetch_sub(1, std::memory_order_relaxed);
+				task(worker);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> guard(sleepLock);
+			available.wait(guard, [this]() { return stopping || queued.load(std::memory_order_acquire) > 0; });
+			if (stopping && queued.load(std::memory_order_acquire) == 0) {
+				return;
+			}
+		}
+	}
+}
\ No newline at end of file
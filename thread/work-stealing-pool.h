@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+
+namespace Generic {
+	/* Pool of worker threads where each worker has its own queue of tasks, and steals from the others once it runs out
+	Tasks submitted from outside are dealt to the queues in turn, and tasks submitted from a worker go onto that worker's own queue
+	Workers take their own newest task first (still warm in cache) and steal the oldest task of another, so uneven tasks (eg. images of very different sizes) even out
+	without every worker contending on one queue as ThreadPool does
+	*/
+	class WorkStealingPool {
+	public:
+		/* Given the index of the worker running it (0 to Size() - 1), eg. to use that worker's own state */
+		using Task = std::function<void(const unsigned int worker)>;
+	private:
+		struct Queue {
+			std::mutex lock;
+			std::deque<Task> tasks;
+		};
+		std::vector<std::unique_ptr<Queue>> queues; //one per worker
+		std::vector<std::thread> workers;
+		std::vector<unsigned int> affinity;
+
+		/* Workers with nothing to run or steal sleep until a task is submitted */
+		std::mutex sleepLock;
+		std::condition_variable available;
+		std::atomic<size_t> queued = 0; //tasks submitted but not yet taken
+		bool stopping = false;
+
+		std::atomic<unsigned int> nextQueue = 0;
+	private:
+		void Work(const unsigned int worker);
+		bool Take(const unsigned int worker, Task& task);
+	public:
+		/* 0 threads uses the hardware concurrency of the machine
+		If affinity is given, worker i only runs on logical processor affinity[i % affinity.size()] (eg. to keep each worker & the memory it touches first on one NUMA node)
+		*/
+		WorkStealingPool(unsigned int threads = 0, const std::vector<unsigned int>& affinity = {});
+		~WorkStealingPool();
+
+		WorkStealingPool(const WorkStealingPool&) = delete;
+		WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+		/* From the queues, which are all made before any worker starts (workers is still growing while the first workers run) */
+		unsigned int Size() const { return (unsigned int)queues.size(); }
+
+		void Submit(Task task);
+	};
+}
\ No newline at end of file
@@ -0,0 +1,1027 @@
+#include "zlib.h"
+#include "../cpu/cpu.h"
+#include <algorithm>
+#include <bit>
+
+using namespace Generic;
+using namespace Generic::cpu;
+using namespace std;
+
+namespace ImageLibrary {
+	namespace zlib {
+		/* Same parameters as zlib uses for each level */
+		static const DeflateLevel levels[10] = {
+			{ 0, 0, 0, 0, false }, //stored only
+			{ 4, 4, 8, 4, false },
+			{ 4, 5, 16, 8, false },
+			{ 4, 6, 32, 32, false },
+			{ 4, 4, 16, 16, true },
+			{ 8, 16, 32, 32, true },
+			{ 8, 16, 128, 128, true },
+			{ 8, 32, 128, 256, true },
+			{ 32, 128, 258, 1024, true },
+			{ 32, 258, 258, 4096, true },
+		};
+
+		/* Length code (symbol 257 + code) of each match length - 3 */
+		static constexpr std::array<uint8_t, 256> lengthCodes{ []() consteval {
+			std::array<uint8_t, 256> result{};
+			for (int code = 0; code < 29; code++) {
+				const int end = code < 28 ? lens[code + 1] : 259;
+				for (int length = lens[code]; length < end; length++) {
+					result[length - 3] = (uint8_t)code;
+				}
+			}
+			return result;
+		}() };
+
+		/* Distance code of distance - 1 up to 256 (near), and of (distance - 1) >> 7 beyond that (far), since every code past 16 spans a multiple of 128 */
+		static constexpr uint8_t DistanceCodeOf(const int distance) {
+			int code = 0;
+			while (code < 29 && dists[code + 1] <= distance) {
+				code++;
+			}
+			return (uint8_t)code;
+		}
+		static constexpr std::array<uint8_t, 256> nearDistanceCodes{ []() consteval {
+			std::array<uint8_t, 256> result{};
+			for (int i = 0; i < 256; i++) {
+				result[i] = DistanceCodeOf(i + 1);
+			}
+			return result;
+		}() };
+		static constexpr std::array<uint8_t, 256> farDistanceCodes{ []() consteval {
+			std::array<uint8_t, 256> result{};
+			for (int i = 2; i < 256; i++) {
+				result[i] = DistanceCodeOf((i << 7) + 1);
+			}
+			return result;
+		}() };
+
+		static inline unsigned int DistanceCode(const unsigned int distance) {
+			return distance <= 256 ? nearDistanceCodes[distance - 1] : farDistanceCodes[(distance - 1) >> 7];
+		}
+
+		/* The static codes (RFC 1951 3.2.6), as BuildCodes gives them */
+		struct StaticCodes {
+			uint8_t literalLengths[FIXLCODES];
+			uint16_t literalCodes[FIXLCODES];
+			uint8_t distanceLengths[MAXDCODES];
+			uint16_t distanceCodes[MAXDCODES];
+		};
+		static StaticCodes BuildStaticCodes() {
+			StaticCodes codes;
+			for (int i = 0; i < FIXLCODES; i++) {
+				codes.literalLengths[i] = (uint8_t)staticLengths[i];
+			}
+			for (int i = 0; i < MAXDCODES; i++) {
+				codes.distanceLengths[i] = (uint8_t)staticDistances[i];
+			}
+			huffman::BuildCodes(codes.literalLengths, FIXLCODES, codes.literalCodes);
+			huffman::BuildCodes(codes.distanceLengths, MAXDCODES, codes.distanceCodes);
+			return codes;
+		}
+		static const StaticCodes staticCodes = BuildStaticCodes();
+
+		/* Order the code length code lengths are sent in (RFC 1951 3.2.7) */
+		static const uint8_t codeLengthOrder[MAXCODELENGTHS] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+		static const uint8_t codeLengthExtra[MAXCODELENGTHS] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7 };
+
+		/* What a dynamic block sends before its data: how many literal/length & distance codes there are, and their code lengths as one sequence,
+		run-length encoded with codes 16 (repeat the last 3 - 6 times), 17 (3 - 10 zeros) & 18 (11 - 138 zeros) that have a code of their own
+		*/
+		struct DynamicHeader {
+			unsigned int literalCount = 0;
+			unsigned int distanceCount = 0;
+			unsigned int codeLengthCount = 0;
+			uint8_t runs[MAXCODES] = {};
+			uint8_t runExtra[MAXCODES] = {};
+			unsigned int runCount = 0;
+			uint8_t codeLengthLengths[MAXCODELENGTHS] = {};
+			uint16_t codeLengthCodes[MAXCODELENGTHS] = {};
+			uint64_t bits = 0; //after the block type
+		};
+		static DynamicHeader BuildDynamicHeader(const uint8_t* literalLengths, const uint8_t* distanceLengths) {
+			DynamicHeader header;
+			header.literalCount = MAXLCODES;
+			while (header.literalCount > 257 && literalLengths[header.literalCount - 1] == 0) {
+				header.literalCount--;
+			}
+			header.distanceCount = MAXDCODES;
+			while (header.distanceCount > 1 && distanceLengths[header.distanceCount - 1] == 0) {
+				header.distanceCount--;
+			}
+
+			uint8_t sequence[MAXCODES];
+			memcpy(sequence, literalLengths, header.literalCount);
+			memcpy(sequence + header.literalCount, distanceLengths, header.distanceCount);
+			const unsigned int total = header.literalCount + header.distanceCount;
+
+			uint32_t codeLengthFrequencies[MAXCODELENGTHS] = {};
+			auto run = [&](const uint8_t symbol, const uint8_t extra) {
+				header.runs[header.runCount] = symbol;
+				header.runExtra[header.runCount++] = extra;
+				codeLengthFrequencies[symbol]++;
+			};
+			for (unsigned int i = 0; i < total;) {
+				const uint8_t value = sequence[i];
+				unsigned int repeat = 1;
+				while (i + repeat < total && sequence[i + repeat] == value) {
+					repeat++;
+				}
+				i += repeat;
+
+				if (value == 0) {
+					while (repeat >= 11) {
+						const unsigned int amount = min(repeat, 138u);
+						run(18, (uint8_t)(amount - 11));
+						repeat -= amount;
+					}
+					if (repeat >= 3) {
+						run(17, (uint8_t)(repeat - 3));
+						repeat = 0;
+					}
+				}
+				else {
+					run(value, 0);
+					repeat--;
+					while (repeat >= 3) {
+						const unsigned int amount = min(repeat, 6u);
+						run(16, (uint8_t)(amount - 3));
+						repeat -= amount;
+					}
+				}
+				for (; repeat > 0; repeat--) {
+					run(value, 0);
+				}
+			}
+
+			huffman::BuildLengths(codeLengthFrequencies, MAXCODELENGTHS, 7, header.codeLengthLengths);
+			huffman::BuildCodes(header.codeLengthLengths, MAXCODELENGTHS, header.codeLengthCodes);
+			header.codeLengthCount = MAXCODELENGTHS;
+			while (header.codeLengthCount > 4 && header.codeLengthLengths[codeLengthOrder[header.codeLengthCount - 1]] == 0) {
+				header.codeLengthCount--;
+			}
+
+			header.bits = 5 + 5 + 4 + 3 * header.codeLengthCount;
+			for (unsigned int i = 0; i < MAXCODELENGTHS; i++) {
+				header.bits += (uint64_t)codeLengthFrequencies[i] * (header.codeLengthLengths[i] + codeLengthExtra[i]);
+			}
+			return header;
+		}
+
+		/* The one table every block is coded with under precomputed codes, made for filtered image data: the nearer a byte is to 0 (either way) the shorter its code,
+		with a floor so that no literal takes more than 10 bits; runs get shorter codes the shorter they are, and distance 1 is the only distance used
+		*/
+		struct PrecomputedCodes {
+			uint8_t literalLengths[MAXLCODES];
+			uint16_t literalCodes[MAXLCODES];
+			uint8_t distanceLengths[MAXDCODES];
+			uint16_t distanceCodes[MAXDCODES];
+			DynamicHeader header;
+
+			/* Length code, its extra bits & the distance code of each run length from 3, put together to be written at once */
+			uint32_t runCodes[259];
+			uint8_t runLengths[259];
+		};
+		static PrecomputedCodes BuildPrecomputedCodes() {
+			PrecomputedCodes codes;
+			uint32_t literalFrequencies[MAXLCODES] = {};
+			const uint32_t floor = (1 << 20) * 3 / 100;
+			uint32_t weight = 1 << 20;
+			for (int difference = 0; difference <= 128; difference++) {
+				literalFrequencies[difference] = weight + floor;
+				literalFrequencies[(256 - difference) & 0xFF] = weight + floor;
+				weight = weight * 4 / 5;
+			}
+			literalFrequencies[0] *= 10;
+			literalFrequencies[256] = 1;
+			weight = (1 << 20) / 10;
+			for (int code = 0; code < 28; code++) {
+				literalFrequencies[257 + code] = weight;
+				weight = weight * 9 / 10;
+			}
+			literalFrequencies[285] = (1 << 20) / 20; //258, the longest
+			const uint32_t distanceFrequencies[MAXDCODES] = { 1, 1 }; //a code can't be alone
+
+			huffman::BuildLengths(literalFrequencies, MAXLCODES, 15, codes.literalLengths);
+			huffman::BuildLengths(distanceFrequencies, MAXDCODES, 15, codes.distanceLengths);
+			huffman::BuildCodes(codes.literalLengths, MAXLCODES, codes.literalCodes);
+			huffman::BuildCodes(codes.distanceLengths, MAXDCODES, codes.distanceCodes);
+			codes.header = BuildDynamicHeader(codes.literalLengths, codes.distanceLengths);
+
+			for (int length = 0; length < 3; length++) {
+				codes.runCodes[length] = 0;
+				codes.runLengths[length] = 0;
+			}
+			for (int length = 3; length <= 258; length++) {
+				const int code = lengthCodes[length - 3];
+				const int symbol = 257 + code;
+				uint32_t bits = codes.literalCodes[symbol];
+				int count = codes.literalLengths[symbol];
+				bits |= (uint32_t)(length - lens[code]) << count;
+				count += lext[code];
+				bits |= (uint32_t)codes.distanceCodes[0] << count;
+				count += codes.distanceLengths[0];
+				codes.runCodes[length] = bits;
+				codes.runLengths[length] = (uint8_t)count;
+			}
+			return codes;
+		}
+		static const PrecomputedCodes precomputedCodes = BuildPrecomputedCodes();
+
+		/* Codes the literals from..to with the precomputed codes (at most 10 bits each) into out, 4 to a code, carrying the bits short of a whole byte; returns the bytes stored
+Whole bytes are stored 8 at a time after each code without a branch, so out needs 8 bytes of room past what is returned
+*/
+		IMAGELIB_INLINE static unsigned int CodeLiterals(const uint8_t* from, const uint8_t* to, uint8_t* out, uint64_t& pendingBits, unsigned int& pendingCount) {
+			const uint16_t* codes = precomputedCodes.literalCodes;
+			const uint8_t* lengths = precomputedCodes.literalLengths;
+			uint64_t bits = pendingBits;
+			unsigned int count = pendingCount;
+			unsigned int used = 0;
+			auto put = [&](const uint64_t code, const unsigned int codeLength) {
+				bits |= code << count;
+				count += codeLength;
+				memcpy(out + used, &bits, 8);
+				used += count >> 3;
+				bits >>= count & ~7u;
+				count &= 7;
+			};
+			for (; from + 4 <= to; from += 4) {
+				const unsigned int first = lengths[from[0]] + lengths[from[1]];
+				const uint64_t low = codes[from[0]] | (uint64_t)codes[from[1]] << lengths[from[0]];
+				const uint64_t high = codes[from[2]] | (uint64_t)codes[from[3]] << lengths[from[2]];
+				put(low | high << first, first + lengths[from[2]] + lengths[from[3]]);
+			}
+			for (; from < to; from++) {
+				put(codes[*from], lengths[*from]);
+			}
+			pendingBits = bits;
+			pendingCount = count;
+			return used;
+		}
+
+		typedef unsigned int(*LiteralFunction)(const uint8_t* from, const uint8_t* to, uint8_t* out, uint64_t& pendingBits, unsigned int& pendingCount);
+
+		static unsigned int CodeLiteralsScalar(const uint8_t* from, const uint8_t* to, uint8_t* out, uint64_t& pendingBits, unsigned int& pendingCount) {
+			return CodeLiterals(from, to, out, pendingBits, pendingCount);
+		}
+
+#if IMAGELIB_X86
+		/* The same loop with shlx / shrx, whose variable shifts don't wait on the flags (the shifts being most of the work) */
+		IMAGELIB_TARGET("bmi2") static unsigned int CodeLiteralsBMI2(const uint8_t* from, const uint8_t* to, uint8_t* out, uint64_t& pendingBits, unsigned int& pendingCount) {
+			return CodeLiterals(from, to, out, pendingBits, pendingCount);
+		}
+#endif
+
+		static LiteralFunction SelectLiterals() {
+#if IMAGELIB_X86
+			if (GetSIMDLevel() >= SIMDLevel::AVX2 && GetFeatures().bmi2) {
+				return CodeLiteralsBMI2;
+			}
+#endif
+			return CodeLiteralsScalar;
+		}
+		static const LiteralFunction literalKernel = SelectLiterals();
+
+		/* Bytes from p equal to byte, up to limit, compared 8 at a time */
+		static inline unsigned int RunLength(const uint8_t* p, const uint8_t byte, const unsigned int limit) {
+			const uint64_t pattern = 0x0101010101010101ull * byte;
+			unsigned int length = 0;
+			while (length + 8 <= limit) {
+				uint64_t word;
+				memcpy(&word, p + length, 8);
+				if (word != pattern) {
+					return length + (countr_zero(word ^ pattern) >> 3);
+				}
+				length += 8;
+			}
+			while (length < limit && p[length] == byte) {
+				length++;
+			}
+			return length;
+		}
+
+		template<typename Backing>
+		ZLIBStream<Backing, Mode::Write>::ZLIBStream(Data<Backing, uint8_t, Mode::Write>* destination, const unsigned int level, const Format format) :
+			dest(destination), format(format) {
+			checksum = format == Format::GZIP ? 0 : 1;
+			source.resize(2 * sliding_32k + max_match); //slack past the window lets matches be compared 8 bytes at a time without checking for its end
+			SetLevel(level);
+		}
+
+		/* The hash chains are only allocated once a level needs them */
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::SetLevel(const unsigned int level) {
+			this->level = level > 9 ? 9 : level;
+			config = levels[this->level];
+			if (this->level > 0 && head.empty()) {
+				head.resize(1 << hash_bits);
+				chain.resize(sliding_32k);
+				symbols.reserve(max_symbols);
+			}
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::SetStrategy(const Strategy strategy, const bool precomputedCodes) {
+			this->strategy = strategy;
+			precomputed = precomputedCodes;
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::Reset(Data<Backing, uint8_t, Mode::Write>* destination) {
+			if (destination != nullptr) {
+				dest.dest = destination;
+			}
+			dest.Reset();
+
+			filled = 0;
+			position = 0;
+			blockStart = 0;
+			blockLength = 0;
+			fill(head.begin(), head.end(), 0); //chain entries are only reached through head, so they needn't be cleared
+
+			matchAvailable = false;
+			prevLength = min_match - 1;
+			prevDistance = 0;
+
+			symbols.clear();
+			memset(literalFrequencies, 0, sizeof(literalFrequencies));
+			memset(distanceFrequencies, 0, sizeof(distanceFrequencies));
+
+			blockOpen = false;
+			hasLast = false;
+			lastByte = 0;
+			run = 0;
+
+			started = false;
+			finished = false;
+			hasDictionary = false;
+			dictionaryId = 0;
+			checksum = format == Format::GZIP ? 0 : 1;
+			totalIn = 0;
+		}
+
+		void ZLIBHeader(uint8_t* out, const unsigned int level, const bool dictionary) {
+			const unsigned int compressionLevel = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+			unsigned int header = 0x78 << 8 | compressionLevel << 6 | (dictionary ? 0x20 : 0); //deflate with a 32K window
+			header += (31 - header % 31) % 31;
+			out[0] = (uint8_t)(header >> 8);
+			out[1] = (uint8_t)header;
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::WriteHeader() {
+			started = true;
+			if (format == Format::ZLIB) {
+				uint8_t bytes[6];
+				ZLIBHeader(bytes, level, hasDictionary);
+				bytes[2] = (uint8_t)(dictionaryId >> 24);
+				bytes[3] = (uint8_t)(dictionaryId >> 16);
+				bytes[4] = (uint8_t)(dictionaryId >> 8);
+				bytes[5] = (uint8_t)dictionaryId;
+				dest.WriteBytes(bytes, hasDictionary ? 6 : 2);
+			}
+			else if (format == Format::GZIP) {
+				const uint8_t extraFlags = level == 9 ? 2 : level == 1 ? 4 : 0;
+				const uint8_t bytes[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, extraFlags, 255 }; //no name or modification time, unknown OS
+				dest.WriteBytes(bytes, 10);
+			}
+		}
+
+		/* The dictionary is placed as if it had just been compressed, so nothing but the hash chains needs to know about it */
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::SetDictionary(const uint8_t* dictionary, unsigned int length) {
+			if (started || filled > 0) {
+				throw exception("[ZLIB] Dictionary set after writing!");
+			}
+			if (format == Format::GZIP) {
+				throw exception("[ZLIB] gzip streams can't have a dictionary!");
+			}
+			if (length == 0) {
+				return;
+			}
+			if (format == Format::ZLIB) {
+				hasDictionary = true;
+				dictionaryId = checksum::Adler32(dictionary, length);
+			}
+			if (length > sliding_32k) {
+				dictionary += length - sliding_32k;
+				length = sliding_32k;
+			}
+
+			memcpy(source.data(), dictionary, length);
+			filled = length;
+			position = length;
+			blockStart = length;
+			hasLast = true;
+			lastByte = dictionary[length - 1];
+			if (level > 0 && strategy == Strategy::Default) {
+				for (unsigned int at = 1; at + min_match <= length; at++) {
+					Insert(at); //position 0 can't be told from the end of a chain
+				}
+			}
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::WriteTrailer() {
+			if (format == Format::ZLIB) {
+				const uint8_t bytes[4] = { (uint8_t)(checksum >> 24), (uint8_t)(checksum >> 16), (uint8_t)(checksum >> 8), (uint8_t)checksum };
+				dest.WriteBytes(bytes, 4);
+			}
+			else if (format == Format::GZIP) {
+				const uint32_t size = (uint32_t)totalIn;
+				const uint8_t bytes[8] = { (uint8_t)checksum, (uint8_t)(checksum >> 8), (uint8_t)(checksum >> 16), (uint8_t)(checksum >> 24),
+					(uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16), (uint8_t)(size >> 24) };
+				dest.WriteBytes(bytes, 8);
+			}
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::UpdateChecksum(const uint8_t* in, const unsigned int length) {
+			if (format == Format::GZIP) {
+				checksum = checksum::CRC32(in, length, checksum);
+			}
+			else {
+				checksum = checksum::Adler32(in, length, checksum);
+			}
+			totalIn += length;
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::Write(const uint8_t* in, const unsigned int length) {
+			if (finished) {
+				throw exception("[ZLIB] Writing to a finished stream!");
+			}
+			if (!started) {
+				WriteHeader();
+			}
+			UpdateChecksum(in, length);
+			if (Direct()) {
+				CodeDirect(in, length);
+				return;
+			}
+
+			const unsigned int windowSize = 2 * sliding_32k;
+			unsigned int remaining = length;
+			while (remaining > 0) {
+				if (filled == windowSize) {
+					Slide();
+				}
+				const unsigned int amount = min(remaining, windowSize - filled);
+				memcpy(source.data() + filled, in, amount);
+				filled += amount;
+				in += amount;
+				remaining -= amount;
+				Compress(false);
+			}
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::Flush() {
+			if (finished) {
+				return;
+			}
+			if (!started) {
+				WriteHeader();
+			}
+			if (Direct()) {
+				EndDirectBlock();
+			}
+			else {
+				Compress(true);
+				if (blockLength > 0) {
+					EndBlock(false);
+				}
+			}
+			EmptyStoredBlock();
+			dest.Flush();
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::Finish() {
+			if (finished) {
+				return;
+			}
+			if (!started) {
+				WriteHeader();
+			}
+			if (Direct()) {
+				EndDirectBlock();
+				dest.WriteBits(1, 1); //an empty final block, as the last block was begun without knowing it would be
+				dest.WriteBits((unsigned int)BlockType::Static, 2);
+				dest.WriteBits(staticCodes.literalCodes[256], staticCodes.literalLengths[256]);
+			}
+			else {
+				Compress(true);
+				EndBlock(true);
+			}
+			dest.AlignToByte();
+			WriteTrailer();
+			dest.Flush();
+			finished = true;
+		}
+
+		/* The upper half of the window moves down once the window is full (compression stops short of the end, so everything in the lower half has been compressed)
+		The block being built is written first if it started in the lower half, since a stored block needs all of its data
+		*/
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::Slide() {
+			if (blockStart < sliding_32k && blockLength > 0) {
+				EndBlock(false);
+			}
+			memmove(source.data(), source.data() + sliding_32k, filled - sliding_32k);
+			filled -= sliding_32k;
+			position -= sliding_32k;
+			blockStart -= sliding_32k;
+
+			for (uint16_t& entry : head) {
+				entry = entry >= sliding_32k ? entry - sliding_32k : 0;
+			}
+			for (uint16_t& entry : chain) {
+				entry = entry >= sliding_32k ? entry - sliding_32k : 0;
+			}
+		}
+
+		/* Unless flushing, stops while there is still room for the longest match ahead, so that matches found don't depend on how the input was split into writes */
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::Compress(const bool flush) {
+			if (level == 0) {
+				CompressStored();
+			}
+			else if (strategy == Strategy::HuffmanOnly) {
+				CompressHuffman();
+			}
+			else if (strategy == Strategy::RLE) {
+				CompressRLE(flush);
+			}
+			else if (config.lazyMatching) {
+				CompressLazy(flush);
+			}
+			else {
+				CompressGreedy(flush);
+			}
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::CompressStored() {
+			blockLength += filled - position;
+			position = filled;
+		}
+
+		/* Adds position at to its hash chain, returning the previous position with the same hash (0 if none); needs 3 bytes from at */
+		template<typename Backing>
+		unsigned int ZLIBStream<Backing, Mode::Write>::Insert(const unsigned int at) {
+			const uint8_t* bytes = source.data() + at;
+			const uint32_t value = bytes[0] | bytes[1] << 8 | bytes[2] << 16;
+			const unsigned int hash = (value * 2654435761u) >> (32 - hash_bits);
+			const unsigned int previous = head[hash];
+			chain[at & clamp_32k] = (uint16_t)previous;
+			head[hash] = (uint16_t)at;
+			return previous;
+		}
+
+		/* Follows the hash chain from candidate for a match at position longer than best, returning its length (best if none is longer) and setting distance
+		Candidates are compared 8 bytes at a time, the first differing byte being found from the lowest set bit of their xor
+		*/
+		template<typename Backing>
+		unsigned int ZLIBStream<Backing, Mode::Write>::LongestMatch(unsigned int candidate, unsigned int best, unsigned int& distance) const {
+			const unsigned int maxLength = min(max_match, filled - position);
+			if (best >= maxLength) {
+				return best;
+			}
+			const unsigned int nice = min<unsigned int>(config.nice, maxLength);
+			const unsigned int limit = position > sliding_32k ? position - sliding_32k : 0;
+			unsigned int chainLeft = best >= config.good ? config.chain >> 2 : config.chain;
+
+			const uint8_t* scan = source.data() + position;
+			while (candidate != 0 && candidate >= limit && chainLeft-- > 0) {
+				const uint8_t* match = source.data() + candidate;
+				if (match[best] == scan[best] && match[0] == scan[0] && match[1] == scan[1]) {
+					unsigned int length = 0;
+					while (length < maxLength) {
+						uint64_t a, b;
+						memcpy(&a, scan + length, 8);
+						memcpy(&b, match + length, 8);
+						if (a != b) {
+							length += countr_zero(a ^ b) >> 3;
+							break;
+						}
+						length += 8;
+					}
+					length = min(length, maxLength);
+
+					if (length > best) {
+						best = length;
+						distance = position - candidate;
+						if (length >= nice) {
+							break;
+						}
+					}
+				}
+
+				const unsigned int next = chain[candidate & clamp_32k];
+				if (next >= candidate) {
+					break; //the slot was reused by a later position, so the rest of this chain is gone
+				}
+				candidate = next;
+			}
+			return best;
+		}
+
+		/* Takes the longest match at each position; the positions inside short matches are hashed too, while longer ones are skipped over */
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::CompressGreedy(const bool flush) {
+			while (true) {
+				const unsigned int available = filled - position;
+				if (available == 0 || (!flush && available < min_lookahead)) {
+					break;
+				}
+
+				unsigned int length = 0;
+				unsigned int distance = 0;
+				if (available >= min_match) {
+					const unsigned int candidate = Insert(position);
+					if (candidate != 0) {
+						length = LongestMatch(candidate, min_match - 1, distance);
+					}
+				}
+
+				if (length >= min_match) {
+					Match(length, distance);
+					if (length <= config.lazy) {
+						for (unsigned int at = position + 1; at < position + length && at + min_match <= filled; at++) {
+							Insert(at);
+						}
+					}
+					position += length;
+				}
+				else {
+					Literal(source[position]);
+					position++;
+				}
+
+				if (symbols.size() >= max_symbols) {
+					EndBlock(false);
+				}
+			}
+		}
+
+		/* A match is held back for a position, and dropped for a literal if the next position has a longer one (as zlib's deflate_slow) */
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::CompressLazy(const bool flush) {
+			while (true) {
+				const unsigned int available = filled - position;
+				if (available == 0 || (!flush && available < min_lookahead)) {
+					break;
+				}
+
+				const unsigned int candidate = available >= min_match ? Insert(position) : 0;
+				unsigned int length = min_match - 1;
+				unsigned int distance = 0;
+				if (candidate != 0 && prevLength < config.lazy) {
+					length = LongestMatch(candidate, prevLength, distance);
+					if (length == prevLength) {
+						length = min_match - 1; //nothing longer than the held match
+					}
+					else if (length == min_match && distance > too_far) {
+						length = min_match - 1;
+					}
+				}
+
+				if (prevLength >= min_match && length <= prevLength) {
+					const unsigned int end = position - 1 + prevLength;
+					Match(prevLength, prevDistance);
+					for (unsigned int at = position + 1; at < end && at + min_match <= filled; at++) {
+						Insert(at); //position - 1 and position are already in the chains
+					}
+					position = end;
+					matchAvailable = false;
+					prevLength = min_match - 1;
+				}
+				else {
+					if (matchAvailable) {
+						Literal(source[position - 1]);
+					}
+					matchAvailable = true;
+					prevLength = length;
+					prevDistance = distance;
+					position++;
+				}
+
+				if (symbols.size() >= max_symbols) {
+					EndBlock(false);
+				}
+			}
+
+			if (flush && matchAvailable) {
+				Literal(source[position - 1]);
+				matchAvailable = false;
+				prevLength = min_match - 1;
+			}
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::CompressHuffman() {
+			while (position < filled) {
+				Literal(source[position]);
+				position++;
+				if (symbols.size() >= max_symbols) {
+					EndBlock(false);
+				}
+			}
+		}
+
+		/* Runs of the byte before are the only matches, as zlib's deflate_rle */
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::CompressRLE(const bool flush) {
+			while (true) {
+				const unsigned int available = filled - position;
+				if (available == 0 || (!flush && available < max_match)) {
+					break;
+				}
+
+				unsigned int length = 0;
+				if (position > 0 && available >= min_match) {
+					length = RunLength(source.data() + position, source[position - 1], min(available, max_match));
+				}
+				if (length >= min_match) {
+					Match(length, 1);
+					position += length;
+				}
+				else {
+					Literal(source[position]);
+					position++;
+				}
+
+				if (symbols.size() >= max_symbols) {
+					EndBlock(false);
+				}
+			}
+		}
+
+		/* A run of byte ended: coded as a match unless as many literals take fewer bits (short runs of 0 are cheaper as literals) */
+		template<typename Put>
+		static inline void CodeRun(unsigned int& run, const uint8_t byte, Put&& put) {
+			const unsigned int literalLength = precomputedCodes.literalLengths[byte];
+			if (run >= 3 && precomputedCodes.runLengths[run] < run * literalLength) {
+				put(precomputedCodes.runCodes[run], precomputedCodes.runLengths[run]);
+			}
+			else {
+				for (; run > 0; run--) {
+					put(precomputedCodes.literalCodes[byte], literalLength);
+				}
+			}
+			run = 0;
+		}
+
+		/* Runs are held back until they end (or reach the longest match), so a run split between writes is still coded as one
+		Bits are gathered in locals and the whole bytes stored 8 at a time after each code, without a branch; literals go through the fastest CodeLiterals the CPU runs
+		*/
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::CodeDirect(const uint8_t* in, const unsigned int length) {
+			if (!blockOpen) {
+				WriteDynamicHeader(precomputedCodes.header, false);
+				blockOpen = true;
+			}
+
+			constexpr unsigned int staged_size = 4096;
+			constexpr unsigned int literal_chunk = 2048;
+			uint8_t staged[staged_size + 8];
+			unsigned int used = 0;
+			uint64_t bits = 0;
+			unsigned int count = dest.TakeBits(bits);
+			auto put = [&](const uint64_t code, const unsigned int codeLength) {
+				bits |= code << count;
+				count += codeLength;
+				memcpy(staged + used, &bits, 8);
+				used += count >> 3;
+				bits >>= count & ~7u;
+				count &= 7;
+			};
+			auto stage = [&]() {
+				if (used >= staged_size - literal_chunk * 10 / 8 - 8) { //room for a chunk of literals, or a run
+					dest.WriteBytes(staged, used);
+					used = 0;
+				}
+			};
+			auto literals = [&](const uint8_t* from, const uint8_t* to) {
+				while (from < to) {
+					const uint8_t* chunk = from + min<size_t>(to - from, literal_chunk);
+					used += literalKernel(from, chunk, staged + used, bits, count);
+					from = chunk;
+					stage();
+				}
+			};
+			put(0, 0); //bits taken from dest can be up to 31
+
+			const uint8_t* end = in + length;
+			if (strategy == Strategy::HuffmanOnly) {
+				literals(in, end);
+			}
+			else {
+				uint8_t last = lastByte;
+				bool haveLast = hasLast;
+				unsigned int pending = run;
+				while (in < end) {
+					if (haveLast && *in == last) {
+						const unsigned int repeats = RunLength(in, last, (unsigned int)min<size_t>(end - in, max_match - pending));
+						pending += repeats;
+						in += repeats;
+						if (pending == max_match) {
+							CodeRun(pending, last, put);
+							stage();
+						}
+						continue;
+					}
+					CodeRun(pending, last, put);
+					stage();
+
+					/* Literals up to where a run of at least 3 starts (shorter runs are coded as literals anyway), found 8 positions at a time from the zero bytes in
+					the xors of the bytes with those one back; runs that might carry on into the next write are left to the run path
+					*/
+					const uint8_t* stop = in + 1;
+					while (stop + 10 <= end) {
+						uint64_t before, here, next, after;
+						memcpy(&before, stop - 1, 8);
+						memcpy(&here, stop, 8);
+						memcpy(&next, stop + 1, 8);
+						memcpy(&after, stop + 2, 8);
+						const uint64_t difference = (here ^ before) | (next ^ here) | (after ^ next);
+						const uint64_t zeros = (difference - 0x0101010101010101ull) & ~difference & 0x8080808080808080ull;
+						if (zeros != 0) {
+							stop += countr_zero(zeros) >> 3;
+							break;
+						}
+						stop += 8;
+					}
+					while (stop < end && !(*stop == stop[-1] && (stop + 1 == end || (stop[1] == *stop && (stop + 2 == end || stop[2] == *stop))))) {
+						stop++;
+					}
+					literals(in, stop);
+					last = stop[-1];
+					haveLast = true;
+					in = stop;
+				}
+				lastByte = last;
+				hasLast = haveLast;
+				run = pending;
+			}
+			dest.WriteBytes(staged, used);
+			dest.WriteBits((uint32_t)bits, count);
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::EndDirectBlock() {
+			if (blockOpen) {
+				CodeRun(run, lastByte, [this](const uint32_t code, const unsigned int codeLength) {
+					dest.WriteBits(code, codeLength);
+				});
+				dest.WriteBits(precomputedCodes.literalCodes[256], precomputedCodes.literalLengths[256]);
+				blockOpen = false;
+			}
+		}
+
+		template<typename Backing>
+		inline void ZLIBStream<Backing, Mode::Write>::Literal(const uint8_t byte) {
+			symbols.push_back(byte);
+			literalFrequencies[byte]++;
+			blockLength++;
+		}
+
+		template<typename Backing>
+		inline void ZLIBStream<Backing, Mode::Write>::Match(const unsigned int length, const unsigned int distance) {
+			symbols.push_back(distance << 16 | (length - min_match));
+			literalFrequencies[257 + lengthCodes[length - min_match]]++;
+			distanceFrequencies[DistanceCode(distance)]++;
+			blockLength += length;
+		}
+
+		/* The block is sized for each of the three ways it could be written, and written the smallest way */
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::EndBlock(const bool last) {
+			if (level == 0) {
+				WriteStored(source.data() + blockStart, blockLength, last);
+				blockStart += blockLength;
+				blockLength = 0;
+				return;
+			}
+
+			literalFrequencies[256] = 1; //end of block
+			uint8_t literalLengths[MAXLCODES];
+			uint8_t distanceLengths[MAXDCODES];
+			huffman::BuildLengths(literalFrequencies, MAXLCODES, 15, literalLengths);
+			huffman::BuildLengths(distanceFrequencies, MAXDCODES, 15, distanceLengths);
+			const DynamicHeader header = BuildDynamicHeader(literalLengths, distanceLengths);
+
+			uint64_t dynamicBits = 3 + header.bits;
+			uint64_t staticBits = 3;
+			uint64_t extraBits = 0;
+			for (unsigned int i = 0; i < MAXLCODES; i++) {
+				dynamicBits += (uint64_t)literalFrequencies[i] * literalLengths[i];
+				staticBits += (uint64_t)literalFrequencies[i] * staticCodes.literalLengths[i];
+				if (i > 256) {
+					extraBits += (uint64_t)literalFrequencies[i] * lext[i - 257];
+				}
+			}
+			for (unsigned int i = 0; i < MAXDCODES; i++) {
+				dynamicBits += (uint64_t)distanceFrequencies[i] * distanceLengths[i];
+				staticBits += (uint64_t)distanceFrequencies[i] * staticCodes.distanceLengths[i];
+				extraBits += (uint64_t)distanceFrequencies[i] * dext[i];
+			}
+			dynamicBits += extraBits;
+			staticBits += extraBits;
+			const uint64_t storedBlocks = max(1u, (blockLength + 65534) / 65535);
+			const uint64_t storedBits = ((uint64_t)blockLength + 5 * storedBlocks) * 8 + 7;
+
+			if (storedBits <= staticBits && storedBits <= dynamicBits) {
+				WriteStored(source.data() + blockStart, blockLength, last);
+			}
+			else if (staticBits <= dynamicBits) {
+				dest.WriteBits(last ? 1 : 0, 1);
+				dest.WriteBits((unsigned int)BlockType::Static, 2);
+				WriteSymbols(staticCodes.literalLengths, staticCodes.literalCodes, staticCodes.distanceLengths, staticCodes.distanceCodes);
+			}
+			else {
+				uint16_t literalCodes[MAXLCODES];
+				uint16_t distanceCodes[MAXDCODES];
+				huffman::BuildCodes(literalLengths, MAXLCODES, literalCodes);
+				huffman::BuildCodes(distanceLengths, MAXDCODES, distanceCodes);
+				WriteDynamicHeader(header, last);
+				WriteSymbols(literalLengths, literalCodes, distanceLengths, distanceCodes);
+			}
+
+			symbols.clear();
+			memset(literalFrequencies, 0, sizeof(literalFrequencies));
+			memset(distanceFrequencies, 0, sizeof(distanceFrequencies));
+			blockStart += blockLength;
+			blockLength = 0;
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::WriteDynamicHeader(const DynamicHeader& header, const bool last) {
+			dest.WriteBits(last ? 1 : 0, 1);
+			dest.WriteBits((unsigned int)BlockType::Dynamic, 2);
+			dest.WriteBits(header.literalCount - 257, 5);
+			dest.WriteBits(header.distanceCount - 1, 5);
+			dest.WriteBits(header.codeLengthCount - 4, 4);
+			for (unsigned int i = 0; i < header.codeLengthCount; i++) {
+				dest.WriteBits(header.codeLengthLengths[codeLengthOrder[i]], 3);
+			}
+			for (unsigned int i = 0; i < header.runCount; i++) {
+				const uint8_t symbol = header.runs[i];
+				dest.WriteBits(header.codeLengthCodes[symbol], header.codeLengthLengths[symbol]);
+				if (codeLengthExtra[symbol] != 0) {
+					dest.WriteBits(header.runExtra[i], codeLengthExtra[symbol]);
+				}
+			}
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::WriteSymbols(const uint8_t* literalLengths, const uint16_t* literalCodes, const uint8_t* distanceLengths, const uint16_t* distanceCodes) {
+			for (const uint32_t symbol : symbols) {
+				const unsigned int distance = symbol >> 16;
+				if (distance == 0) {
+					dest.WriteBits(literalCodes[symbol], literalLengths[symbol]);
+					continue;
+				}
+
+				const unsigned int length = (symbol & 0xFF) + min_match;
+				const unsigned int lengthCode = lengthCodes[length - min_match];
+				dest.WriteBits(literalCodes[257 + lengthCode], literalLengths[257 + lengthCode]);
+				if (lext[lengthCode] != 0) {
+					dest.WriteBits(length - lens[lengthCode], lext[lengthCode]);
+				}
+				const unsigned int distanceCode = DistanceCode(distance);
+				dest.WriteBits(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+				if (dext[distanceCode] != 0) {
+					dest.WriteBits(distance - dists[distanceCode], dext[distanceCode]);
+				}
+			}
+			dest.WriteBits(literalCodes[256], literalLengths[256]);
+		}
+
+		/* Split into blocks of at most 65535 bytes (only the last of which is marked final) */
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::WriteStored(const uint8_t* data, unsigned int length, const bool last) {
+			do {
+				const unsigned int amount = min(length, 65535u);
+				length -= amount;
+				dest.WriteBits(last && length == 0 ? 1 : 0, 1);
+				dest.WriteBits((unsigned int)BlockType::Stored, 2);
+				const uint8_t header[4] = { (uint8_t)amount, (uint8_t)(amount >> 8), (uint8_t)~amount, (uint8_t)(~amount >> 8) };
+				dest.WriteBytes(header, 4);
+				dest.WriteBytes(data, amount);
+				data += amount;
+			} while (length > 0);
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Write>::EmptyStoredBlock() {
+			WriteStored(nullptr, 0, false);
+		}
+
+		template class ZLIBStream<vector<uint8_t>, Mode::Write>;
+		template class ZLIBStream<basic_ofstream<uint8_t, std::char_traits<uint8_t>>, Mode::Write>;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include "gzip.h"
+#include <algorithm>
+
+using namespace Generic;
+using namespace std;
+
+namespace ImageLibrary {
+	namespace zlib {
+
+		struct MemberResult {
+			bool valid = false;
+			size_t end = 0; //offset one past the member trailer
+			vector<uint8_t> data;
+		};
+
+		/* Inflates the single member starting at offset (throws if there isn't a valid member there) */
+		static MemberResult InflateMember(const uint8_t* data, const size_t length, const size_t offset) {
+			static const unsigned int read_size = 16384;
+
+			MemberResult result;
+			Data<span<const uint8_t>, uint8_t, Mode::Read> source(data + offset, length - offset);
+			ZLIBStream<span<const uint8_t>, Mode::Read> stream(&source, Format::GZIP, false);
+
+			unsigned int amount = 0;
+			do {
+				size_t size = result.data.size();
+				result.data.resize(size + read_size);
+				amount = stream.ReadAvailable(result.data.data() + size, read_size);
+				result.data.resize(size + amount);
+			} while (amount > 0);
+
+			result.end = offset + source.GetPosition();
+			result.valid = true;
+			return result;
+		}
+
+		/* Speculative candidates are allowed to fail, since most of them will be inside the compressed data of another member */
+		static MemberResult TryInflateMember(const uint8_t* data, const size_t length, const size_t offset) {
+			try {
+				return InflateMember(data, length, offset);
+			}
+			catch (std::exception e) {
+				return MemberResult();
+			}
+		}
+
+		/* Speculative tasks read from the caller's buffer, so every one of them (including those for candidates passed over) has to finish before returning (or unwinding) */
+		struct WaitForMembers {
+			deque<future<MemberResult>>& pending;
+			vector<future<MemberResult>>& discarded;
+			~WaitForMembers() {
+				for (future<MemberResult>& member : pending) {
+					if (member.valid()) {
+						member.wait();
+					}
+				}
+				for (future<MemberResult>& member : discarded) {
+					member.wait();
+				}
+			}
+		};
+
+		vector<uint8_t> InflateGZIP(const uint8_t* data, const size_t length, ThreadPool& pool) {
+			/* Anything with the magic number, deflate method and no reserved flags could start a member */
+			vector<size_t> candidates;
+			for (size_t i = 1; i + 10 <= length; i++) {
+				if (data[i] == 0x1F && data[i + 1] == 0x8B && data[i + 2] == 8 && (data[i + 3] & 0xE0) == 0) {
+					candidates.push_back(i);
+				}
+			}
+
+			/* Only the next few candidates are inflated ahead, so no more than that many members' output is held before it is stitched
+			A worker of the pool can't wait on the pool's own tasks, so decodes every member itself
+			*/
+			const size_t window = pool.IsWorker() ? 0 : (size_t)pool.Size() * 2;
+			deque<future<MemberResult>> pending; //for candidates from first up to submitted
+			vector<future<MemberResult>> discarded; //candidates found to be inside another member, still running
+			WaitForMembers wait = { pending, discarded };
+			size_t first = 0;
+			size_t submitted = 0;
+
+			/* The first member is always real, so it is decoded here while the pool works on the rest */
+			vector<uint8_t> out;
+			size_t position = 0;
+			while (true) {
+				while (first < candidates.size() && candidates[first] < position) {
+					if (!pending.empty()) {
+						discarded.push_back(std::move(pending.front()));
+						pending.pop_front();
+					}
+					first++;
+				}
+				submitted = max(submitted, first);
+				while (submitted < candidates.size() && submitted < first + window) {
+					const size_t offset = candidates[submitted++];
+					pending.push_back(pool.Submit([data, length, offset]() { return TryInflateMember(data, length, offset); }));
+				}
+
+				MemberResult member;
+				if (position > 0 && first < candidates.size() && candidates[first] == position && !pending.empty()) {
+					member = pending.front().get();
+					pending.pop_front();
+					first++;
+				}
+				if (!member.valid) {
+					member = InflateMember(data, length, position); //not a candidate (or it failed); decode in order so real errors are reported
+				}
+
+				if (out.empty()) {
+					out = std::move(member.data);
+				}
+				else {
+					out.insert(out.end(), member.data.begin(), member.data.end());
+				}
+				position = member.end;
+
+				/* Candidates passed over have usually failed long ago; those finished are let go so their output isn't held */
+				discarded.erase(remove_if(discarded.begin(), discarded.end(), [](const future<MemberResult>& member) {
+					return member.wait_for(chrono::seconds(0)) == future_status::ready;
+				}), discarded.end());
+
+				/* Anything after the last member that isn't another header is trailing padding (ignored, as gzip -d does) */
+				if (position + 10 > length || data[position] != 0x1F || data[position + 1] != 0x8B) {
+					break;
+				}
+			}
+
+			return out;
+		}
+
+		vector<uint8_t> InflateGZIP(const uint8_t* data, const size_t length, unsigned int threads) {
+			ThreadPool pool(threads);
+			return InflateGZIP(data, length, pool);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "zlib.h"
+#include "../thread/thread-pool.h"
+
+namespace ImageLibrary {
+	namespace zlib {
+		/* Decodes a whole gzip file held in memory (RFC 1952), returning the concatenated output of every member
+		Multi-member files (as written by parallel compressors such as pigz or bgzip) are split speculatively at every position that looks like a member header,
+		and the next few candidates (twice the pool's threads) are inflated on the pool ahead of stitching; candidates are stitched in order,
+		and any candidate that turns out not to be a real member boundary is discarded
+		Called from a worker of pool, every member is decoded on the calling thread instead (waiting on the pool from inside it could deadlock)
+		*/
+		std::vector<uint8_t> InflateGZIP(const uint8_t* data, const size_t length, Generic::ThreadPool& pool);
+		std::vector<uint8_t> InflateGZIP(const uint8_t* data, const size_t length, unsigned int threads = 0); //0 threads uses the hardware concurrency
+	}
+}
\ No newline at end of file
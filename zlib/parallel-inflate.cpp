@@ -0,0 +1,454 @@
+#include "parallel-inflate.h"
+#include "gzip.h"
+
+using namespace Generic;
+using namespace std;
+
+namespace ImageLibrary {
+	namespace zlib {
+		static const unsigned short marker_base = 256; //symbols from here on are markers, referring to window[symbol - marker_base]
+
+		/* Little-endian bit cursor over memory; reads past the end give zero bits, so callers check Overrun after consuming */
+		struct MemoryBits {
+			const uint8_t* data;
+			size_t length;
+			size_t position = 0; //in bits
+
+			/* At least 57 valid bits, starting at position */
+			uint64_t Peek() const {
+				size_t byte = position >> 3;
+				uint64_t value = 0;
+				if (byte + 8 <= length) {
+					memcpy(&value, data + byte, 8);
+				}
+				else {
+					for (size_t i = 0; i < 8 && byte + i < length; i++) {
+						value |= (uint64_t)data[byte + i] << (8 * i);
+					}
+				}
+				return value >> (position & 7);
+			}
+			uint32_t Bits(const unsigned int count) {
+				uint32_t value = (uint32_t)(Peek() & ((1ull << count) - 1));
+				position += count;
+				return value;
+			}
+			bool Overrun() const {
+				return position > length * 8;
+			}
+		};
+
+		/* Output of one decoded piece of the stream, as 16-bit symbols (bytes, or markers into the 32kb preceding the piece) */
+		struct Segment {
+			bool valid = false;
+			bool final = false;
+			size_t startBit = 0;
+			size_t endBit = 0; //bit position of the block boundary the segment stopped at
+			vector<uint16_t> symbols;
+		};
+
+		/* Block level inflater over memory, built on the same huffman tables as ZLIBStream
+		Everything returns false on invalid data instead of throwing, since speculative decoding is expected to fail often
+		*/
+		class SymbolInflater {
+		private:
+			MemoryBits bits;
+
+			Generic::huffman::Huffman<MAXBITS, MAXCODELENGTHS> codeTable;
+			Generic::huffman::Huffman<MAXBITS, FIXLCODES> lengthTable;
+			Generic::huffman::Huffman<MAXBITS, MAXDCODES> distTable;
+			Generic::huffman::Huffman<MAXBITS, FIXLCODES> staticLengthTable;
+			Generic::huffman::Huffman<MAXBITS, MAXDCODES> staticDistTable;
+			short lengths[MAXCODES] = {};
+		public:
+			bool final = false;
+		private:
+			bool Stored(vector<uint16_t>& out) {
+				bits.position = (bits.position + 7) & ~(size_t)7;
+				size_t byte = bits.position >> 3;
+				if (byte + 4 > bits.length) { return false; }
+
+				unsigned int length = bits.data[byte] | bits.data[byte + 1] << 8;
+				unsigned int complement = bits.data[byte + 2] | bits.data[byte + 3] << 8;
+				if (length != (~complement & 0xFFFF)) { return false; }
+
+				byte += 4;
+				if (byte + length > bits.length) { return false; }
+
+				size_t at = out.size();
+				out.resize(at + length);
+				for (unsigned int i = 0; i < length; i++) {
+					out[at + i] = bits.data[byte + i];
+				}
+				bits.position = (byte + length) * 8;
+				return true;
+			}
+
+			bool Dynamic() {
+				static constexpr short order[19] =
+					{ 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+				unsigned int n_lengths = bits.Bits(5) + 257;
+				unsigned int n_dist = bits.Bits(5) + 1;
+				unsigned int n_codes = bits.Bits(4) + 4;
+				if (n_lengths > MAXLCODES || n_dist > MAXDCODES) { return false; }
+
+				unsigned int index = 0;
+				for (; index < n_codes; index++) {
+					lengths[order[index]] = (short)bits.Bits(3);
+				}
+				for (; index < MAXCODELENGTHS; index++) {
+					lengths[order[index]] = 0;
+				}
+				if (codeTable.construct(lengths, MAXCODELENGTHS) != 0) { return false; } //code length codes have to be complete
+
+				index = 0;
+				while (index < n_lengths + n_dist) {
+					unsigned int used = 0;
+					int symbol = codeTable.decode((uint32_t)bits.Peek(), &used);
+					if (symbol < 0) { return false; }
+					bits.position += used;
+
+					if (symbol < 16) {
+						lengths[index++] = (short)symbol;
+						continue;
+					}
+
+					short len = 0;
+					unsigned int repeat = 0;
+					if (symbol == 16) {
+						if (index == 0) { return false; }
+						len = lengths[index - 1];
+						repeat = 3 + bits.Bits(2);
+					}
+					else if (symbol == 17) {
+						repeat = 3 + bits.Bits(3);
+					}
+					else {
+						repeat = 11 + bits.Bits(7);
+					}
+					if (index + repeat > n_lengths + n_dist) { return false; }
+					while (repeat--) {
+						lengths[index++] = len;
+					}
+				}
+				if (lengths[256] == 0 || bits.Overrun()) { return false; }
+
+				/* Incomplete codes are only allowed for a single length 1 code */
+				int err = lengthTable.construct(lengths, n_lengths);
+				if (err && (err < 0 || n_lengths != lengthTable.count[0] + lengthTable.count[1])) { return false; }
+				err = distTable.construct(lengths + n_lengths, n_dist);
+				if (err && (err < 0 || n_dist != distTable.count[0] + distTable.count[1])) { return false; }
+
+				return true;
+			}
+
+			/* windowAvailable is how far before the first symbol of out back-references may reach (they become markers) */
+			template<typename LengthTable>
+			bool Codes(vector<uint16_t>& out, const size_t windowAvailable, const LengthTable& lengthCodes, const Generic::huffman::Huffman<MAXBITS, MAXDCODES>& distCodes) {
+				size_t limit = bits.length * 8;
+				while (bits.position <= limit) {
+					uint64_t peek = bits.Peek();
+					unsigned int used = 0;
+					int symbol = lengthCodes.decode((uint32_t)peek, &used);
+					if (symbol < 0) { return false; }
+					bits.position += used;
+
+					if (symbol < 256) {
+						out.push_back((uint16_t)symbol);
+						continue;
+					}
+					if (symbol == 256) {
+						return !bits.Overrun();
+					}
+
+					symbol -= 257;
+					if (symbol >= 29) { return false; }
+					peek >>= used;
+
+					/* A length/distance pair takes at most 15 + 5 + 15 + 13 bits, so it fits in what was peeked */
+					unsigned int len = lens[symbol] + (unsigned int)(peek & ((1u << lext[symbol]) - 1));
+					peek >>= lext[symbol];
+					bits.position += lext[symbol];
+
+					int distSymbol = distCodes.decode((uint32_t)peek, &used);
+					if (distSymbol < 0 || distSymbol >= 30) { return false; }
+					peek >>= used;
+					unsigned int dist = dists[distSymbol] + (unsigned int)(peek & ((1u << dext[distSymbol]) - 1));
+					bits.position += used + dext[distSymbol];
+
+					size_t at = out.size();
+					if (dist > at + windowAvailable) { return false; }
+
+					out.resize(at + len);
+					uint16_t* symbols = out.data();
+					for (unsigned int i = 0; i < len; i++, at++) {
+						symbols[at] = dist <= at ? symbols[at - dist] : (uint16_t)(marker_base + sliding_32k - (dist - at));
+					}
+				}
+				return false;
+			}
+		public:
+			SymbolInflater(const uint8_t* data, const size_t length) : bits({ data, length }) {
+				staticLengthTable.construct(staticLengths.data(), FIXLCODES);
+				staticDistTable.construct(staticDistances.data(), MAXDCODES);
+			}
+
+			void Seek(const size_t bit) { bits.position = bit; }
+			size_t Position() const { return bits.position; }
+
+			/* Decodes one whole block (header included) onto the end of out */
+			bool Block(vector<uint16_t>& out, const size_t windowAvailable) {
+				if (bits.position + 3 > bits.length * 8) { return false; }
+
+				uint32_t header = bits.Bits(3);
+				final = header & 0x1;
+				switch ((BlockType)(header >> 1)) {
+				case BlockType::Stored:
+					return Stored(out);
+				case BlockType::Static:
+					return Codes(out, windowAvailable, staticLengthTable, staticDistTable);
+				case BlockType::Dynamic:
+					return Dynamic() && Codes(out, windowAvailable, lengthTable, distTable);
+				default:
+					return false;
+				}
+			}
+
+			/* Cheap rejection of positions that can't start a dynamic or stored block, before trying to decode one */
+			bool PlausibleBlockStart() const {
+				uint64_t peek = bits.Peek();
+				unsigned int type = (peek >> 1) & 0x3;
+				if (type == (unsigned int)BlockType::Dynamic) {
+					return ((peek >> 3) & 0x1F) <= 29 && ((peek >> 8) & 0x1F) <= 29; //HLIT, HDIST in range
+				}
+				if (type == (unsigned int)BlockType::Stored) {
+					/* Fixed blocks are too easy to mistake for noise to search for, but stored headers can be checked exactly (padding is zero when written by zlib) */
+					unsigned int padding = (8 - ((bits.position + 3) & 7)) & 7;
+					if ((peek >> 3) & ((1u << padding) - 1)) { return false; }
+					uint32_t lengths = (uint32_t)(peek >> (3 + padding));
+					return (lengths & 0xFFFF) == (~(lengths >> 16) & 0xFFFF);
+				}
+				return false;
+			}
+		};
+
+		/* Decodes in order from startBit until a block boundary at or after stopBit (or the final block); invalid data is an error here */
+		static Segment DecodeSegment(const uint8_t* data, const size_t length, const size_t startBit, const size_t stopBit, const size_t windowAvailable) {
+			Segment segment;
+			SymbolInflater inflater(data, length);
+			inflater.Seek(startBit);
+			do {
+				if (!inflater.Block(segment.symbols, windowAvailable)) {
+					throw std::exception("[ZLIB] Invalid DEFLATE data!");
+				}
+			} while (!inflater.final && inflater.Position() < stopBit);
+
+			segment.valid = true;
+			segment.final = inflater.final;
+			segment.startBit = startBit;
+			segment.endBit = inflater.Position();
+			return segment;
+		}
+
+		/* Searches [searchBegin, searchEnd) for the first position that decodes as a block, and decodes on from there like DecodeSegment */
+		static Segment SpeculateSegment(const uint8_t* data, const size_t length, const size_t searchBegin, const size_t searchEnd, const size_t stopBit) {
+			Segment segment;
+			SymbolInflater inflater(data, length);
+
+			for (size_t bit = searchBegin; bit < searchEnd; bit++) {
+				inflater.Seek(bit);
+				if (!inflater.PlausibleBlockStart()) {
+					continue;
+				}
+
+				/* A false positive almost never survives decoding a whole block and then the blocks after it */
+				segment.symbols.clear();
+				bool decoded = true;
+				do {
+					decoded = inflater.Block(segment.symbols, sliding_32k);
+				} while (decoded && !inflater.final && inflater.Position() < stopBit);
+
+				if (decoded) {
+					segment.valid = true;
+					segment.final = inflater.final;
+					segment.startBit = bit;
+					segment.endBit = inflater.Position();
+					return segment;
+				}
+			}
+
+			segment.symbols = vector<uint16_t>();
+			return segment;
+		}
+
+		static size_t HeaderLength(const uint8_t* data, const size_t length, const Format format) {
+			if (format == Format::ZLIB) {
+				if (length < 2) { throw std::exception("[ZLIB] Truncated header!"); }
+				if ((data[0] & 0xF) != 8) { throw std::exception("[ZLIB] Unknown zlib compression method!"); }
+				if ((data[0] * 256 + data[1]) % 31 != 0) { throw std::exception("[ZLIB] Failed bit check!"); }
+				if (data[1] & 0x20) { throw std::exception("[ZLIB] Preset dictionaries are not supported!"); }
+				return 2;
+			}
+			if (format == Format::GZIP) {
+				if (length < 10 || data[0] != 0x1F || data[1] != 0x8B) { throw std::exception("[GZIP] Invalid magic number!"); }
+				if (data[2] != 8) { throw std::exception("[GZIP] Unknown compression method!"); }
+
+				uint8_t FLG = data[3];
+				size_t position = 10;
+				if (FLG & 0x4) { //FEXTRA
+					if (position + 2 > length) { throw std::exception("[GZIP] Truncated member header!"); }
+					position += 2 + (data[position] | data[position + 1] << 8);
+				}
+				for (uint8_t flag : { 0x8, 0x10 }) { //FNAME, FCOMMENT
+					if (FLG & flag) {
+						while (position < length && data[position] != 0) { position++; }
+						position++;
+					}
+				}
+				if (FLG & 0x2) { position += 2; } //FHCRC
+				if (position > length) { throw std::exception("[GZIP] Truncated member header!"); }
+				return position;
+			}
+			return 0;
+		}
+
+		/* Speculative tasks read from the caller's buffer, so every one of them has to finish before returning (or unwinding) */
+		struct WaitForSegments {
+			vector<future<Segment>>& speculative;
+			~WaitForSegments() {
+				for (future<Segment>& segment : speculative) {
+					if (segment.valid()) {
+						segment.wait();
+					}
+				}
+			}
+		};
+
+		vector<uint8_t> InflateParallel(const uint8_t* data, const size_t length, const Format format, ThreadPool& pool, const size_t chunkSize) {
+			size_t header = HeaderLength(data, length, format);
+			size_t startBit = header * 8;
+			size_t chunkBits = chunkSize * 8;
+			size_t chunks = (length - header + chunkSize - 1) / chunkSize;
+			if (pool.Size() < 2) {
+				chunks = 1; //nothing to overlap with
+			}
+
+			vector<future<Segment>> speculative(chunks);
+			WaitForSegments wait = { speculative };
+			for (size_t chunk = 1; chunk < chunks; chunk++) {
+				size_t searchBegin = startBit + chunk * chunkBits;
+				size_t searchEnd = min(searchBegin + chunkBits, length * 8);
+				speculative[chunk] = pool.Submit([=]() { return SpeculateSegment(data, length, searchBegin, searchEnd, searchEnd); });
+			}
+
+			/* Stitch: the first chunk is decoded here (it is the only one with a known start), then each later segment has to begin exactly where the last one ended */
+			vector<Segment> segments;
+			segments.push_back(DecodeSegment(data, length, startBit, chunks > 1 ? startBit + chunkBits : SIZE_MAX, 0));
+			while (!segments.back().final) {
+				size_t position = segments.back().endBit;
+				if (position >= length * 8) { throw std::exception("[ZLIB] Truncated DEFLATE stream!"); }
+
+				size_t chunk = (position - startBit) / chunkBits;
+				Segment segment;
+				if (chunk < chunks && speculative[chunk].valid()) {
+					segment = speculative[chunk].get();
+				}
+				if (!segment.valid || segment.startBit != position) {
+					segment = DecodeSegment(data, length, position, chunk + 1 < chunks ? startBit + (chunk + 1) * chunkBits : SIZE_MAX, sliding_32k);
+				}
+				segments.push_back(std::move(segment));
+			}
+
+			/* Each segment's markers point into the 32kb before it, so windows are carried forward in order (only the tail of each segment needs resolving for that) */
+			vector<vector<uint8_t>> windows(segments.size());
+			vector<size_t> offsets(segments.size());
+			vector<uint8_t> window(sliding_32k, 0);
+			size_t produced = 0;
+			for (size_t s = 0; s < segments.size(); s++) {
+				windows[s] = window;
+				offsets[s] = produced;
+
+				const vector<uint16_t>& symbols = segments[s].symbols;
+				size_t tail = min(symbols.size(), (size_t)sliding_32k);
+				memmove(window.data(), window.data() + tail, sliding_32k - tail);
+				for (size_t i = 0; i < tail; i++) {
+					uint16_t symbol = symbols[symbols.size() - tail + i];
+					window[sliding_32k - tail + i] = symbol < marker_base ? (uint8_t)symbol : windows[s][symbol - marker_base];
+				}
+				produced += symbols.size();
+			}
+
+			/* Resolve every segment at once, checksumming each piece so the totals can be combined afterwards */
+			vector<uint8_t> out(produced);
+			vector<future<uint32_t>> checksums;
+			checksums.reserve(segments.size());
+			for (size_t s = 0; s < segments.size(); s++) {
+				checksums.push_back(pool.Submit([&, s]() {
+					const vector<uint16_t>& symbols = segments[s].symbols;
+					const uint8_t* segmentWindow = windows[s].data();
+					size_t lowest = marker_base + sliding_32k - min(offsets[s], (size_t)sliding_32k); //markers can't reach before the start of the stream
+					uint8_t* target = out.data() + offsets[s];
+
+					for (size_t i = 0; i < symbols.size(); i++) {
+						uint16_t symbol = symbols[i];
+						if (symbol < marker_base) {
+							target[i] = (uint8_t)symbol;
+						}
+						else if (symbol >= lowest) {
+							target[i] = segmentWindow[symbol - marker_base];
+						}
+						else {
+							throw std::exception("[ZLIB] Back-reference too far back");
+						}
+					}
+
+					if (format == Format::GZIP) {
+						return checksum::CRC32(target, symbols.size());
+					}
+					return checksum::Adler32(target, symbols.size());
+				}));
+			}
+
+			for (future<uint32_t>& piece : checksums) {
+				piece.wait(); //tasks reference the locals above, so none can be left running if one of them throws
+			}
+
+			uint32_t total = format == Format::GZIP ? 0 : 1;
+			for (size_t s = 0; s < segments.size(); s++) {
+				uint32_t piece = checksums[s].get();
+				size_t size = segments[s].symbols.size();
+				total = format == Format::GZIP ? checksum::CRC32Combine(total, piece, size) : checksum::Adler32Combine(total, piece, size);
+			}
+
+			/* Trailer follows the final block at the next byte boundary */
+			size_t trailer = (segments.back().endBit + 7) / 8;
+			if (format == Format::ZLIB) {
+				if (trailer + 4 > length) { throw std::exception("[ZLIB] Missing adler-32 trailer!"); }
+				if (Generic::ConvertEndian(data + trailer) != total) { throw std::exception("[ZLIB] Adler-32 mismatch!"); }
+			}
+			else if (format == Format::GZIP) {
+				if (trailer + 8 > length) { throw std::exception("[GZIP] Missing member trailer!"); }
+				const uint8_t* t = data + trailer;
+				uint32_t crc = t[0] | t[1] << 8 | t[2] << 16 | (uint32_t)t[3] << 24;
+				uint32_t isize = t[4] | t[5] << 8 | t[6] << 16 | (uint32_t)t[7] << 24;
+				if (crc != total) { throw std::exception("[GZIP] CRC-32 mismatch!"); }
+				if (isize != (uint32_t)produced) { throw std::exception("[GZIP] Size mismatch!"); }
+
+				/* Members after the first are concatenated, as ZLIBStream reads them; they are usually many small ones (pigz, bgzip), so are split across the pool by member instead */
+				size_t next = trailer + 8;
+				if (next < length && data[next] == 0x1F) {
+					vector<uint8_t> rest = InflateGZIP(data + next, length - next, pool);
+					out.insert(out.end(), rest.begin(), rest.end());
+				}
+			}
+
+			return out;
+		}
+
+		vector<uint8_t> InflateParallel(const uint8_t* data, const size_t length, const Format format, unsigned int threads) {
+			ThreadPool pool(threads);
+			return InflateParallel(data, length, format, pool);
+		}
+	}
+}
\ No newline at end of file
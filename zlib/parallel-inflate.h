@@ -0,0 +1,21 @@
+#pragma once
+
+#include "zlib.h"
+#include "../thread/thread-pool.h"
+
+namespace ImageLibrary {
+	namespace zlib {
+		/* Inflates a single (large) DEFLATE stream held in memory across the pool, by speculating on block boundaries (the approach used by pugz / rapidgzip)
+
+		The compressed data is cut into chunks of chunkSize bytes. Every chunk after the first searches its range for a position that decodes as a valid dynamic or stored block,
+		then inflates from there until it reaches a block boundary inside the next chunk's range. Back-references to data before the chunk start are not known yet,
+		so they are written as markers into the 32kb window that precedes the chunk.
+		Chunks are then stitched in order (anything that guessed a wrong boundary is re-decoded from the real one), and the markers are resolved once each preceding window is known.
+
+		Output is identical to a sequential inflate, trailer checksums included; streams with a zlib preset dictionary are not supported
+		Any gzip members after the first are decoded with InflateGZIP (which splits them across the pool by member), and data after the last member that isn't a header is ignored
+		*/
+		std::vector<uint8_t> InflateParallel(const uint8_t* data, const size_t length, const Format format, Generic::ThreadPool& pool, const size_t chunkSize = 4 << 20);
+		std::vector<uint8_t> InflateParallel(const uint8_t* data, const size_t length, const Format format = Format::ZLIB, unsigned int threads = 0); //0 threads uses the hardware concurrency
+	}
+}
\ No newline at end of file
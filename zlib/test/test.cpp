@@ -0,0 +1,366 @@
+#include "test.h"
+#include "../parallel-inflate.h"
+#include "../gzip.h"
+#include <random>
+#include <string>
+#include <functional>
+
+using namespace Generic;
+using namespace std;
+
+namespace ImageLibrary {
+	namespace zlib {
+		/* Words from a small vocabulary, so matches reach back across the whole window (and across chunk boundaries) */
+		static vector<uint8_t> MakeText(mt19937& rng, const size_t length) {
+			static const char* words[] = { "inflate", "deflate", "block", "window", "marker", "chunk", "boundary", "stored", "fixed", "dynamic", "huffman", "literal",
+				"distance", "length", "adler", "trailer", "speculative", "stitch", "pool", "thread" };
+			vector<uint8_t> text;
+			text.reserve(length + 16);
+			while (text.size() < length) {
+				const char* word = words[rng() % size(words)];
+				text.insert(text.end(), word, word + strlen(word));
+				text.push_back(rng() % 16 == 0 ? '\n' : ' ');
+			}
+			text.resize(length);
+			return text;
+		}
+
+		/* Incompressible, so deflate stores it (and any byte pattern, block headers included, turns up somewhere) */
+		static vector<uint8_t> MakeNoise(mt19937& rng, const size_t length) {
+			vector<uint8_t> noise(length);
+			for (uint8_t& byte : noise) {
+				byte = (uint8_t)rng();
+			}
+			return noise;
+		}
+
+		/* Rows of gradients & flat runs, like filtered image data */
+		static vector<uint8_t> MakeImage(mt19937& rng, const size_t length) {
+			vector<uint8_t> image(length);
+			for (size_t i = 0; i < length; i++) {
+				const size_t x = i % 3000;
+				image[i] = x < 1000 ? (uint8_t)(x / 7) : x < 2000 ? (uint8_t)(i / 3000 % 4 == 0 ? rng() : 0) : (uint8_t)(x * 3 + i / 3000);
+			}
+			return image;
+		}
+
+		static void WriteTrailer(Data<vector<uint8_t>, uint8_t, Mode::Write>& out, const vector<uint8_t>& data, const Format format) {
+			if (format == Format::ZLIB) {
+				const uint32_t adler = checksum::Adler32(data.data(), data.size());
+				const uint8_t trailer[4] = { (uint8_t)(adler >> 24), (uint8_t)(adler >> 16), (uint8_t)(adler >> 8), (uint8_t)adler };
+				out.Write(trailer, 4);
+			}
+			else if (format == Format::GZIP) {
+				const uint32_t crc = checksum::CRC32(data.data(), data.size());
+				const uint32_t size = (uint32_t)data.size();
+				const uint8_t trailer[8] = { (uint8_t)crc, (uint8_t)(crc >> 8), (uint8_t)(crc >> 16), (uint8_t)(crc >> 24),
+					(uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16), (uint8_t)(size >> 24) };
+				out.Write(trailer, 8);
+			}
+		}
+
+		/* Fixed Huffman blocks only, which ZLIBStream never picks for blocks this long (and which InflateParallel can never take for a block start):
+		literals, with runs coded as distance 1 matches of 3 - 10 bytes
+		*/
+		static vector<uint8_t> CompressFixed(const vector<uint8_t>& data, const Format format) {
+			uint8_t literalLengths[288];
+			for (unsigned int symbol = 0; symbol < 288; symbol++) {
+				literalLengths[symbol] = symbol < 144 ? 8 : symbol < 256 ? 9 : symbol < 280 ? 7 : 8;
+			}
+			uint8_t distanceLengths[30];
+			memset(distanceLengths, 5, sizeof(distanceLengths));
+			uint16_t literalCodes[288];
+			uint16_t distanceCodes[30];
+			huffman::BuildCodes(literalLengths, 288, literalCodes);
+			huffman::BuildCodes(distanceLengths, 30, distanceCodes);
+
+			Data<vector<uint8_t>, uint8_t, Mode::Write> out;
+			if (format == Format::ZLIB) {
+				uint8_t header[2];
+				ZLIBHeader(header, 6);
+				out.Write(header, 2);
+			}
+			else if (format == Format::GZIP) {
+				const uint8_t header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+				out.Write(header, 10);
+			}
+
+			BitWriter<vector<uint8_t>, uint8_t> bits(&out);
+			const size_t block_size = 50000;
+			for (size_t start = 0; start < data.size(); start += block_size) {
+				const size_t end = min(data.size(), start + block_size);
+				bits.WriteBits(end == data.size() ? 1 : 0, 1);
+				bits.WriteBits(1, 2); //fixed codes
+				for (size_t i = start; i < end;) {
+					unsigned int run = 0;
+					while (i > 0 && run < 10 && i + run < end && data[i + run] == data[i - 1]) {
+						run++;
+					}
+					if (run >= 3) {
+						bits.WriteBits(literalCodes[257 + run - 3], literalLengths[257 + run - 3]); //lengths 3 - 10 have no extra bits
+						bits.WriteBits(distanceCodes[0], distanceLengths[0]);
+						i += run;
+					}
+					else {
+						bits.WriteBits(literalCodes[data[i]], literalLengths[data[i]]);
+						i++;
+					}
+				}
+				bits.WriteBits(literalCodes[256], literalLengths[256]);
+			}
+			bits.AlignToByte();
+			bits.Flush();
+
+			WriteTrailer(out, data, format);
+			return out.source;
+		}
+
+		/* flushEvery (if not 0) ends a block every that many bytes, so streams of small blocks can be made, which come out as a mix of fixed & dynamic blocks */
+		static vector<uint8_t> Compress(const vector<uint8_t>& data, const unsigned int level, const Format format, const size_t flushEvery = 0) {
+			Data<vector<uint8_t>, uint8_t, Mode::Write> out;
+			ZLIBStream<vector<uint8_t>, Mode::Write> stream(&out, level, format);
+			const size_t piece = flushEvery != 0 ? flushEvery : data.size();
+			for (size_t start = 0; start < data.size(); start += piece) {
+				stream.Write(data.data() + start, (unsigned int)min(piece, data.size() - start));
+				if (flushEvery != 0) {
+					stream.Flush();
+				}
+			}
+			stream.Finish();
+			return out.source;
+		}
+
+		/* Concatenated gzip members (as pigz & bgzip write), each a piece of data compressed on its own at levels 0, 1, 6 & 9 in turn; ends (if given) gets where each member ends */
+		static vector<uint8_t> CompressMembers(const vector<uint8_t>& data, const unsigned int members, vector<size_t>* ends = nullptr) {
+			static const unsigned int levels[] = { 0, 1, 6, 9 };
+			vector<uint8_t> file;
+			const size_t piece = (data.size() + members - 1) / members;
+			for (unsigned int member = 0; member < members; member++) {
+				const size_t start = min(data.size(), member * piece);
+				const vector<uint8_t> part(data.begin() + start, data.begin() + min(data.size(), start + piece));
+				const vector<uint8_t> compressed = Compress(part, levels[member % 4], Format::GZIP);
+				file.insert(file.end(), compressed.begin(), compressed.end());
+				if (ends != nullptr) {
+					ends->push_back(file.size());
+				}
+			}
+			return file;
+		}
+
+		/* A gzip member with the optional header fields in flags (FHCRC 0x2, FEXTRA 0x4, FNAME 0x8, FCOMMENT 0x10) filled in */
+		static vector<uint8_t> CompressMember(const vector<uint8_t>& data, const unsigned int level, const uint8_t flags) {
+			Data<vector<uint8_t>, uint8_t, Mode::Write> out;
+			const uint8_t header[10] = { 0x1F, 0x8B, 8, flags, 0, 0, 0, 0, 0, 0xFF };
+			out.Write(header, 10);
+			if (flags & 0x4) {
+				const uint8_t extra[10] = { 8, 0, 'I', 'L', 4, 0, 1, 2, 3, 4 }; //XLEN, then one subfield
+				out.Write(extra, 10);
+			}
+			if (flags & 0x8) {
+				out.Write((const uint8_t*)"member.bin", 11);
+			}
+			if (flags & 0x10) {
+				out.Write((const uint8_t*)"written by the test", 20);
+			}
+			if (flags & 0x2) {
+				const uint8_t crc16[2] = { 0xAB, 0xCD }; //not verified by readers
+				out.Write(crc16, 2);
+			}
+			const vector<uint8_t> deflated = Compress(data, level, Format::Raw);
+			out.Write(deflated.data(), (unsigned int)deflated.size());
+			WriteTrailer(out, data, Format::GZIP);
+			return out.source;
+		}
+
+		static vector<uint8_t> InflateSequential(const vector<uint8_t>& compressed, const Format format) {
+			Data<span<const uint8_t>, uint8_t, Mode::Read> source(compressed.data(), compressed.size());
+			ZLIBStream<span<const uint8_t>, Mode::Read> stream(&source, format);
+			vector<uint8_t> result;
+			unsigned int amount = 0;
+			do {
+				const size_t size = result.size();
+				result.resize(size + 65536);
+				amount = stream.ReadAvailable(result.data() + size, 65536);
+				result.resize(size + amount);
+			} while (amount > 0);
+			return result;
+		}
+
+		/* A sequential inflate and the parallel one (given as inflate) give the original data, or (for corrupted streams) both throw, or both give the same output */
+		static bool Check(std::ostream& out, const string& name, const vector<uint8_t>& compressed, const Format format, const vector<uint8_t>* original,
+			const function<vector<uint8_t>()>& inflate) {
+			vector<uint8_t> sequential;
+			string sequentialError;
+			try {
+				sequential = InflateSequential(compressed, format);
+			}
+			catch (std::exception e) {
+				sequentialError = e.what();
+			}
+
+			vector<uint8_t> parallel;
+			string parallelError;
+			try {
+				parallel = inflate();
+			}
+			catch (std::exception e) {
+				parallelError = e.what();
+			}
+
+			string problem;
+			if (original != nullptr && !sequentialError.empty()) {
+				problem = "sequential inflate failed: " + sequentialError;
+			}
+			else if (original != nullptr && sequential != *original) {
+				problem = "sequential output differs from the original";
+			}
+			else if (sequentialError.empty() != parallelError.empty()) {
+				problem = sequentialError.empty() ? "parallel inflate failed: " + parallelError : "parallel inflate accepted a stream the sequential one rejects (" + sequentialError + ")";
+			}
+			else if (sequentialError.empty() && parallel != sequential) {
+				problem = "parallel output differs from the sequential output";
+			}
+
+			if (!problem.empty()) {
+				out << "  FAIL " << name << ": " << problem << "\n";
+				return false;
+			}
+			return true;
+		}
+
+		bool ParallelInflateTest(std::ostream& out) {
+			static const Format formats[] = { Format::ZLIB, Format::Raw, Format::GZIP };
+			static const char* formatNames[] = { "zlib", "raw", "gzip" };
+			static const size_t chunkSizes[] = { 64 << 10, 100003, 4099 };
+
+			mt19937 rng(0x5A4C4942);
+			struct Input {
+				const char* name;
+				vector<uint8_t> data;
+			};
+			const Input inputs[] = {
+				{ "text", MakeText(rng, 1 << 20) },
+				{ "noise", MakeNoise(rng, 300000) },
+				{ "image", MakeImage(rng, 600000) },
+			};
+
+			ThreadPool pool(4);
+			unsigned int cases = 0;
+			unsigned int failures = 0;
+			const auto check = [&](const string& name, const vector<uint8_t>& compressed, const Format format, const vector<uint8_t>* original) {
+				for (const size_t chunkSize : chunkSizes) {
+					cases++;
+					const auto inflate = [&]() { return InflateParallel(compressed.data(), compressed.size(), format, pool, chunkSize); };
+					failures += Check(out, name + " (chunk size " + to_string(chunkSize) + ")", compressed, format, original, inflate) ? 0 : 1;
+				}
+			};
+
+			out << "Parallel inflate test\n";
+			for (const Input& input : inputs) {
+				for (unsigned int f = 0; f < 3; f++) {
+					const string prefix = string(input.name) + " " + formatNames[f] + " ";
+					check(prefix + "stored", Compress(input.data, 0, formats[f]), formats[f], &input.data);
+					check(prefix + "fixed", CompressFixed(input.data, formats[f]), formats[f], &input.data);
+					check(prefix + "level 1", Compress(input.data, 1, formats[f]), formats[f], &input.data);
+					check(prefix + "level 6 small blocks", Compress(input.data, 6, formats[f], 3000), formats[f], &input.data);
+					check(prefix + "level 9", Compress(input.data, 9, formats[f]), formats[f], &input.data);
+				}
+
+				/* Every member is decoded, and zeros padding the end of the file are ignored */
+				vector<uint8_t> members = CompressMembers(input.data, 40);
+				check(string(input.name) + " gzip 40 members", members, Format::GZIP, &input.data);
+				members.resize(members.size() + 512, 0);
+				check(string(input.name) + " gzip 40 members & padding", members, Format::GZIP, &input.data);
+
+				/* Trailers that don't match the data have to be rejected by both, and damaged data has to be handled the same way by both */
+				vector<uint8_t> damaged = Compress(input.data, 9, Format::ZLIB);
+				damaged[damaged.size() - 1] ^= 1;
+				check(string(input.name) + " zlib corrupted adler-32", damaged, Format::ZLIB, nullptr);
+
+				damaged = Compress(input.data, 9, Format::GZIP);
+				damaged[damaged.size() - 8] ^= 0x80;
+				check(string(input.name) + " gzip corrupted crc-32", damaged, Format::GZIP, nullptr);
+
+				damaged = Compress(input.data, 9, Format::GZIP);
+				damaged[damaged.size() - 4] ^= 1;
+				check(string(input.name) + " gzip corrupted size", damaged, Format::GZIP, nullptr);
+
+				for (const double at : { 0.3, 0.7 }) {
+					damaged = Compress(input.data, 6, Format::ZLIB);
+					damaged[(size_t)(damaged.size() * at)] ^= 0x10;
+					check(string(input.name) + " zlib corrupted data at " + to_string((int)(at * 100)) + "%", damaged, Format::ZLIB, nullptr);
+				}
+			}
+
+			out << cases << " cases, " << failures << " failed\n" << flush;
+			return failures == 0;
+		}
+
+		bool GZIPMemberTest(std::ostream& out) {
+			mt19937 rng(0x475A4950);
+			const vector<uint8_t> text = MakeText(rng, 1 << 20);
+			const vector<uint8_t> noise = MakeNoise(rng, 200000);
+
+			ThreadPool pool(4);
+			ThreadPool single(1); //a worker waiting on its own pool's tasks would never see them run
+			unsigned int cases = 0;
+			unsigned int failures = 0;
+			const auto check = [&](const string& name, const vector<uint8_t>& file, const vector<uint8_t>* original) {
+				const auto inflate = [&]() { return InflateGZIP(file.data(), file.size(), pool); };
+				const auto inflateOnWorker = [&]() { return single.Submit([&]() { return InflateGZIP(file.data(), file.size(), single); }).get(); };
+				cases += 2;
+				failures += Check(out, name, file, Format::GZIP, original, inflate) ? 0 : 1;
+				failures += Check(out, name + " (from a worker of the pool)", file, Format::GZIP, original, inflateOnWorker) ? 0 : 1;
+			};
+
+			out << "Multi-member gzip test\n";
+			check("text 1 member", Compress(text, 6, Format::GZIP), &text);
+			check("text 40 members", CompressMembers(text, 40), &text);
+			check("text 500 members", CompressMembers(text, 500), &text);
+			check("noise 40 members", CompressMembers(noise, 40), &noise);
+
+			/* Optional header fields are skipped in every combination */
+			vector<uint8_t> file;
+			vector<uint8_t> original;
+			for (unsigned int member = 0; member < 32; member++) {
+				const vector<uint8_t> part(text.begin() + member * 20000, text.begin() + member * 20000 + 20000);
+				const vector<uint8_t> compressed = CompressMember(part, member % 10, (uint8_t)(member & 0x1E));
+				file.insert(file.end(), compressed.begin(), compressed.end());
+				original.insert(original.end(), part.begin(), part.end());
+			}
+			check("header fields", file, &original);
+
+			/* Zeros after the last member are padding */
+			vector<uint8_t> padded = CompressMembers(text, 40);
+			padded.resize(padded.size() + 1000, 0);
+			check("40 members & padding", padded, &text);
+
+			/* A stored member holding a whole gzip file: every header inside it looks like a member (and inflates as one), but isn't */
+			const vector<uint8_t> inner = CompressMembers(vector<uint8_t>(text.begin(), text.begin() + 100000), 5);
+			vector<uint8_t> payload(noise.begin(), noise.begin() + 5000);
+			payload.insert(payload.end(), inner.begin(), inner.end());
+			payload.insert(payload.end(), noise.begin() + 5000, noise.begin() + 10000);
+			vector<uint8_t> nested = Compress(payload, 0, Format::GZIP);
+			const vector<uint8_t> after = Compress(vector<uint8_t>(text.begin(), text.begin() + 50000), 6, Format::GZIP);
+			nested.insert(nested.end(), after.begin(), after.end());
+			payload.insert(payload.end(), text.begin(), text.begin() + 50000);
+			check("fake headers in a stored member", nested, &payload);
+
+			/* A damaged member has to be reported, not skipped */
+			vector<size_t> ends;
+			const vector<uint8_t> members = CompressMembers(text, 40, &ends);
+			vector<uint8_t> damaged = members;
+			damaged[ends[4] - 8] ^= 1; //crc-32 of the 5th member
+			check("corrupted member crc-32", damaged, nullptr);
+			damaged = members;
+			damaged[members.size() / 2] ^= 0x10;
+			check("corrupted member data", damaged, nullptr);
+			damaged = members;
+			damaged.resize(damaged.size() - 3);
+			check("truncated last member", damaged, nullptr);
+
+			out << cases << " cases, " << failures << " failed\n" << flush;
+			return failures == 0;
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <ostream>
+
+namespace ImageLibrary {
+	namespace zlib {
+		/* Round trips stored, fixed & dynamic streams (zlib, raw & gzip, including files of many gzip members) through InflateParallel at small chunk sizes, comparing against a sequential ZLIBStream
+		and the original data, and checks that corrupted trailers & data are rejected the same way; prints any failures, and returns whether everything passed
+		*/
+		bool ParallelInflateTest(std::ostream& out);
+
+		/* Inflates multi-member gzip files with InflateGZIP (on the calling thread, and from the only worker of its pool), against a sequential ZLIBStream & the original data:
+		many members, optional header fields, trailing padding, a stored member holding fake headers, and damaged members that have to be rejected
+		*/
+		bool GZIPMemberTest(std::ostream& out);
+	}
+}
\ No newline at end of file
@@ -8,6 +8,9 @@ namespace ImageLibrary {
 
 		template<typename Backing>
 		void ZLIBStream<Backing, Mode::Read>::Loop() {
+			unsigned int start = write_pointer;
+			unsigned int before = written_current_period;
+
 			switch (state) {
 			case State::Init:
 				Init();
@@ -18,13 +21,63 @@ namespace ImageLibrary {
 			case State::NewBlock:
 				NewBlock();
 				break;
+			case State::Trailer:
+				ReadTrailer();
+				break;
 			default:
 				break;
 			}
+
+			UpdateChecksum(start, written_current_period - before);
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Read>::Reset(Data<Backing, uint8_t, Mode::Read>* source) {
+			src.src = source;
+			src.ResetBitPointer();
+			current_index = 0;
+			last_read = 0;
+
+			ext_pointer = 0;
+			write_pointer = 0;
+			written_current_period = 0;
+			max = 0;
+			byte = 0;
+			bit_pointer = 0;
+			bytePresent = false;
+
+			state = State::Init;
+			pending_copy = false;
+			copy_amount_remaining = 0;
+			copyLocation = 0;
+			final = false;
+			amountWritten = 0; //nothing left in the window can be referred back to
+			literalDataLength = 0;
+			checksum = 1;
+			totalOut = 0;
 		}
 
 		template<typename Backing>
 		void ZLIBStream<Backing, Mode::Read>::Init() {
+			switch (format) {
+			case Format::ZLIB:
+				ReadZLIBHeader();
+				checksum = 1;
+				break;
+			case Format::GZIP:
+				ReadGZIPHeader();
+				checksum = 0;
+				break;
+			case Format::Raw:
+				break;
+			}
+			totalOut = 0;
+
+			NewBlock();
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Read>::ReadZLIBHeader() {
 			/* Begin by reading in header data */
 			uint8_t CMF = 0; 
 			src.src->Read(&CMF, 1);
@@ -36,14 +89,80 @@ namespace ImageLibrary {
 			uint8_t CINFO = (CMF & 0xF0) >> 4; /* sliding window size (not needed to be read here) */
 
 			uint8_t FCHECK = FLG & 0x1F; //check bits for CMF and FLG
-			uint8_t FDICT = FLG & 0x20 >> 5; //preset dictionary; if present, need to seek past (only needed for encoding)
-			uint8_t FLEVEL = FLG & 0xC0 >> 6; //compression level (also not needed)
+			uint8_t FDICT = (FLG & 0x20) >> 5; //preset dictionary; if present, need to seek past (only needed for encoding)
+			uint8_t FLEVEL = (FLG & 0xC0) >> 6; //compression level (also not needed)
 
 			uint16_t check = ((uint16_t)CMF * 256) + FLG;
 			if (check % 31 != 0) { throw std::exception("[ZLIB] Failed bit check!"); }
 			if (FDICT) { src.src->Seek(4); } //skip dictionary
-			NewBlock();
-			state = State::Decoding;
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Read>::ReadGZIPHeader() {
+			static const uint8_t FTEXT = 0x1, FHCRC = 0x2, FEXTRA = 0x4, FNAME = 0x8, FCOMMENT = 0x10, FRESERVED = 0xE0;
+
+			/* ID1, ID2, CM, FLG, MTIME (4), XFL, OS */
+			uint8_t header[10] = {};
+			src.src->Read(header, 10);
+			if (src.src->GetReadCount() != 10) { throw std::exception("[GZIP] Truncated member header!"); }
+
+			if (header[0] != 0x1F || header[1] != 0x8B) { throw std::exception("[GZIP] Invalid magic number!"); }
+			if (header[2] != 8) { throw std::exception("[GZIP] Unknown compression method!"); }
+
+			uint8_t FLG = header[3];
+			if (FLG & FRESERVED) { throw std::exception("[GZIP] Reserved flags set!"); }
+
+			if (FLG & FEXTRA) {
+				uint8_t XLEN[2] = {};
+				src.src->Read(XLEN, 2);
+				src.src->Seek(XLEN[0] | XLEN[1] << 8); //extra subfields (eg. BGZF block size) are not needed to decode
+			}
+			/* Original file name and comment are zero-terminated latin-1 strings */
+			for (uint8_t flag : { FNAME, FCOMMENT }) {
+				if (FLG & flag) {
+					uint8_t c = 0;
+					do {
+						if (!src.src->TryRead(&c, 1)) { throw std::exception("[GZIP] Unterminated header string!"); }
+					} while (c != 0);
+				}
+			}
+			if (FLG & FHCRC) { src.src->Seek(2); } //header crc16 (not verified)
+		}
+
+		/* Trailers are byte aligned; any bits left over in the current byte are padding */
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Read>::ReadTrailer() {
+			src.ResetBitPointer();
+
+			if (format == Format::ZLIB) {
+				uint8_t adler[4] = {};
+				src.src->Read(adler, 4);
+				if (src.src->GetReadCount() != 4) { throw std::exception("[ZLIB] Missing adler-32 trailer!"); }
+				if (Generic::ConvertEndian(adler) != checksum) { throw std::exception("[ZLIB] Adler-32 mismatch!"); }
+			}
+			else if (format == Format::GZIP) {
+				uint8_t trailer[8] = {};
+				src.src->Read(trailer, 8);
+				if (src.src->GetReadCount() != 8) { throw std::exception("[GZIP] Missing member trailer!"); }
+
+				uint32_t crc = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (uint32_t)trailer[3] << 24;
+				uint32_t isize = trailer[4] | trailer[5] << 8 | trailer[6] << 16 | (uint32_t)trailer[7] << 24;
+				if (crc != checksum) { throw std::exception("[GZIP] CRC-32 mismatch!"); }
+				if (isize != (uint32_t)totalOut) { throw std::exception("[GZIP] Size mismatch!"); }
+
+				/* Another member may follow; anything that isn't a gzip header is treated as trailing padding */
+				uint8_t magic = 0;
+				if (concatenated && src.src->TryRead(&magic, 1)) {
+					src.src->SeekBack(1);
+					if (magic == 0x1F) {
+						amountWritten = 0; //members are independent, so back-references cannot reach into the previous one
+						Init();
+						return;
+					}
+				}
+			}
+
+			state = State::Finished;
 		}
 
 		template<typename Backing>
@@ -57,16 +176,15 @@ namespace ImageLibrary {
 			if (type == BlockType::Stored) {
 				src.ResetBitPointer();
 
-				/* get block length */
-				literalDataLength = 0;
-				src.src->Read((uint8_t*)&literalDataLength, 2);
-				unsigned int complement = 0;
-				src.src->Read((uint8_t*)&complement, 2);
+				/* get block length (LEN, NLEN stored little-endian) */
+				uint8_t lengths[4] = {};
+				src.src->Read(lengths, 4);
+				if (src.src->GetReadCount() != 4) { throw exception("[ZLIB] Truncated stored block!"); }
 
-				literalDataLength = Generic::ConvertEndian((uint8_t*)&literalDataLength);
-				complement = Generic::ConvertEndian((uint8_t*)&complement);
+				literalDataLength = lengths[0] | lengths[1] << 8;
+				uint16_t complement = lengths[2] | lengths[3] << 8;
 
-				if (literalDataLength != ~complement)
+				if (literalDataLength != (uint16_t)~complement)
 					throw exception("Invalid block length!");
 
 			}
@@ -76,6 +194,44 @@ namespace ImageLibrary {
 			else if (type == BlockType::Dynamic) {
 				BuildDynamic();
 			}
+			else {
+				throw exception("[ZLIB] Invalid block type!");
+			}
+			state = State::Decoding;
+		}
+
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Read>::EndOfBlock() {
+			if (final) {
+				state = (format == Format::Raw) ? State::Finished : State::Trailer;
+			}
+			else {
+				state = State::NewBlock;
+			}
+		}
+
+		/* Checksums run over the window region written by the last Loop (which wraps at most once) */
+		template<typename Backing>
+		void ZLIBStream<Backing, Mode::Read>::UpdateChecksum(const unsigned int start, const unsigned int amount) {
+			if (amount == 0) {
+				return;
+			}
+			totalOut += amount;
+			if (format == Format::Raw) {
+				return;
+			}
+
+			unsigned int first = sliding_32k - start;
+			if (first > amount) { first = amount; }
+
+			if (format == Format::ZLIB) {
+				checksum = Generic::checksum::Adler32(source.data() + start, first, checksum);
+				checksum = Generic::checksum::Adler32(source.data(), amount - first, checksum);
+			}
+			else {
+				checksum = Generic::checksum::CRC32(source.data() + start, first, checksum);
+				checksum = Generic::checksum::CRC32(source.data(), amount - first, checksum);
+			}
 		}
 
 		template<typename Backing>
@@ -104,6 +260,7 @@ namespace ImageLibrary {
 			//read code length code lengths; missing lengths are zero
 			int index = 0;
 			for (; index < n_codes; index++) {
+				lengths[order[index]] = 0; //ReadBits only sets bits, so clear what the previous block left behind
 				src.ReadBits((uint8_t*)&lengths[order[index]], 3);
 			}
 			for (; index < MAXCODELENGTHS; index++) { //if the codelengths have not all been defined, set the rest to 0 (since they must not exist)
@@ -213,8 +370,34 @@ namespace ImageLibrary {
 			}
 		}
 
+		template<typename Backing>
+		unsigned int ZLIBStream<Backing, Mode::Read>::ReadAvailable(uint8_t* out, const unsigned int length) {
+			last_read = 0;
+
+			if (written_current_period == 0) {
+				if (state == State::WaitingForRead) {
+					state = State::Decoding;
+				}
+				while (written_current_period == 0 && state != State::Finished) {
+					Loop();
+				}
+			}
+
+			unsigned int amount = length;
+			if (amount > written_current_period) { amount = written_current_period; }
+			if (amount > 0) {
+				ReadSlidingWindow(out, amount);
+			}
+			return amount;
+		}
+
+		template<typename Backing>
+		bool ZLIBStream<Backing, Mode::Read>::IsFinished() {
+			return state == State::Finished && written_current_period == 0;
+		}
+
 		/* Will fill available elements in sliding window 
-		When it encounters eob, it will set state (NewBlock, or Finished if final == true) and then return
+		When it encounters eob, it will set state (NewBlock, or Trailer / Finished if final == true) and then return
 		When it cannot write any more (full), it will set state WaitingForRead
 		*/
 		template<typename Backing>
@@ -231,23 +414,24 @@ namespace ImageLibrary {
 					}
 				}
 
-				/* If stored, just return uncompressed byte; otherwise, need to decode first */
+				/* If stored, copy straight into the window (as much as fits without wrapping); otherwise, need to decode first */
 				if (type == BlockType::Stored) {
-					uint8_t byte = 0;
-					src.src->Read(&byte, 1);
-					literalDataLength--;
 					if (literalDataLength == 0) {
-						if (final) {
-							state = State::Finished;
-						}
-						else {
-							state = State::NewBlock;
-						}
+						EndOfBlock();
 						return;
 					}
-					else {
-						Write(byte);
-					}
+
+					unsigned int amount = literalDataLength;
+					if (amount > sliding_32k - written_current_period) { amount = sliding_32k - written_current_period; }
+					if (amount > sliding_32k - write_pointer) { amount = sliding_32k - write_pointer; }
+
+					src.src->Read(source.data() + write_pointer, amount);
+					if (src.src->GetReadCount() != amount) { throw exception("[ZLIB] Truncated stored block!"); }
+
+					write_pointer = (write_pointer + amount) % sliding_32k;
+					written_current_period += amount;
+					amountWritten = amountWritten + amount > sliding_32k ? sliding_32k : amountWritten + amount;
+					literalDataLength -= amount;
 				}
 				else {
 					int symbol = 0;
@@ -261,12 +445,7 @@ namespace ImageLibrary {
 					if (symbol < 0)
 						throw exception("Invalid Symbol!");
 					if (symbol == 256) {	
-						if (final) {
-							state = State::Finished;
-						}
-						else {
-							state = State::NewBlock;
-						}
+						EndOfBlock();
 						return;
 					}
 					else {
@@ -359,6 +538,7 @@ namespace ImageLibrary {
 		}
 
 		template class ZLIBStream<vector<uint8_t>, Mode::Read>;
+		template class ZLIBStream<span<const uint8_t>, Mode::Read>;
 		template class ZLIBStream<basic_ifstream<uint8_t, std::char_traits<uint8_t>>, Mode::Read>;
 	}
 }
\ No newline at end of file
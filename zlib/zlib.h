@@ -1,9 +1,12 @@
+#pragma once
+
 //implememting specification outlined in https://www.ietf.org/rfc/rfc1951.txt (DEFLATE Compressed Data Format Specification version 1.3)
 /* (remember to put huffman code in Generic namespace - maybe also create a folder and new .h and .cpp files for the huffman stuff too?) */
 
 #include "../interface/data-source.h"
 #include <csetjmp>
 #include "../huffman/huffman.h"
+#include "../checksum/checksum.h"
 #include <array>
 
 namespace ImageLibrary {
@@ -17,6 +20,14 @@ namespace ImageLibrary {
 			Decoding,
 			NewBlock,
 			WaitingForRead,
+			Trailer,
+		};
+
+		/* Framing around the DEFLATE data: zlib (RFC 1950), gzip (RFC 1952) or none at all (raw RFC 1951 blocks) */
+		enum class Format : uint8_t {
+			ZLIB,
+			GZIP,
+			Raw
 		};
 
 		enum class BlockType : uint8_t {
@@ -25,6 +36,58 @@ namespace ImageLibrary {
 			Dynamic
 		};
 
+		/* DEFLATE constants and tables (RFC 1951 3.2.5 - 3.2.6), shared by every inflater */
+		static const short MAXLCODES = 286; //max number of literal/length codes
+		static const short MAXDCODES = 30; //max number of distance codes
+		static const short MAXCODES = MAXLCODES + MAXDCODES;
+		static const short MAXCODELENGTHS = 19;
+		static const short FIXLCODES = 288; //number of fixed literal/length codes
+		static const short MAXBITS = 16;
+
+		static constexpr std::array<short, FIXLCODES> staticLengths{ []() consteval {
+			std::array<short, FIXLCODES> result{};
+			int symbol;
+			for (symbol = 0; symbol < 144; symbol++) {
+				result[symbol] = 8;
+			}
+			for (; symbol < 256; symbol++) {
+				result[symbol] = 9;
+			}
+			for (; symbol < 280; symbol++) {
+				result[symbol] = 7;
+			}
+			for (; symbol < FIXLCODES; symbol++) {
+				result[symbol] = 8;
+			}
+			return result;
+		}() };
+		static constexpr std::array<short, MAXDCODES> staticDistances{ []() consteval {
+			std::array<short, MAXDCODES> result{};
+			int symbol;
+			for (symbol = 0; symbol < MAXDCODES; symbol++) {
+				result[symbol] = 5;
+			}
+			return result;
+		}() };
+		/*short lenCount[MAXBITS] = {}, lenSymbolsStatic[FIXLCODES] = {}, lenSymbolsDynamic[MAXLCODES] = {};
+		short distCount[MAXBITS] = {}, distSymbols[MAXDCODES] = {}; */
+
+		static constexpr const short lens[29] = { //size base for length codes 257..285 
+			3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+			35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static constexpr const short lext[29] = { //extra bits for length codes 257..285
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+			3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		static constexpr const short dists[30] = { //offset base for distance codes 0..29 (dist at least 1 for a length dist pair)
+			1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+			257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+			8193, 12289, 16385, 24577 };
+		static constexpr const short dext[30] = { //extra bits for distance codes 0..29
+			0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+			7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+			12, 12, 13, 13
+		};
+
 		/* Backing determines the backing buffer for the source to the zlibstream */
 		template<typename Backing, Generic::Mode mode>
 		class ZLIBStream : Generic::Data<std::vector<uint8_t>, uint8_t, mode> {};
@@ -34,57 +97,7 @@ namespace ImageLibrary {
 		private:
 			Generic::BitReader<Backing, uint8_t> src;
 
-			static const short MAXLCODES = 286; //max number of literal/length codes
-			static const short MAXDCODES = 30; //max number of distance codes
-			static const short MAXCODES = MAXLCODES + MAXDCODES;
-			static const short MAXCODELENGTHS = 19;
-			static const short FIXLCODES = 288; //number of fixed literal/length codes
-			static const short MAXBITS = 16;
-
 			short lengths[MAXCODES] = {};
-			static constexpr std::array<short, FIXLCODES> staticLengths{ []() consteval {
-				std::array<short, FIXLCODES> result{};
-				int symbol;
-				for (symbol = 0; symbol < 144; symbol++) {
-					result[symbol] = 8;
-				}
-				for (; symbol < 256; symbol++) {
-					result[symbol] = 9;
-				}
-				for (; symbol < 280; symbol++) {
-					result[symbol] = 7;
-				}
-				for (; symbol < FIXLCODES; symbol++) {
-					result[symbol] = 8;
-				}
-				return result;
-			}() };
-			static constexpr std::array<short, MAXDCODES> staticDistances{ []() consteval {
-				std::array<short, MAXDCODES> result{};
-				int symbol;
-				for (symbol = 0; symbol < MAXDCODES; symbol++) {
-					result[symbol] = 5;
-				}
-				return result;
-			}() };
-			/*short lenCount[MAXBITS] = {}, lenSymbolsStatic[FIXLCODES] = {}, lenSymbolsDynamic[MAXLCODES] = {};
-			short distCount[MAXBITS] = {}, distSymbols[MAXDCODES] = {}; */
-
-			static constexpr const short lens[29] = { //size base for length codes 257..285 
-				3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
-				35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
-			static constexpr const short lext[29] = { //extra bits for length codes 257..285
-				0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
-				3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
-			static constexpr const short dists[30] = { //offset base for distance codes 0..29 (dist at least 1 for a length dist pair)
-				1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
-				257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
-				8193, 12289, 16385, 24577 };
-			static constexpr const short dext[30] = { //extra bits for distance codes 0..29
-				0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
-				7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
-				12, 12, 13, 13
-			};
 
 			unsigned int ext_pointer = 0;
 			unsigned int write_pointer = 0;
@@ -108,11 +121,21 @@ namespace ImageLibrary {
 			unsigned long long amountWritten = 0;
 
 			unsigned short literalDataLength = 0;
+
+			Format format = Format::ZLIB;
+			bool concatenated = true; //gzip only; continue with the next member after a trailer
+			uint32_t checksum = 1; //adler-32 (zlib) or crc-32 (gzip) of everything written so far
+			unsigned long long totalOut = 0; //bytes decoded in the current member
 		private:
 			void Loop();
 
 			void Init();
+			void ReadZLIBHeader();
+			void ReadGZIPHeader();
+			void ReadTrailer();
 			void NewBlock();
+			void EndOfBlock();
+			void UpdateChecksum(const unsigned int start, const unsigned int amount);
 
 			void BuildStatic();
 			void BuildDynamic();	
@@ -123,16 +146,160 @@ namespace ImageLibrary {
 
 			void ReadSlidingWindow(uint8_t* out, const unsigned int length);
 		public:
-			/* Gets source to compressed data and constructs 32kb sliding window */
-			ZLIBStream(Generic::Data<Backing, uint8_t, Generic::Mode::Read>* source) : Generic::Data<std::vector<uint8_t>, uint8_t, Generic::Mode::Read>(sliding_32k), src(source) {};
+			/* Gets source to compressed data and constructs 32kb sliding window 
+			For gzip, concatenated controls whether members following the first are decoded as part of the same stream (as gzip -d does) or left unread
+			*/
+			ZLIBStream(Generic::Data<Backing, uint8_t, Generic::Mode::Read>* source, const Format format = Format::ZLIB, const bool concatenated = true) : 
+				Generic::Data<std::vector<uint8_t>, uint8_t, Generic::Mode::Read>(sliding_32k), src(source), format(format), concatenated(concatenated) {};
+
+			/* Starts over on a new stream of the same format, keeping the sliding window's memory */
+			void Reset(Generic::Data<Backing, uint8_t, Generic::Mode::Read>* source);
 
 			void Read(uint8_t* out, const unsigned int length) override;
 			bool TryRead(uint8_t* out, const unsigned int length) override;
+
+			/* Reads up to length bytes, decoding only if nothing is buffered; returns 0 once the stream has been fully consumed (trailer included) */
+			unsigned int ReadAvailable(uint8_t* out, const unsigned int length);
+			bool IsFinished();
+		};
+
+		/* Compression levels as in zlib: 0 only stores, 1 - 3 take the longest match found at each position (greedy), and 4 - 9 also check whether the next position
+		has a longer one (lazy), searching further along the hash chains as the level goes up
+		*/
+		struct DeflateLevel {
+			unsigned short good; //once a match this long is found, the next search only goes a quarter as far
+			unsigned short lazy; //no lazy search after a match this long (greedy levels: matches up to this long get the positions inside them hashed)
+			unsigned short nice; //a match this long ends the search
+			unsigned short chain; //most hash chain entries checked
+			bool lazyMatching;
+		};
+
+		/* How matches are looked for (as zlib's strategies): Default searches the hash chains as far as the level says, HuffmanOnly doesn't look for any,
+		and RLE only looks for runs of the byte before (distance 1), which is far faster and still does well on filtered image data with flat areas
+		*/
+		enum class Strategy : uint8_t {
+			Default,
+			HuffmanOnly,
+			RLE
 		};
 
+		struct DynamicHeader;
+
+		/* The two bytes starting a zlib stream compressed at level (for streams put together from raw pieces, eg. strips compressed on separate threads) */
+		void ZLIBHeader(uint8_t* out, const unsigned int level, const bool dictionary = false);
+
+		/* Every byte written is compressed with LZ77 (matches found through hash chains over a 32K window) & Huffman coding; each block is then written
+		stored, with the static codes or with its own dynamic codes, whichever is smallest
+		Compressed data is passed to destination as it is produced (in pieces of a few kilobytes at most), and the stream ends once Finish is called
+		*/
 		template<typename Backing>
 		class ZLIBStream<Backing, Generic::Mode::Write> : Generic::Data<std::vector<uint8_t>, uint8_t, Generic::Mode::Write> {
+		private:
+			constexpr static unsigned int min_match = 3;
+			constexpr static unsigned int max_match = 258;
+			constexpr static unsigned int min_lookahead = max_match + min_match + 1; //bytes that must be available for the longest match to be found (unless finishing)
+			constexpr static unsigned int hash_bits = 15;
+			constexpr static unsigned int max_symbols = 16384; //symbols of a block before it is written
+			constexpr static unsigned int too_far = 4096; //lazy levels drop 3 byte matches further away than this (they take more bits than 3 literals)
+
+			Generic::BitWriter<Backing, uint8_t> dest;
+
+			Format format = Format::ZLIB;
+			unsigned int level = 6;
+			DeflateLevel config;
+			Strategy strategy = Strategy::Default;
+			bool precomputed = false;
+
+			/* source is the window: the 32K already compressed (which matches can refer back into), then data still to be compressed, up to 64K in all */
+			unsigned int filled = 0; //bytes in the window
+			unsigned int position = 0; //next byte to compress
+			unsigned int blockStart = 0; //window position of the first byte of the block being built
+			unsigned int blockLength = 0; //bytes covered by the symbols of the block so far
+
+			/* Hash chains: head holds the latest position of each hash of 3 bytes, and chain the position before it with the same hash (0 ends a chain) */
+			std::vector<uint16_t> head;
+			std::vector<uint16_t> chain;
+
+			/* Lazy matching: the match found at the previous position, which is only taken if this position doesn't have a longer one */
+			bool matchAvailable = false;
+			unsigned int prevLength = min_match - 1;
+			unsigned int prevDistance = 0;
+
+			/* Symbols of the block being built (a literal, or length - 3 with its distance above it), and how often each code is used */
+			std::vector<uint32_t> symbols;
+			uint32_t literalFrequencies[FIXLCODES] = {};
+			uint32_t distanceFrequencies[MAXDCODES] = {};
+
+			/* Precomputed codes: data is coded as it is written, so the block stays open between writes and a run can carry on into the next write */
+			bool blockOpen = false;
+			bool hasLast = false; //a byte has been written (or was in the dictionary) for runs to repeat
+			uint8_t lastByte = 0;
+			unsigned int run = 0; //repeats of lastByte not coded yet
+
+			bool started = false; //header written
+			bool finished = false;
+			bool hasDictionary = false;
+			uint32_t dictionaryId = 0; //adler-32 of the dictionary, for the zlib header
+			uint32_t checksum = 1;
+			unsigned long long totalIn = 0;
+		private:
+			void WriteHeader();
+			void WriteTrailer();
+			void UpdateChecksum(const uint8_t* in, const unsigned int length);
+
+			void Compress(const bool flush);
+			void CompressStored();
+			void CompressGreedy(const bool flush);
+			void CompressLazy(const bool flush);
+			void CompressHuffman();
+			void CompressRLE(const bool flush);
+			bool Direct() const { return precomputed && strategy != Strategy::Default && level > 0; }
+			void CodeDirect(const uint8_t* in, const unsigned int length);
+			void EndDirectBlock();
+			unsigned int Insert(const unsigned int at);
+			unsigned int LongestMatch(unsigned int candidate, const unsigned int best, unsigned int& distance) const;
+			void Slide();
+
+			inline void Literal(const uint8_t byte);
+			inline void Match(const unsigned int length, const unsigned int distance);
+			void EndBlock(const bool last);
+			void WriteStored(const uint8_t* data, unsigned int length, const bool last);
+			void WriteDynamicHeader(const DynamicHeader& header, const bool last);
+			void WriteSymbols(const uint8_t* literalLengths, const uint16_t* literalCodes, const uint8_t* distanceLengths, const uint16_t* distanceCodes);
+			void EmptyStoredBlock();
+		public:
+			/* Compressed data goes to destination; level is 0 - 9 (as in zlib, 6 being the usual trade-off) */
+			ZLIBStream(Generic::Data<Backing, uint8_t, Generic::Mode::Write>* destination, const unsigned int level = 6, const Format format = Format::ZLIB);
+
+			/* Starts a new stream (to the same destination, unless another is given), keeping the memory of the window & hash chains */
+			void Reset(Generic::Data<Backing, uint8_t, Generic::Mode::Write>* destination = nullptr);
+
+			/* Changes the compression level; only before anything is written (after constructing or Reset) */
+			void SetLevel(const unsigned int level);
+
+			/* Changes how matches are looked for (level 0 still only stores); only before anything is written, like the level
+			With precomputedCodes (HuffmanOnly or RLE only), every block is coded with one table made ahead of time for filtered image data instead of codes built for each block,
+			so data is coded straight from each write without going through the window or being buffered: the fastest way to compress, at some cost in size
+			*/
+			void SetStrategy(const Strategy strategy, const bool precomputedCodes = false);
+
+			/* Primes the window with data that matches can refer back to without it being written itself (only its last 32K is used), eg. the data before
+			a piece of a larger stream compressed on its own; only before anything is written
+			The zlib header records the dictionary's adler-32 for the decoder (which has to be given the same dictionary); gzip has no way to, so throws
+			*/
+			void SetDictionary(const uint8_t* dictionary, unsigned int length);
+
+			void Write(const uint8_t* in, const unsigned int length) override;
+
+			/* Ends the current block and aligns to a byte boundary with an empty stored block (a sync flush), then passes everything so far to destination
+			Matches can still refer back across a flush
+			*/
+			void Flush() override;
+
+			/* Compresses whatever is left, writes the final block & the trailer, and passes everything to destination; nothing more can be written until Reset */
+			void Finish();
 
+			uint32_t Checksum() const { return checksum; } //adler-32 (zlib & raw) or crc-32 (gzip) of everything written so far
 		};
 	}
 }
\ No newline at end of file